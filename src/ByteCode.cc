@@ -3,6 +3,7 @@
 void ByteCode::writeByte(u8 byte, int lineNumber) {
     code_.push_back(byte);
     lineNumbers_.push_back(lineNumber);
+    verified_ = false;
 }
 
 void ByteCode::writeConstantInstr(Value constant, int lineNumber) {
@@ -28,6 +29,10 @@ size ByteCode::writeValue(Value value) {
     return constants_.size() - 1;
 }
 
+size ByteCode::addCache() {
+    return cacheCount_++;
+}
+
 Value ByteCode::getConstantAtOffset(int offset) const {
     return constants_[offset];
 }
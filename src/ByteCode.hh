@@ -9,11 +9,15 @@
 
 class GlangVm;
 class Parser;
+class Program;
+class Sampler;
 
 class ByteCode {
 
     friend GlangVm;
     friend Parser;
+    friend Program;
+    friend Sampler;
 
 public:
     ByteCode() = default;
@@ -32,6 +36,24 @@ public:
 
     void writeByte(u8 byte, int lineNumber);
     size writeValue(Value value);
+    // reserves an inline cache for a property access site
+    size addCache();
+
+    [[nodiscard]] size constantCount() const { return constants_.size(); }
+    [[nodiscard]] size cacheCount() const { return cacheCount_; }
+
+    // the program this code belongs to and its place in it, once it is in one
+    [[nodiscard]] const Program* program() const { return program_; }
+    [[nodiscard]] int index() const { return index_; }
+
+    // filled in by the verifier: the deepest the value stack gets while this
+    // code runs, counted from the frame's first slot
+    [[nodiscard]] int maxStack() const { return maxStack_; }
+    [[nodiscard]] bool verified() const { return verified_; }
+    void markVerified(int maxStack) {
+        maxStack_ = maxStack;
+        verified_ = true;
+    }
 
 private:
     [[nodiscard]] u8 getByte(int offset) const;
@@ -40,4 +62,9 @@ private:
     std::vector<std::uint8_t> code_;
     std::vector<Value> constants_;
     std::vector<int> lineNumbers_;
+    size cacheCount_{};
+    int maxStack_{};
+    bool verified_{};
+    const Program* program_{};
+    int index_{};
 };
\ No newline at end of file
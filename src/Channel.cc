@@ -0,0 +1,512 @@
+#include "Channel.hh"
+#include "Vm.hh"
+#include "natives.hh"
+#include "object.hh"
+#include "array.hh"
+#include "map.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+struct Arena {
+    std::mutex mutex;
+    std::unordered_map<std::string_view, SharedString*> strings; // viewing the blocks' characters
+};
+
+// never destroyed: messages may still hold strings when statics go
+Arena& arena() {
+    static auto* arena = new Arena;
+    return *arena;
+}
+}
+
+SharedString* SharedString::intern(const char* chars, int length, u32 hash) {
+    Arena& strings = arena();
+    std::lock_guard lock{strings.mutex};
+    auto found = strings.strings.find(std::string_view{chars, static_cast<size>(length)});
+    if (found != strings.strings.end()) {
+        found->second->retain();
+        return found->second;
+    }
+
+    void* block = std::malloc(sizeof(SharedString) + length + 1);
+    auto string = new (block) SharedString{length, hash};
+    std::memcpy(string->chars(), chars, length);
+    string->chars()[length] = '\0';
+    strings.strings.emplace(std::string_view{string->chars(), static_cast<size>(length)}, string);
+    return string;
+}
+
+void SharedString::release() {
+    u32 refs = refs_.load(std::memory_order_relaxed);
+    while (refs > 1) {
+        if (refs_.compare_exchange_weak(refs, refs - 1, std::memory_order_acq_rel, std::memory_order_relaxed)) return;
+    }
+
+    // the last reference only goes under the lock, so intern() never
+    // revives a block that is being freed
+    Arena& strings = arena();
+    std::lock_guard lock{strings.mutex};
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    strings.strings.erase(std::string_view{chars(), static_cast<size>(length_)});
+    this->~SharedString();
+    std::free(this);
+}
+
+// how deep arrays and maps nest in a message
+static constexpr int MaxDepth = 64;
+
+Message::Message(Message&& other) noexcept {
+    *this = std::move(other);
+}
+
+Message& Message::operator=(Message&& other) noexcept {
+    if (this == &other) return *this;
+    clear();
+    kind_ = std::exchange(other.kind_, Kind::Nil);
+    std::copy(other.numbers_, other.numbers_ + 3, numbers_);
+    string_ = std::exchange(other.string_, nullptr);
+    packed_ = std::move(other.packed_);
+    items_ = std::move(other.items_);
+    channel_ = std::move(other.channel_);
+    return *this;
+}
+
+Message::~Message() {
+    clear();
+}
+
+void Message::clear() {
+    if (string_ != nullptr) string_->release();
+    string_ = nullptr;
+    packed_.clear();
+    items_.clear();
+    if (channel_ != nullptr) channel_->release();
+    channel_.reset();
+    kind_ = Kind::Nil;
+}
+
+// copies 'string' into the arena the first time it is sent; from then on
+// every copy sent anywhere shares that. The string keeps its own
+// characters, which never move while anything may be reading them.
+static SharedString* share(ObjString* string) {
+    if (string->shared == nullptr) string->shared = SharedString::intern(string->chars, string->length, string->hash);
+    string->shared->retain();
+    return string->shared;
+}
+
+bool Message::from(Value value, Message& message, std::string& error) {
+    message.clear();
+    return from(value, message, error, 0);
+}
+
+bool Message::from(Value value, Message& message, std::string& error, int depth) {
+    if (value.isNil()) {
+        message.kind_ = Kind::Nil;
+    } else if (value.isBool()) {
+        message.kind_ = Kind::Bool;
+        message.numbers_[0] = value.asBool() ? 1 : 0;
+    } else if (value.isNumber()) {
+        message.kind_ = Kind::Number;
+        message.numbers_[0] = value.asNumber();
+    } else if (object::isString(value)) {
+        message.kind_ = Kind::String;
+        message.string_ = share(object::asString(value));
+    } else if (object::isRange(value)) {
+        ObjRange* range = object::asRange(value);
+        message.kind_ = Kind::Range;
+        message.numbers_[0] = range->start;
+        message.numbers_[1] = range->end;
+        message.numbers_[2] = range->step;
+    } else if (object::isChannel(value)) {
+        message.kind_ = Kind::Channel;
+        message.channel_ = object::asChannel(value)->channel;
+        message.channel_->hold();
+    } else if (object::isArray(value) || object::isMap(value)) {
+        if (depth == MaxDepth) {
+            error = fmt::format("Can't send values nested more than {} deep.", MaxDepth);
+            return false;
+        }
+        if (object::isArray(value) && object::asArray(value)->packed) {
+            ObjArray* array = object::asArray(value);
+            message.kind_ = Kind::Numbers;
+            message.packed_.assign(array->numbers, array->numbers + array->count);
+            return true;
+        }
+
+        std::vector<Value> values;
+        if (object::isArray(value)) {
+            ObjArray* array = object::asArray(value);
+            message.kind_ = Kind::Array;
+            values.assign(array->values, array->values + array->count);
+        } else {
+            ObjMap* map = object::asMap(value);
+            message.kind_ = Kind::Map;
+            for (int i = 0; i < map->entryCount; ++i) {
+                if (map->entries[i].deleted) continue;
+                values.push_back(map->entries[i].key);
+                values.push_back(map->entries[i].value);
+            }
+        }
+        message.items_.resize(values.size());
+        for (size i = 0; i < values.size(); ++i) {
+            if (!from(values[i], message.items_[i], error, depth + 1)) return false;
+        }
+    } else {
+        error = fmt::format("Can't send a {} over a channel.", object::kindName(value));
+        return false;
+    }
+    return true;
+}
+
+Value Message::toValue() const {
+    switch (kind_) {
+    case Kind::Nil:
+        return Value::createNil();
+    case Kind::Bool:
+        return Value::createBool(numbers_[0] != 0);
+    case Kind::Number:
+        return Value::createNumber(numbers_[0]);
+    case Kind::String:
+        return Value::createObj(ObjFactory::shareString(string_));
+    case Kind::Range:
+        return Value::createObj(ObjFactory::newRange(numbers_[0], numbers_[1], numbers_[2]));
+    case Kind::Numbers: {
+        auto count = static_cast<int>(packed_.size());
+        ObjArray* array = ObjFactory::newArray(count);
+        if (count > 0) std::memcpy(array->numbers, packed_.data(), sizeof(double) * count);
+        array->count = count;
+        return Value::createObj(array);
+    }
+    case Kind::Array: {
+        ObjArray* array = ObjFactory::newArray(static_cast<int>(items_.size()));
+        for (const auto& item : items_) array::push(array, item.toValue());
+        return Value::createObj(array);
+    }
+    case Kind::Map: {
+        ObjMap* map = ObjFactory::newMap();
+        for (size i = 0; i < items_.size(); i += 2) map::set(map, items_[i].toValue(), items_[i + 1].toValue());
+        return Value::createObj(map);
+    }
+    case Kind::Channel:
+        return Value::createObj(ObjFactory::newChannel(channel_));
+    }
+    return Value::createNil();
+}
+
+Channel::Channel(size capacity)
+    : capacity_{capacity}, cells_{std::make_unique<Cell[]>(capacity)} {
+    for (size i = 0; i < capacity; ++i) cells_[i].sequence.store(2 * i, std::memory_order_relaxed);
+}
+
+// a cell can be written at position p when its sequence is 2p and read
+// when it is 2p + 1; reading it sets it to 2(p + capacity), where it is
+// written next. Doubling keeps the two apart for a single cell.
+bool Channel::trySend(Message& message) {
+    size position = sendPosition_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &cells_[position % capacity_];
+        size sequence = cell->sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<std::ptrdiff_t>(sequence - 2 * position);
+        if (difference == 0) {
+            if (sendPosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = sendPosition_.load(std::memory_order_relaxed);
+        }
+    }
+    cell->message = std::move(message);
+    cell->sequence.store(2 * position + 1, std::memory_order_release);
+
+    // pairs with the fence in wait(): either this sees the receiver
+    // queued or the receiver sees the message
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (receiversWaiting_.load(std::memory_order_relaxed) > 0) wake(receivers_, receiversWaiting_);
+    return true;
+}
+
+bool Channel::tryRecv(Message& message) {
+    size position = recvPosition_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &cells_[position % capacity_];
+        size sequence = cell->sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<std::ptrdiff_t>(sequence - (2 * position + 1));
+        if (difference == 0) {
+            if (recvPosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = recvPosition_.load(std::memory_order_relaxed);
+        }
+    }
+    message = std::move(cell->message);
+    cell->sequence.store(2 * (position + capacity_), std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sendersWaiting_.load(std::memory_order_relaxed) > 0) wake(senders_, sendersWaiting_);
+    return true;
+}
+
+bool Channel::canSend() const {
+    size position = sendPosition_.load(std::memory_order_relaxed);
+    return cells_[position % capacity_].sequence.load(std::memory_order_acquire) == 2 * position;
+}
+
+bool Channel::canRecv() const {
+    size position = recvPosition_.load(std::memory_order_relaxed);
+    return cells_[position % capacity_].sequence.load(std::memory_order_acquire) == 2 * position + 1;
+}
+
+bool Channel::waitToSend(Ticket& ticket) {
+    return wait(ticket, senders_, sendersWaiting_, &Channel::canSend);
+}
+
+bool Channel::waitToRecv(Ticket& ticket) {
+    return wait(ticket, receivers_, receiversWaiting_, &Channel::canRecv);
+}
+
+bool Channel::wait(Ticket& ticket, std::deque<Ticket*>& waiters, std::atomic<int>& waiting,
+                   bool (Channel::*ready)() const) {
+    std::lock_guard lock{mutex_};
+    if (!ticket.queued) {
+        waiters.push_back(&ticket);
+        ticket.queued = true;
+        ticket.posted = false;
+        waiting.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!(this->*ready)()) return true;
+
+    waiters.erase(std::find(waiters.begin(), waiters.end(), &ticket));
+    ticket.queued = false;
+    waiting.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+}
+
+void Channel::wake(std::deque<Ticket*>& waiters, std::atomic<int>& waiting) {
+    std::lock_guard lock{mutex_};
+    if (waiters.empty()) return;
+    Ticket* ticket = waiters.front();
+    waiters.pop_front();
+    waiting.fetch_sub(1, std::memory_order_relaxed);
+    ticket->queued = false;
+    ticket->posted = true;
+    ticket->inbox->post(ticket->fiber);
+}
+
+void Channel::cancel(Ticket& ticket) {
+    auto& waiters = ticket.sending ? senders_ : receivers_;
+    auto& waiting = ticket.sending ? sendersWaiting_ : receiversWaiting_;
+
+    std::unique_lock lock{mutex_};
+    if (ticket.queued) {
+        waiters.erase(std::find(waiters.begin(), waiters.end(), &ticket));
+        waiting.fetch_sub(1, std::memory_order_relaxed);
+        ticket.queued = false;
+        return;
+    }
+    if (!ticket.posted) return;
+
+    // woken for a message, or a free cell, that someone else may need now
+    ticket.posted = false;
+    bool handOn = ticket.sending ? canSend() : canRecv();
+    lock.unlock();
+    if (handOn) wake(waiters, waiting);
+}
+
+namespace natives {
+
+namespace {
+// a fiber waiting to receive from any of 'channels'; with more than one,
+// as select(), the result says which it came from
+class RecvWait : public Wait {
+public:
+    RecvWait(GlangVm& vm, std::vector<ObjChannel*> channels, bool selecting)
+        : channels_{std::move(channels)}, tickets_(channels_.size()), selecting_{selecting} {
+        for (auto& ticket : tickets_) {
+            ticket.inbox = vm.inbox();
+            ticket.fiber = vm.runningFiber();
+        }
+        // where to start looking, so no channel starves the others
+        static thread_local size turn = 0;
+        first_ = turn++ % channels_.size();
+    }
+
+    ~RecvWait() override {
+        for (size i = 0; i < channels_.size(); ++i) channels_[i]->channel->cancel(tickets_[i]);
+    }
+
+    bool resume(Value& result) override {
+        size count = channels_.size();
+        while (true) {
+            for (size i = 0; i < count; ++i) {
+                size index = (first_ + i) % count;
+                Message message;
+                if (!channels_[index]->channel->tryRecv(message)) continue;
+
+                for (size j = 0; j < count; ++j) channels_[j]->channel->cancel(tickets_[j]);
+                result = message.toValue();
+                if (selecting_) {
+                    ObjArray* pair = ObjFactory::newArray(2);
+                    array::push(pair, Value::createNumber(static_cast<double>(index)));
+                    array::push(pair, result);
+                    result = Value::createObj(pair);
+                }
+                return true;
+            }
+
+            // a channel that got a message meanwhile means trying again
+            bool queued = true;
+            for (size i = 0; i < count && queued; ++i) queued = channels_[i]->channel->waitToRecv(tickets_[i]);
+            if (queued) return false;
+        }
+    }
+
+    [[nodiscard]] bool stuck() const override {
+        return std::all_of(channels_.begin(), channels_.end(),
+                           [](ObjChannel* channel) { return channel->channel->holders() == 1; });
+    }
+
+private:
+    std::vector<ObjChannel*> channels_;
+    std::vector<Ticket> tickets_; // by channel, never resized once queued
+    size first_;
+    bool selecting_;
+};
+
+// a fiber waiting for room in a full channel
+class SendWait : public Wait {
+public:
+    SendWait(GlangVm& vm, ObjChannel* channel, Message message)
+        : channel_{channel}, message_{std::move(message)} {
+        ticket_.inbox = vm.inbox();
+        ticket_.fiber = vm.runningFiber();
+        ticket_.sending = true;
+    }
+
+    ~SendWait() override { channel_->channel->cancel(ticket_); }
+
+    bool resume(Value& result) override {
+        while (!channel_->channel->trySend(message_)) {
+            if (channel_->channel->waitToSend(ticket_)) return false;
+        }
+        channel_->channel->cancel(ticket_);
+        result = Value::createNil();
+        return true;
+    }
+
+    [[nodiscard]] bool stuck() const override { return channel_->channel->holders() == 1; }
+
+private:
+    ObjChannel* channel_;
+    Message message_;
+    Ticket ticket_;
+};
+}
+
+// parks the running fiber on 'wait' unless it is over already
+static void await(GlangVm& vm, std::unique_ptr<Wait> wait, Value* args) {
+    if (wait->resume(args[-1])) return;
+    vm.park(std::move(wait));
+}
+
+static ObjChannel* channelArgument(GlangVm& vm, Value value, const char* name) {
+    if (!object::isChannel(value)) {
+        vm.runtimeError("{}() expects a channel.", name);
+        return nullptr;
+    }
+    return object::asChannel(value);
+}
+
+static bool channelNative(GlangVm& vm, int, Value* args) {
+    Value capacity = args[0];
+    if (!capacity.isNumber() || std::trunc(capacity.asNumber()) != capacity.asNumber() || capacity.asNumber() < 1 ||
+        capacity.asNumber() > 1 << 30) {
+        vm.runtimeError("channel() expects a capacity of at least 1.");
+        return false;
+    }
+
+    auto channel = std::make_shared<Channel>(static_cast<size>(capacity.asNumber()));
+    args[-1] = Value::createObj(ObjFactory::newChannel(std::move(channel)));
+    return true;
+}
+
+static bool sendNative(GlangVm& vm, int, Value* args) {
+    ObjChannel* channel = channelArgument(vm, args[0], "send");
+    if (channel == nullptr) return false;
+
+    Message message;
+    std::string error;
+    if (!Message::from(args[1], message, error)) {
+        vm.runtimeError("{}", error);
+        return false;
+    }
+
+    if (channel->channel->trySend(message)) {
+        args[-1] = Value::createNil();
+        return true;
+    }
+    await(vm, std::make_unique<SendWait>(vm, channel, std::move(message)), args);
+    return true;
+}
+
+static bool recvNative(GlangVm& vm, int, Value* args) {
+    ObjChannel* channel = channelArgument(vm, args[0], "recv");
+    if (channel == nullptr) return false;
+
+    Message message;
+    if (channel->channel->tryRecv(message)) {
+        args[-1] = message.toValue();
+        return true;
+    }
+    await(vm, std::make_unique<RecvWait>(vm, std::vector<ObjChannel*>{channel}, false), args);
+    return true;
+}
+
+static bool tryRecvNative(GlangVm& vm, int, Value* args) {
+    ObjChannel* channel = channelArgument(vm, args[0], "try_recv");
+    if (channel == nullptr) return false;
+
+    Message message;
+    args[-1] = channel->channel->tryRecv(message) ? message.toValue() : Value::createNil();
+    return true;
+}
+
+static bool selectNative(GlangVm& vm, int, Value* args) {
+    if (!object::isArray(args[0]) || object::asArray(args[0])->count == 0) {
+        vm.runtimeError("select() expects a non-empty array of channels.");
+        return false;
+    }
+
+    ObjArray* array = object::asArray(args[0]);
+    std::vector<ObjChannel*> channels;
+    for (int i = 0; i < array->count; ++i) {
+        Value element = array::get(array, i);
+        if (!object::isChannel(element)) {
+            vm.runtimeError("select() expects a non-empty array of channels.");
+            return false;
+        }
+        channels.push_back(object::asChannel(element));
+    }
+    await(vm, std::make_unique<RecvWait>(vm, std::move(channels), true), args);
+    return true;
+}
+
+void defineChannels(GlangVm& vm) {
+    vm.defineNative("channel", channelNative, 1);
+    vm.defineNative("send", sendNative, 2);
+    vm.defineNative("recv", recvNative, 1);
+    vm.defineNative("try_recv", tryRecvNative, 1);
+    vm.defineNative("select", selectNative, 1);
+}
+}
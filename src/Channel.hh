@@ -0,0 +1,153 @@
+#pragma once
+
+#include "common.hh"
+#include "Value.hh"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class GlangVm;
+class Inbox;
+struct ObjFiber;
+
+// An immutable string that lives outside every isolate's heap, so strings
+// sent over channels are shared instead of copied. Equal strings are
+// interned into one block, which is freed with its last reference.
+class SharedString {
+public:
+    // the block holding 'chars', with a reference taken for the caller
+    static SharedString* intern(const char* chars, int length, u32 hash);
+
+    void retain() { refs_.fetch_add(1, std::memory_order_relaxed); }
+    void release();
+
+    [[nodiscard]] char* chars() { return reinterpret_cast<char*>(this + 1); }
+    [[nodiscard]] int length() const { return length_; }
+    [[nodiscard]] u32 hash() const { return hash_; }
+
+private:
+    SharedString(int length, u32 hash) : length_{length}, hash_{hash} {}
+
+    std::atomic<u32> refs_{1};
+    int length_;
+    u32 hash_;
+    // the characters follow, terminated
+};
+
+class Channel;
+
+// A value on its way between isolates: everything mutable is copied out
+// of the sender's heap, strings are shared and channels are the channel
+// itself. Functions, classes, instances, fibers and files stay home.
+class Message {
+public:
+    Message() = default;
+    Message(Message&& other) noexcept;
+    Message& operator=(Message&& other) noexcept;
+    ~Message();
+
+    Message(const Message&) = delete;
+    Message& operator=(const Message&) = delete;
+
+    // false, with 'error' set, if 'value' can't be sent
+    static bool from(Value value, Message& message, std::string& error);
+    // the value in the current heap
+    [[nodiscard]] Value toValue() const;
+
+private:
+    enum class Kind : u8 {
+        Nil,
+        Bool,
+        Number,
+        String,
+        Range,
+        Numbers, // a packed array
+        Array,
+        Map, // keys and values, alternating
+        Channel
+    };
+
+    static bool from(Value value, Message& message, std::string& error, int depth);
+    void clear();
+
+    Kind kind_{Kind::Nil};
+    double numbers_[3]{}; // a bool, a number or a range's start, end and step
+    SharedString* string_{};
+    std::vector<double> packed_;
+    std::vector<Message> items_;
+    std::shared_ptr<::Channel> channel_;
+};
+
+// One fiber's place in the queue of those waiting on a channel. It is
+// posted to the fiber's VM when the other side made progress; that is a
+// hint, the fiber tries again and may queue anew.
+struct Ticket {
+    std::shared_ptr<Inbox> inbox;
+    ObjFiber* fiber{};
+    bool sending{};
+    bool queued{}; // the channel's lock guards it
+    bool posted{};
+};
+
+// A bounded multi-producer multi-consumer queue of messages, shared by
+// the isolates holding it. Sending and receiving are lock-free: the ring
+// of cells is Vyukov's, where every cell carries the position it can next
+// be written or read at. Only fibers that found the channel full or empty
+// take the lock, to queue a ticket.
+class Channel {
+public:
+    explicit Channel(size capacity);
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    [[nodiscard]] size capacity() const { return capacity_; }
+
+    // the channel's holders are the heaps with an ObjChannel for it and the
+    // messages carrying it; with just one, only that heap's fibers can ever
+    // send or receive on it
+    void hold() { holders_.fetch_add(1, std::memory_order_relaxed); }
+    void release() { holders_.fetch_sub(1, std::memory_order_acq_rel); }
+    [[nodiscard]] int holders() const { return holders_.load(std::memory_order_acquire); }
+
+    // false, leaving 'message' alone, if the channel is full
+    bool trySend(Message& message);
+    // false if the channel is empty
+    bool tryRecv(Message& message);
+
+    // queue 'ticket' until the channel can take a message, or has one;
+    // false, with nothing queued, if it already can
+    bool waitToSend(Ticket& ticket);
+    bool waitToRecv(Ticket& ticket);
+    // takes 'ticket' off the channel; a wake-up it got for nothing is
+    // handed on
+    void cancel(Ticket& ticket);
+
+private:
+    struct Cell {
+        std::atomic<size> sequence;
+        Message message;
+    };
+
+    [[nodiscard]] bool canSend() const;
+    [[nodiscard]] bool canRecv() const;
+    bool wait(Ticket& ticket, std::deque<Ticket*>& waiters, std::atomic<int>& waiting, bool (Channel::*ready)() const);
+    void wake(std::deque<Ticket*>& waiters, std::atomic<int>& waiting);
+
+    size capacity_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<size> sendPosition_{0};
+    alignas(64) std::atomic<size> recvPosition_{0};
+
+    alignas(64) std::atomic<int> sendersWaiting_{0};
+    std::atomic<int> receiversWaiting_{0};
+    std::mutex mutex_;
+    std::deque<Ticket*> senders_;
+    std::deque<Ticket*> receivers_;
+
+    std::atomic<int> holders_{0};
+};
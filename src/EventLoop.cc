@@ -0,0 +1,612 @@
+#include "EventLoop.hh"
+#include "Vm.hh"
+#include "natives.hh"
+#include "object.hh"
+#include "memory.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+// enough for every fiber of a busy script to have a request in flight
+static constexpr u32 RingEntries = 256;
+
+EventLoop::EventLoop(std::shared_ptr<Inbox> inbox)
+    : inbox_{std::move(inbox)},
+      epollFd_{::epoll_create1(EPOLL_CLOEXEC)},
+      wakeFd_{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)} {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = &wakeFd_;
+    if (epollFd_ < 0 || wakeFd_ < 0 || ::epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &event) < 0) {
+        // out of descriptors, most likely: with nothing to wait on, every
+        // request blocks the thread and the VM waits for posts on its inbox
+        if (wakeFd_ >= 0) ::close(wakeFd_);
+        if (epollFd_ >= 0) ::close(epollFd_);
+        wakeFd_ = epollFd_ = -1;
+        return;
+    }
+    inbox_->setWakeFd(wakeFd_);
+
+    if (setUpRing()) {
+        // the ring's descriptor is readable while completions wait
+        event.data.ptr = &ringFd_;
+        if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, ringFd_, &event) < 0) tearDownRing();
+    }
+}
+
+EventLoop::~EventLoop() {
+    if (epollFd_ < 0) return;
+    inbox_->setWakeFd(-1);
+    tearDownRing();
+    ::close(wakeFd_);
+    ::close(epollFd_);
+}
+
+// the rings are shared with the kernel; without a kernel that has them,
+// or one that reads at a descriptor's current position, the loop polls
+bool EventLoop::setUpRing() {
+    io_uring_params params{};
+    auto fd = static_cast<int>(::syscall(__NR_io_uring_setup, RingEntries, &params));
+    if (fd < 0) return false;
+    if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(u32);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+
+    auto map = [&](size length, off_t offset) {
+        return ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    };
+    sqRing_ = map(sqRingSize_, IORING_OFF_SQ_RING);
+    cqRing_ = single ? sqRing_ : map(cqRingSize_, IORING_OFF_CQ_RING);
+    sqes_ = map(sqesSize_, IORING_OFF_SQES);
+    if (sqRing_ == MAP_FAILED || cqRing_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+        if (sqes_ != MAP_FAILED) ::munmap(sqes_, sqesSize_);
+        if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_) ::munmap(cqRing_, cqRingSize_);
+        if (sqRing_ != MAP_FAILED) ::munmap(sqRing_, sqRingSize_);
+        ::close(fd);
+        return false;
+    }
+
+    auto at = [](void* ring, u32 offset) { return reinterpret_cast<u32*>(static_cast<char*>(ring) + offset); };
+    sqTail_ = at(sqRing_, params.sq_off.tail);
+    sqMask_ = at(sqRing_, params.sq_off.ring_mask);
+    sqArray_ = at(sqRing_, params.sq_off.array);
+    cqHead_ = at(cqRing_, params.cq_off.head);
+    cqTail_ = at(cqRing_, params.cq_off.tail);
+    cqMask_ = at(cqRing_, params.cq_off.ring_mask);
+    cqes_ = static_cast<char*>(cqRing_) + params.cq_off.cqes;
+    cqEntries_ = params.cq_entries;
+    ringFd_ = fd;
+    return true;
+}
+
+void EventLoop::tearDownRing() {
+    if (ringFd_ < 0) return;
+    ::munmap(sqes_, sqesSize_);
+    if (cqRing_ != sqRing_) ::munmap(cqRing_, cqRingSize_);
+    ::munmap(sqRing_, sqRingSize_);
+    ::close(ringFd_);
+    ringFd_ = -1;
+}
+
+void EventLoop::prepare(int fd) {
+    // a read of a blocking pipe would block the thread; the ring waits
+    // for data itself
+    if (ringFd_ < 0 && epollFd_ >= 0) ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+void EventLoop::perform(IoRequest& request) {
+    ssize_t result;
+    do {
+        result = request.kind == IoRequest::Kind::Read ? ::read(request.fd, request.buffer, request.length)
+                                                       : ::write(request.fd, request.buffer, request.length);
+    } while (result < 0 && errno == EINTR);
+    request.result = result < 0 ? -errno : result;
+}
+
+bool EventLoop::start(IoRequest& request) {
+    if (ringFd_ >= 0) {
+        submit(&request, request.kind == IoRequest::Kind::Read ? IORING_OP_READ : IORING_OP_WRITE);
+        request.pending = true;
+        return true;
+    }
+
+    perform(request);
+    if (request.result != -EAGAIN || epollFd_ < 0) return false;
+
+    epoll_event event{};
+    event.events = (request.kind == IoRequest::Kind::Read ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT;
+    event.data.ptr = &request;
+    ::epoll_ctl(epollFd_, EPOLL_CTL_ADD, request.fd, &event);
+    ++watching_;
+    request.pending = true;
+    return true;
+}
+
+// one entry at a time, entered at once, so the submission ring never
+// fills; the completion ring could, and is drained first
+void EventLoop::submit(IoRequest* request, u8 opcode) {
+    while (inFlight_ >= cqEntries_) waitForCompletion();
+
+    u32 tail = *sqTail_;
+    u32 index = tail & *sqMask_;
+    auto entry = static_cast<io_uring_sqe*>(sqes_) + index;
+    std::memset(entry, 0, sizeof(*entry));
+    entry->opcode = opcode;
+    if (opcode == IORING_OP_ASYNC_CANCEL) {
+        entry->fd = -1;
+        entry->addr = reinterpret_cast<u64>(request);
+        entry->user_data = 0;
+    } else {
+        entry->fd = request->fd;
+        entry->addr = reinterpret_cast<u64>(request->buffer);
+        entry->len = static_cast<u32>(std::min<size>(request->length, INT_MAX));
+        entry->off = static_cast<u64>(-1); // the current position
+        entry->user_data = reinterpret_cast<u64>(request);
+    }
+    sqArray_[index] = index;
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    ++inFlight_;
+
+    while (::syscall(__NR_io_uring_enter, ringFd_, 1, 0, 0, nullptr, 0) < 0 && errno == EINTR) {
+    }
+}
+
+void EventLoop::waitForCompletion() {
+    while (::syscall(__NR_io_uring_enter, ringFd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno == EINTR) {
+    }
+    reap();
+}
+
+void EventLoop::reap() {
+    u32 head = *cqHead_;
+    u32 tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        auto completion = static_cast<io_uring_cqe*>(cqes_) + (head & *cqMask_);
+        auto request = reinterpret_cast<IoRequest*>(completion->user_data);
+        --inFlight_;
+        if (request == nullptr) continue; // a cancellation's own
+        request->result = completion->res;
+        request->pending = false;
+        done_.push_back(request->fiber);
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+}
+
+void EventLoop::cancel(IoRequest& request) {
+    if (!request.pending) return;
+    if (ringFd_ < 0) {
+        ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, request.fd, nullptr);
+        --watching_;
+        request.pending = false;
+        return;
+    }
+
+    submit(&request, IORING_OP_ASYNC_CANCEL);
+    while (request.pending) waitForCompletion();
+}
+
+void EventLoop::poll(bool block, std::vector<ObjFiber*>& woken) {
+    if (ringFd_ >= 0) reap();
+    if (!done_.empty()) block = false;
+
+    // completions are in the ring's memory, so only blocking or watched
+    // pipes need the kernel
+    if (epollFd_ >= 0 && (block || watching_ > 0)) {
+        epoll_event events[16];
+        int count = ::epoll_wait(epollFd_, events, 16, block ? -1 : 0);
+        for (int i = 0; i < count; ++i) {
+            void* tag = events[i].data.ptr;
+            if (tag == &wakeFd_) {
+                u64 posts;
+                [[maybe_unused]] auto got = ::read(wakeFd_, &posts, sizeof(posts));
+            } else if (tag == &ringFd_) {
+                reap();
+            } else {
+                auto request = static_cast<IoRequest*>(tag);
+                perform(*request);
+                if (request->result == -EAGAIN) {
+                    // woken for nothing: watch again
+                    epoll_event event{};
+                    event.events = (request->kind == IoRequest::Kind::Read ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT;
+                    event.data.ptr = request;
+                    ::epoll_ctl(epollFd_, EPOLL_CTL_MOD, request->fd, &event);
+                    continue;
+                }
+                ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, request->fd, nullptr);
+                --watching_;
+                request->pending = false;
+                done_.push_back(request->fiber);
+            }
+        }
+    }
+
+    woken.insert(woken.end(), done_.begin(), done_.end());
+    done_.clear();
+}
+
+// what one read of a file of unknown size, or of lines, asks for
+static constexpr size ReadSize = 64 * 1024;
+
+namespace {
+// a fiber reading a whole file or a command's output into a buffer that
+// becomes the string's characters
+class ReadWait : public Wait {
+public:
+    ReadWait(GlangVm& vm, int fd, pid_t pid, size expected)
+        : vm_{vm}, fd_{fd}, pid_{pid}, expected_{expected} {
+        request_.fd = fd;
+        request_.fiber = vm.runningFiber();
+        // the terminator included, a file of known size needs no growing
+        capacity_ = expected > 0 ? expected + 1 : ReadSize;
+        buffer_ = memory::allocate<char>(capacity_);
+    }
+
+    ~ReadWait() override {
+        vm_.eventLoop().cancel(request_);
+        if (buffer_ != nullptr) {
+            // a command whose output is not wanted any more is stopped
+            if (pid_ > 0) ::kill(pid_, SIGTERM);
+            memory::free(buffer_, capacity_);
+        }
+        finish();
+    }
+
+    bool resume(Value& result) override {
+        while (!request_.pending) {
+            if (started_) {
+                started_ = false;
+                if (request_.result < 0) {
+                    result = Value::createNil();
+                    return true;
+                }
+                length_ += request_.result;
+                if (request_.result == 0 || length_ == expected_) {
+                    result = Value::createObj(takeBuffer());
+                    return true;
+                }
+            }
+            if (capacity_ - length_ == 1) {
+                buffer_ = static_cast<char*>(memory::reallocate(buffer_, capacity_, capacity_ * 2));
+                capacity_ *= 2;
+            }
+
+            request_.buffer = buffer_ + length_;
+            request_.length = capacity_ - 1 - length_;
+            started_ = true;
+            vm_.eventLoop().start(request_);
+        }
+        return false;
+    }
+
+    [[nodiscard]] bool stuck() const override { return false; }
+
+private:
+    // the buffer, trimmed, handed to the string as it is
+    ObjString* takeBuffer() {
+        finish();
+        if (capacity_ > length_ + 1) buffer_ = static_cast<char*>(memory::reallocate(buffer_, capacity_, length_ + 1));
+        buffer_[length_] = '\0';
+        ObjString* string = ObjFactory::takeString(buffer_, static_cast<int>(length_));
+        buffer_ = nullptr;
+        return string;
+    }
+
+    void finish() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        if (pid_ > 0) ::waitpid(pid_, nullptr, 0);
+        pid_ = 0;
+    }
+
+    GlangVm& vm_;
+    IoRequest request_;
+    int fd_;
+    pid_t pid_;
+    size expected_; // a regular file's size, read up to; 0 for up to the end
+    char* buffer_;
+    size capacity_;
+    size length_{};
+    bool started_{};
+};
+
+// a fiber writing a string out; the string's characters never move, so
+// the kernel reads them where they are
+class WriteWait : public Wait {
+public:
+    WriteWait(GlangVm& vm, int fd, ObjString* string)
+        : vm_{vm}, fd_{fd}, string_{string} {
+        request_.kind = IoRequest::Kind::Write;
+        request_.fd = fd;
+        request_.fiber = vm.runningFiber();
+    }
+
+    ~WriteWait() override {
+        vm_.eventLoop().cancel(request_);
+        ::close(fd_);
+    }
+
+    bool resume(Value& result) override {
+        while (!request_.pending) {
+            if (started_) {
+                started_ = false;
+                if (request_.result < 0) {
+                    result = Value::createBool(false);
+                    return true;
+                }
+                written_ += request_.result;
+            }
+            if (written_ == static_cast<size>(string_->length)) {
+                result = Value::createBool(true);
+                return true;
+            }
+
+            request_.buffer = string_->chars + written_;
+            request_.length = string_->length - written_;
+            started_ = true;
+            vm_.eventLoop().start(request_);
+        }
+        return false;
+    }
+
+    [[nodiscard]] bool stuck() const override { return false; }
+
+private:
+    GlangVm& vm_;
+    IoRequest request_;
+    int fd_;
+    ObjString* string_;
+    size written_{};
+    bool started_{};
+};
+
+// a loop over lines that ran out of them, waiting for the next read
+class LinesWait : public Wait {
+public:
+    LinesWait(GlangVm& vm, ObjLines* lines)
+        : vm_{vm}, lines_{lines} {
+        request_.fd = lines->fd;
+        request_.buffer = lines->buffer + lines->end;
+        request_.length = lines->capacity - lines->end;
+        request_.fiber = vm.runningFiber();
+    }
+
+    ~LinesWait() override {
+        vm_.eventLoop().cancel(request_);
+        release();
+    }
+
+    IoRequest& request() { return request_; }
+
+    // another loop over the same lines, to try again once the read is over
+    void queue(ObjFiber* fiber) { queued_.push_back(fiber); }
+
+    bool resume(Value& result) override;
+    [[nodiscard]] bool stuck() const override { return false; }
+    [[nodiscard]] bool retries() const override { return true; }
+
+private:
+    void release();
+
+    GlangVm& vm_;
+    ObjLines* lines_;
+    IoRequest request_;
+    std::vector<ObjFiber*> queued_;
+};
+
+// a loop over lines another loop is reading into, posted by that loop's
+// wait once the read is over
+class LinesQueueWait : public Wait {
+public:
+    bool resume(Value&) override { return true; }
+    [[nodiscard]] bool stuck() const override { return false; }
+    [[nodiscard]] bool retries() const override { return true; }
+};
+}
+
+// a read into 'lines' gave 'result'; an error ends the lines like the end
+// of the file does
+static void received(ObjLines* lines, std::int64_t result) {
+    if (result > 0) {
+        lines->end += static_cast<int>(result);
+        return;
+    }
+    ::close(lines->fd);
+    lines->fd = -1;
+    if (lines->pid > 0) ::waitpid(lines->pid, nullptr, 0);
+    lines->pid = 0;
+}
+
+bool LinesWait::resume(Value&) {
+    if (request_.pending) return false;
+    received(lines_, request_.result);
+    release();
+    return true;
+}
+
+// the buffer may move again: the loops queued behind the read go on
+void LinesWait::release() {
+    if (lines_->read != this) return;
+    lines_->read = nullptr;
+    for (ObjFiber* fiber : queued_) vm_.inbox()->post(fiber);
+    queued_.clear();
+}
+
+namespace io {
+Line nextLine(GlangVm& vm, ObjLines* lines, ObjString*& line) {
+    while (true) {
+        char* start = lines->buffer + lines->start;
+        int unread = lines->end - lines->start;
+        auto newline = static_cast<char*>(unread > 0 ? std::memchr(start, '\n', unread) : nullptr);
+        if (newline != nullptr) {
+            line = ObjFactory::copyString(start, static_cast<int>(newline - start));
+            lines->start += static_cast<int>(newline - start) + 1;
+            return Line::Next;
+        }
+        if (lines->fd < 0) {
+            // the last line may lack its newline
+            if (unread == 0) return Line::Done;
+            line = ObjFactory::copyString(start, unread);
+            lines->start = lines->end;
+            return Line::Next;
+        }
+
+        if (lines->read != nullptr) {
+            static_cast<LinesWait*>(lines->read)->queue(vm.runningFiber());
+            vm.park(std::make_unique<LinesQueueWait>());
+            return Line::Parked;
+        }
+
+        // the partial line moves to the front; the buffer only grows once
+        // it is all one line
+        if (lines->start > 0) {
+            std::memmove(lines->buffer, start, unread);
+            lines->start = 0;
+            lines->end = unread;
+        }
+        if (lines->end == lines->capacity) {
+            int capacity = std::max(static_cast<int>(ReadSize), lines->capacity * 2);
+            lines->buffer = static_cast<char*>(memory::reallocate(lines->buffer, lines->capacity, capacity));
+            lines->capacity = capacity;
+        }
+
+        auto wait = std::make_unique<LinesWait>(vm, lines);
+        if (vm.eventLoop().start(wait->request())) {
+            lines->read = wait.get();
+            vm.park(std::move(wait));
+            return Line::Parked;
+        }
+        received(lines, wait->request().result);
+    }
+}
+}
+
+namespace natives {
+
+// parks the running fiber on 'wait' unless it is over already
+static void await(GlangVm& vm, std::unique_ptr<Wait> wait, Value* args) {
+    if (wait->resume(args[-1])) return;
+    vm.park(std::move(wait));
+}
+
+static int openPath(GlangVm& vm, Value path, int flags, const char* name) {
+    if (!object::isString(path)) {
+        vm.runtimeError("{}() expects a path.", name);
+        return -1;
+    }
+    int fd = ::open(object::asCString(path), flags | O_CLOEXEC, 0666);
+    if (fd < 0) vm.runtimeError("{}() could not open '{}'.", name, object::asCString(path));
+    return fd;
+}
+
+// starts 'command' with the shell, its output going into a pipe whose
+// read end is returned; -1, with an error reported, if it can't be run
+static int startCommand(GlangVm& vm, Value command, pid_t& pid, const char* name) {
+    if (!object::isString(command)) {
+        vm.runtimeError("{}() expects a command.", name);
+        return -1;
+    }
+
+    int ends[2];
+    if (::pipe2(ends, O_CLOEXEC) != 0) {
+        vm.runtimeError("{}() could not run '{}'.", name, object::asCString(command));
+        return -1;
+    }
+    posix_spawn_file_actions_t actions;
+    ::posix_spawn_file_actions_init(&actions);
+    ::posix_spawn_file_actions_adddup2(&actions, ends[1], STDOUT_FILENO);
+    const char* argv[] = {"sh", "-c", object::asCString(command), nullptr};
+
+    // what the script printed so far comes before the command's output
+    vm.output().flush();
+    int error = ::posix_spawn(&pid, "/bin/sh", &actions, nullptr, const_cast<char* const*>(argv), environ);
+    ::posix_spawn_file_actions_destroy(&actions);
+    ::close(ends[1]);
+    if (error != 0) {
+        ::close(ends[0]);
+        vm.runtimeError("{}() could not run '{}'.", name, object::asCString(command));
+        return -1;
+    }
+
+    vm.eventLoop().prepare(ends[0]);
+    return ends[0];
+}
+
+static bool readFileNative(GlangVm& vm, int, Value* args) {
+    int fd = openPath(vm, args[0], O_RDONLY, "readFile");
+    if (fd < 0) return false;
+
+    struct stat info{};
+    size expected = ::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) ? static_cast<size>(info.st_size) : 0;
+    await(vm, std::make_unique<ReadWait>(vm, fd, 0, expected), args);
+    return true;
+}
+
+static bool writeFileNative(GlangVm& vm, int, Value* args) {
+    if (!object::isString(args[1])) {
+        vm.runtimeError("writeFile() expects a string to write.");
+        return false;
+    }
+    int fd = openPath(vm, args[0], O_WRONLY | O_CREAT | O_TRUNC, "writeFile");
+    if (fd < 0) return false;
+
+    await(vm, std::make_unique<WriteWait>(vm, fd, object::asString(args[1])), args);
+    return true;
+}
+
+static bool readLinesNative(GlangVm& vm, int, Value* args) {
+    int fd = openPath(vm, args[0], O_RDONLY, "readLines");
+    if (fd < 0) return false;
+
+    args[-1] = Value::createObj(ObjFactory::newLines(fd, 0));
+    return true;
+}
+
+static bool readCommandNative(GlangVm& vm, int, Value* args) {
+    pid_t pid;
+    int fd = startCommand(vm, args[0], pid, "readCommand");
+    if (fd < 0) return false;
+
+    await(vm, std::make_unique<ReadWait>(vm, fd, pid, 0), args);
+    return true;
+}
+
+static bool commandLinesNative(GlangVm& vm, int, Value* args) {
+    pid_t pid;
+    int fd = startCommand(vm, args[0], pid, "commandLines");
+    if (fd < 0) return false;
+
+    args[-1] = Value::createObj(ObjFactory::newLines(fd, pid));
+    return true;
+}
+
+void defineIo(GlangVm& vm) {
+    vm.defineNative("readFile", readFileNative, 1);
+    vm.defineNative("writeFile", writeFileNative, 2);
+    vm.defineNative("readLines", readLinesNative, 1);
+    vm.defineNative("readCommand", readCommandNative, 1);
+    vm.defineNative("commandLines", commandLinesNative, 1);
+}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "common.hh"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class GlangVm;
+class Inbox;
+struct ObjFiber;
+struct ObjLines;
+struct ObjString;
+
+// One read or write a parked fiber waits for. It must stay where it is
+// until it is no longer pending.
+struct IoRequest {
+    enum class Kind : u8 {
+        Read,
+        Write
+    };
+
+    Kind kind{Kind::Read};
+    int fd{-1};
+    char* buffer{};
+    size length{};
+    ObjFiber* fiber{};    // woken once the request is done
+    std::int64_t result{}; // bytes transferred, or -errno
+    bool pending{};
+};
+
+// The I/O side of one VM. Reads and writes go to an io_uring when the
+// kernel has one; without it, pipes are polled with epoll and files, which
+// epoll considers always ready, are read and written at once. Either way
+// the loop also waits for posts to the VM's inbox, so a VM with nothing to
+// run sleeps here for I/O and messages alike. A loop that could not get
+// its epoll set does every request at once, blocking the thread.
+class EventLoop {
+public:
+    explicit EventLoop(std::shared_ptr<Inbox> inbox);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // readies a descriptor from pipe() for the loop
+    void prepare(int fd);
+    // starts 'request' at the descriptor's current position; false, with
+    // its result set, if it finished at once
+    bool start(IoRequest& request);
+    // stops 'request', waiting for the kernel to let go of its buffer
+    void cancel(IoRequest& request);
+
+    // appends the fibers whose requests are done; if 'block', waits for
+    // one, or for a post to the inbox
+    void poll(bool block, std::vector<ObjFiber*>& woken);
+    // false if the loop could not get its descriptors, and so neither
+    // waits in poll() nor hears of posts
+    [[nodiscard]] bool waits() const { return epollFd_ >= 0; }
+
+private:
+    bool setUpRing();
+    void tearDownRing();
+    void submit(IoRequest* request, u8 opcode);
+    void waitForCompletion();
+    void reap();
+    static void perform(IoRequest& request);
+
+    std::shared_ptr<Inbox> inbox_;
+    int epollFd_{-1};
+    int wakeFd_{-1}; // the eventfd posts write to
+    std::vector<ObjFiber*> done_;
+    int watching_{}; // descriptors in the epoll set for requests
+
+    // the ring, mapped from the kernel; ringFd_ is -1 without one
+    int ringFd_{-1};
+    void* sqRing_{};
+    size sqRingSize_{};
+    void* cqRing_{};
+    size cqRingSize_{};
+    void* sqes_{};
+    size sqesSize_{};
+    u32* sqTail_{};
+    u32* sqMask_{};
+    u32* sqArray_{};
+    u32* cqHead_{};
+    u32* cqTail_{};
+    u32* cqMask_{};
+    void* cqes_{};
+    u32 cqEntries_{};
+    u32 inFlight_{}; // entries whose completion is still to come
+};
+
+namespace io {
+enum class Line {
+    Next,
+    Done,
+    Parked // the running fiber was parked until more is read
+};
+
+// the next line of 'lines', without its newline, in 'line'
+Line nextLine(GlangVm& vm, ObjLines* lines, ObjString*& line);
+}
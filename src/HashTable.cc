@@ -1,6 +1,8 @@
 #include "HashTable.hh"
 #include "object.hh"
 
+#include <cstring>
+
 std::size_t Hasher::operator()(ObjString* key) const noexcept {
     return key->hash;
 }
@@ -26,6 +28,13 @@ std::optional<Value> HashTable::get(ObjString* key) {
     return iter->second;
 }
 
+Value* HashTable::find(ObjString* key) {
+
+    auto iter = map_.find(key);
+    if (iter == map_.end()) return nullptr;
+    return &iter->second;
+}
+
 bool HashTable::deleteEntry(ObjString* key) {
 
     auto iter = map_.find(key);
@@ -38,8 +47,15 @@ bool HashTable::deleteEntry(ObjString* key) {
 }
 
 ObjString* HashTable::findString(const char* chars, int length, u32 hash) {
+    if (map_.empty()) return nullptr;
 
-    for (auto& [key, value] : map_) {
+    // keys hash by their hash alone, so a stand-in with the same hash
+    // finds the one bucket an equal string can be in
+    ObjString probe{};
+    probe.hash = hash;
+    size bucket = map_.bucket(&probe);
+    for (auto iter = map_.begin(bucket); iter != map_.end(bucket); ++iter) {
+        ObjString* key = iter->first;
         if (key->length == length && key->hash == hash && std::memcmp(key->chars, chars, length) == 0) {
             return key;
         }
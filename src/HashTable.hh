@@ -27,9 +27,15 @@ public:
 
     bool set(ObjString* key, Value value);
     std::optional<Value> get(ObjString* key);
+    // where the value of 'key' is stored, or nullptr; it stays put until
+    // the key is deleted
+    Value* find(ObjString* key);
     bool deleteEntry(ObjString* key);
     ObjString* findString(const char* chars, int length, u32 hash);
 
+    [[nodiscard]] auto begin() const { return map_.begin(); }
+    [[nodiscard]] auto end() const { return map_.end(); }
+
 private:
     std::unordered_map<ObjString*, Value, Hasher> map_;
 };
\ No newline at end of file
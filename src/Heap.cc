@@ -0,0 +1,26 @@
+#include "Heap.hh"
+#include "object.hh"
+#include "Channel.hh"
+
+thread_local Heap* Heap::current_ = nullptr;
+
+Heap::~Heap() {
+    // before the ObjChannels, which may hold the last references
+    releaseChannels();
+
+    Obj* object = objects_;
+    while (object != nullptr) {
+        Obj* next = object->next;
+        ObjFactory::freeObject(object);
+        object = next;
+    }
+}
+
+void Heap::holdChannel(Channel* channel) {
+    if (channels_[channel]++ == 0) channel->hold();
+}
+
+void Heap::releaseChannels() {
+    for (const auto& [channel, count] : channels_) channel->release();
+    channels_.clear();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.hh"
+#include "HashTable.hh"
+
+#include <unordered_map>
+
+struct Obj;
+class ObjFactory;
+class Channel;
+
+// A set of objects and the table their strings are interned in, freed
+// together with the heap. ObjFactory allocates into the heap that is
+// current on the calling thread (see Scope).
+class Heap {
+    friend ObjFactory;
+
+public:
+    Heap() = default;
+    ~Heap();
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    // there must be one: every allocation goes through it
+    static Heap& current() { return *current_; }
+
+    // counts an ObjChannel made for 'channel'; the first makes the heap one
+    // of the channel's holders
+    void holdChannel(Channel* channel);
+    // stops holding the channels, for a heap nothing will run in until it
+    // makes ObjChannels for them again
+    void releaseChannels();
+
+    // makes 'heap' current on this thread until the scope ends
+    class Scope {
+    public:
+        explicit Scope(Heap& heap)
+            : previous_{current_} { current_ = &heap; }
+        ~Scope() { current_ = previous_; }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Heap* previous_;
+    };
+
+private:
+    HashTable strings_; // the intern table
+    Obj* objects_{};    // newest first
+    std::unordered_map<Channel*, int> channels_; // held, with their ObjChannels here
+
+    static thread_local Heap* current_;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.hh"
+
+struct ObjShape;
+struct ObjFunction;
+
+struct CacheEntry {
+    ObjShape* shape;
+    ObjShape* transition; // SetProperty: the shape after adding the field, or nullptr
+    ObjFunction* method;  // GetProperty/Invoke: the class method to use, or nullptr
+    int slot;             // field slot, -1 when 'method' is used
+};
+
+// A per-site inline cache for property access. It stays monomorphic while
+// one shape flows through the site, grows up to 'Size' shapes and then
+// goes megamorphic: the site stops caching and always does the lookup.
+struct PropertyCache {
+    static constexpr int Size = 4;
+
+    int count;
+    bool megamorphic;
+    CacheEntry entries[Size];
+
+    [[nodiscard]] const CacheEntry* find(const ObjShape* shape) const {
+        for (int i = 0; i < count; ++i) {
+            if (entries[i].shape == shape) return &entries[i];
+        }
+        return nullptr;
+    }
+
+    void add(const CacheEntry& entry) {
+        if (megamorphic) return;
+        if (count == Size) {
+            megamorphic = true;
+            count = 0;
+            return;
+        }
+        entries[count++] = entry;
+    }
+};
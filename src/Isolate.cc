@@ -0,0 +1,77 @@
+#include "Isolate.hh"
+#include "object.hh"
+#include "array.hh"
+#include "Statistics.hh"
+
+Isolate::Isolate() {
+    // the VM interns its natives' names, which already needs the heap
+    Scope scope{*this};
+    vm_ = std::make_unique<GlangVm>();
+}
+
+Result Isolate::interpret(const std::string& code, const RunOptions& options) {
+    Statistics* stats = options.stats;
+
+    if (stats != nullptr) stats->begin(Statistics::Compile);
+    ProgramRef program = Program::compile(code, vm_->output());
+    if (stats != nullptr) stats->end(Statistics::Compile);
+
+    if (program == nullptr) {
+        return Result::CompileError;
+    }
+    if (stats != nullptr) stats->recordCode(program->script());
+
+    if (options.disassemble != nullptr) {
+        debug::disassembleProgram(program->script(), *options.disassemble, stderr);
+    }
+
+    return run(program, options);
+}
+
+Result Isolate::run(const ProgramRef& program, const RunOptions& options) {
+    Scope scope{*this};
+    Statistics* stats = options.stats;
+
+    GlangVm& vm = *vm_;
+    vm.setProfiler(options.profiler);
+    vm.setSampler(options.sampler);
+    vm.setTracer(options.tracer);
+    vm.setCounting(stats != nullptr);
+
+    u64 executed = vm.instructionsExecuted();
+    if (stats != nullptr) stats->begin(Statistics::Run);
+    auto result = vm.interpret(program);
+    if (stats != nullptr) {
+        stats->end(Statistics::Run);
+        stats->recordInstructions(vm.instructionsExecuted() - executed);
+    }
+
+    vm.output().flush();
+    return result;
+}
+
+std::optional<Value> Isolate::global(std::string_view name) {
+    Scope scope{*this};
+    ObjString* key = ObjFactory::copyString(name.data(), static_cast<int>(name.size()));
+    return vm_->globals_.get(key);
+}
+
+void Isolate::setGlobal(std::string_view name, Value value) {
+    Scope scope{*this};
+    ObjString* key = ObjFactory::copyString(name.data(), static_cast<int>(name.size()));
+    vm_->globals_.set(key, value);
+}
+
+void Isolate::setArguments(const std::vector<std::string>& arguments) {
+    Scope scope{*this};
+    ObjArray* array = ObjFactory::newArray(0);
+    for (const auto& argument : arguments) {
+        array::push(array, Value::createObj(ObjFactory::copyString(argument.data(), static_cast<int>(argument.size()))));
+    }
+    setGlobal("args", Value::createObj(array));
+}
+
+Result interpret(const std::string& code, const RunOptions& options) {
+    Isolate isolate;
+    return isolate.interpret(code, options);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.hh"
+#include "Heap.hh"
+#include "Program.hh"
+#include "Vm.hh"
+
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// An independent runtime: its own heap, string table and globals, with
+// nothing shared with other isolates. Any number of isolates can run
+// side by side on different threads, but each one must only be used by
+// one thread at a time.
+//
+// Objects are allocated in the isolate that is current on the calling
+// thread (see Scope) and live until that isolate is destroyed.
+class Isolate {
+public:
+    Isolate();
+    ~Isolate() = default;
+
+    Isolate(const Isolate&) = delete;
+    Isolate& operator=(const Isolate&) = delete;
+
+    // compiles and runs 'code'; the globals it defines stay visible to
+    // later calls on the same isolate. Compile errors go to the VM's output
+    // like runtime ones.
+    Result interpret(const std::string& code, const RunOptions& options = {});
+    // runs a program compiled once, possibly shared with other isolates
+    Result run(const ProgramRef& program, const RunOptions& options = {});
+
+    // the value of the global 'name', if a script has defined it
+    std::optional<Value> global(std::string_view name);
+    // defines or overwrites the global 'name'
+    void setGlobal(std::string_view name, Value value);
+    // the script's command-line arguments, as the global array 'args'
+    void setArguments(const std::vector<std::string>& arguments);
+
+    GlangVm& vm() { return *vm_; }
+
+    // makes 'isolate' current on this thread until the scope ends
+    class Scope {
+    public:
+        explicit Scope(Isolate& isolate)
+            : heap_{isolate.heap_} {}
+
+    private:
+        Heap::Scope heap_;
+    };
+
+private:
+    Heap heap_; // outlives the VM, whose globals point into it
+    std::unique_ptr<GlangVm> vm_;
+};
+
+// compiles and runs 'code' in an isolate of its own
+Result interpret(const std::string& code, const RunOptions& options = {});
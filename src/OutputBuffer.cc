@@ -0,0 +1,71 @@
+#include "OutputBuffer.hh"
+#include "object.hh"
+
+#include <iterator>
+#include <unistd.h>
+
+OutputBuffer::OutputBuffer(std::FILE* stream)
+    : stream_{stream},
+      lineBuffered_{isatty(fileno(stream)) != 0} {
+}
+
+OutputBuffer::OutputBuffer(WriteFn write, void* userdata)
+    : stream_{stdout},
+      write_{write},
+      userdata_{userdata},
+      lineBuffered_{false} {
+}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+void OutputBuffer::write(Value value) {
+    switch (value.type) {
+    case ValNumber:
+        fmt::format_to(std::back_inserter(buffer_), "{}", value.asNumber());
+        break;
+    case ValBool:
+        write(value.asBool() ? "True" : "False");
+        break;
+    case ValNil:
+        write("Nil");
+        break;
+    case ValObj:
+        if (object::isString(value)) {
+            ObjString* string = object::asString(value);
+            buffer_.append(string->chars, string->chars + string->length);
+        } else {
+            write(object::toString(value));
+        }
+        break;
+    }
+}
+
+void OutputBuffer::write(std::string_view text) {
+    buffer_.append(text.data(), text.data() + text.size());
+}
+
+void OutputBuffer::newline() {
+    buffer_.push_back('\n');
+    if (lineBuffered_ || buffer_.size() >= Threshold) flush();
+}
+
+void OutputBuffer::flush() {
+    if (buffer_.size() == 0) return;
+
+    if (write_ != nullptr) {
+        write_(buffer_.data(), buffer_.size(), userdata_);
+    } else {
+        std::fwrite(buffer_.data(), 1, buffer_.size(), stream_);
+        std::fflush(stream_);
+    }
+    buffer_.clear();
+}
+
+void OutputBuffer::redirect(WriteFn write, void* userdata, bool lineBuffered) {
+    flush();
+    write_ = write;
+    userdata_ = userdata;
+    lineBuffered_ = write == nullptr ? isatty(fileno(stream_)) != 0 : lineBuffered;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "common.hh"
+#include "Value.hh"
+
+#include <cstdio>
+#include <string_view>
+
+// Collects the program's output and hands it to the stream in large
+// writes: when 'Threshold' bytes are pending, on flush() and on
+// destruction. Values are formatted straight into the buffer. A terminal
+// gets line buffering so interactive output shows up as it is printed.
+// Instead of a stream, the output can go to a function, for embedders,
+// line buffered if they ask for it.
+class OutputBuffer {
+public:
+    using WriteFn = void (*)(const char* text, size length, void* userdata);
+
+    explicit OutputBuffer(std::FILE* stream = stdout);
+    OutputBuffer(WriteFn write, void* userdata);
+    ~OutputBuffer();
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void write(Value value);
+    void write(std::string_view text);
+    void newline();
+    void flush();
+    // sends what follows to 'write', or back to the stream if it is nullptr;
+    // 'lineBuffered' hands 'write' every line as it ends
+    void redirect(WriteFn write, void* userdata, bool lineBuffered = false);
+
+private:
+    static constexpr size Threshold = 64 * 1024;
+
+    std::FILE* stream_;
+    WriteFn write_{};
+    void* userdata_{};
+    bool lineBuffered_;
+    fmt::memory_buffer buffer_;
+};
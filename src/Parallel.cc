@@ -0,0 +1,449 @@
+#include "Parallel.hh"
+#include "Channel.hh"
+#include "HashTable.hh"
+#include "Isolate.hh"
+#include "object.hh"
+#include "array.hh"
+#include "map.hh"
+#include "memory.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <pthread.h>
+#include <signal.h>
+
+static thread_local bool t_inPool = false;
+
+WorkerPool& WorkerPool::shared() {
+    static WorkerPool pool{static_cast<int>(std::max(1u, std::thread::hardware_concurrency())) - 1};
+    return pool;
+}
+
+WorkerPool::WorkerPool(int threads) {
+    // the threads inherit a mask that keeps the profiler's SIGPROF off them:
+    // its handler reads the sampled VM's stack, which lives on another thread
+    sigset_t profSet;
+    sigset_t previousSet;
+    sigemptyset(&profSet);
+    sigaddset(&profSet, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &profSet, &previousSet);
+    for (int i = 1; i <= threads; ++i) threads_.emplace_back(&WorkerPool::work, this, i);
+    pthread_sigmask(SIG_SETMASK, &previousSet, nullptr);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard lock{mutex_};
+        stopping_ = true;
+    }
+    started_.notify_all();
+    for (auto& thread : threads_) thread.join();
+}
+
+void WorkerPool::run(const std::function<void(int)>& task) {
+    if (t_inPool || threads_.empty()) {
+        task(0);
+        return;
+    }
+
+    std::lock_guard job{jobMutex_};
+    {
+        std::lock_guard lock{mutex_};
+        task_ = &task;
+        running_ = static_cast<int>(threads_.size());
+        ++generation_;
+    }
+    started_.notify_all();
+
+    t_inPool = true;
+    task(0);
+    t_inPool = false;
+
+    std::unique_lock lock{mutex_};
+    finished_.wait(lock, [&] { return running_ == 0; });
+    task_ = nullptr;
+}
+
+void WorkerPool::work(int index) {
+    t_inPool = true;
+    u64 seen = 0;
+    while (true) {
+        const std::function<void(int)>* task;
+        {
+            std::unique_lock lock{mutex_};
+            started_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+            if (stopping_) return;
+            seen = generation_;
+            task = task_;
+        }
+
+        (*task)(index);
+
+        {
+            std::lock_guard lock{mutex_};
+            --running_;
+        }
+        finished_.notify_one();
+    }
+}
+
+namespace parallel {
+
+// chunks per worker: enough to even out bodies that cost more in some
+// parts of the range than in others, few enough that a chunk is long
+static constexpr std::int64_t ChunksPerWorker = 8;
+// how deep arrays and maps of them are copied into the workers
+static constexpr int MaxDepth = 16;
+// heap bytes a worker's loops may leave behind before its isolate, which
+// only frees them at its end, is replaced
+static constexpr u64 MaxRetained = 64 * 1024 * 1024;
+
+namespace {
+// the chunks [front, back) a worker has left; it takes them from the
+// front, others steal them from the back
+struct alignas(64) Deque {
+    std::mutex mutex;
+    std::int64_t front{};
+    std::int64_t back{};
+};
+
+struct Job {
+    const HashTable* globals;
+    ObjFunction* body;
+    double start;
+    double step;
+    std::int64_t count;
+    std::int64_t chunks;
+    Value identity;
+
+    std::unique_ptr<Deque[]> deques; // by worker
+    std::vector<Value> partials;     // by chunk
+    std::vector<std::string> output; // by worker
+    std::atomic<bool> failed{};
+    std::atomic<bool> notNumber{};
+};
+
+// the isolate a thread runs loop bodies in, kept from one loop to the next
+// so that a later loop only sets its globals again
+struct Worker {
+    std::unique_ptr<Isolate> isolate;
+    ProgramRef program; // of the bodies it ran; another one gets a fresh isolate
+    std::unordered_map<ObjString*, u64> names; // the globals loops set, by the last loop to
+    u64 loops{};
+    u64 retained{};
+    bool busy{}; // running a body, which may start a loop of its own
+};
+}
+
+static thread_local Worker t_worker;
+
+// readies 'value' for the workers, on the loop's own thread: strings get
+// the copy of their characters the workers' strings point at, and arrays
+// holding nothing a worker needs a copy of are made read-only and lent to
+// them as they are, recorded in 'lent'. True if 'value' can be lent.
+static bool lend(Value value, std::vector<ObjArray*>& lent, int depth = 0) {
+    if (!value.isObj() || object::isFunction(value)) return true;
+    if (object::isString(value)) {
+        ObjString* string = object::asString(value);
+        if (string->shared == nullptr) string->shared = SharedString::intern(string->chars, string->length, string->hash);
+        return false;
+    }
+    if (depth == MaxDepth) return false;
+
+    if (object::isMap(value)) {
+        // maps find string keys by identity, so they are copied
+        ObjMap* map = object::asMap(value);
+        for (int i = 0; i < map->entryCount; ++i) {
+            if (map->entries[i].deleted) continue;
+            lend(map->entries[i].key, lent, depth + 1);
+            lend(map->entries[i].value, lent, depth + 1);
+        }
+        return false;
+    }
+    if (!object::isArray(value)) return false;
+
+    // lent already, by the loop running the one starting now
+    ObjArray* array = object::asArray(value);
+    if (array->lent) return true;
+
+    // packed, no worker's builtin changes it in place
+    bool lendable = array->packed || array::pack(array);
+    if (!lendable) {
+        lendable = true;
+        for (int i = 0; i < array->count; ++i) lendable = lend(array->values[i], lent, depth + 1) && lendable;
+    }
+    if (lendable) {
+        array->lent = true;
+        lent.push_back(array);
+    }
+    return lendable;
+}
+
+// a copy of 'value' in the current heap; false, with the value that could
+// not be copied in 'refused', for what workers can't have
+static bool share(Value value, Value& copy, Value& refused, int depth = 0) {
+    if (!value.isObj() || object::isFunction(value)) {
+        // functions belong to their program, which nothing changes
+        copy = value;
+        return true;
+    }
+    if (object::isString(value)) {
+        ObjString* string = object::asString(value);
+        copy = Value::createObj(string->shared != nullptr ? ObjFactory::shareString(string->shared)
+                                                          : ObjFactory::copyString(string->chars, string->length));
+        return true;
+    }
+    if (object::isChannel(value)) {
+        copy = Value::createObj(ObjFactory::newChannel(object::asChannel(value)->channel));
+        return true;
+    }
+    if (object::isRange(value)) {
+        ObjRange* range = object::asRange(value);
+        copy = Value::createObj(ObjFactory::newRange(range->start, range->end, range->step));
+        return true;
+    }
+    if (!(object::isArray(value) || object::isMap(value)) || depth == MaxDepth) {
+        refused = value;
+        return false;
+    }
+
+    if (object::isMap(value)) {
+        ObjMap* map = object::asMap(value);
+        ObjMap* copied = ObjFactory::newMap();
+        for (int i = 0; i < map->entryCount; ++i) {
+            const MapEntry& entry = map->entries[i];
+            if (entry.deleted) continue;
+            Value key;
+            Value item;
+            if (!share(entry.key, key, refused, depth + 1) || !share(entry.value, item, refused, depth + 1)) return false;
+            map::set(copied, key, item);
+        }
+        // a write would only reach this worker's copy
+        copied->readOnly = true;
+        copy = Value::createObj(copied);
+        return true;
+    }
+
+    ObjArray* array = object::asArray(value);
+    if (array->lent) {
+        copy = value;
+        return true;
+    }
+    ObjArray* copied = ObjFactory::newArray(array->count);
+    if (array->packed) {
+        if (array->count > 0) std::memcpy(copied->numbers, array->numbers, sizeof(double) * array->count);
+        copied->count = array->count;
+    } else {
+        for (int i = 0; i < array->count; ++i) {
+            Value element;
+            if (!share(array->values[i], element, refused, depth + 1)) return false;
+            array::push(copied, element);
+        }
+    }
+    copied->readOnly = true;
+    copy = Value::createObj(copied);
+    return true;
+}
+
+// what a worker was refused, for the error if the body uses it
+static std::string describe(Value refused) {
+    if (object::isArray(refused) || object::isMap(refused)) {
+        return fmt::format("arrays and maps nested more than {} deep", MaxDepth);
+    }
+    const char* kind = object::kindName(refused);
+    return fmt::format("{} {}", std::strchr("aeiou", kind[0]) != nullptr ? "an" : "a", kind);
+}
+
+static void appendOutput(const char* text, size length, void* userdata) {
+    static_cast<std::string*>(userdata)->append(text, length);
+}
+
+static bool takeChunk(Job& job, int worker, int workers, std::int64_t& chunk) {
+    {
+        Deque& own = job.deques[worker];
+        std::lock_guard lock{own.mutex};
+        if (own.front < own.back) {
+            chunk = own.front++;
+            return true;
+        }
+    }
+    for (int i = 1; i < workers; ++i) {
+        Deque& victim = job.deques[(worker + i) % workers];
+        std::lock_guard lock{victim.mutex};
+        if (victim.front < victim.back) {
+            chunk = --victim.back;
+            return true;
+        }
+    }
+    return false;
+}
+
+// gives 'worker' the job's globals; natives are its own. What it can't
+// have is left undefined, and named as such if the body uses it. False if
+// a global an earlier loop set is gone, which only a fresh isolate forgets.
+static bool setGlobals(Job& job, Worker& worker) {
+    Isolate& isolate = *worker.isolate;
+    GlangVm& vm = isolate.vm();
+    u64 loop = ++worker.loops;
+    vm.clearUnshared();
+    for (const auto& [name, value] : *job.globals) {
+        if (object::isNative(value)) continue;
+        std::string_view key{name->chars, static_cast<size>(name->length)};
+        Value copy;
+        Value refused;
+        if (share(value, copy, refused)) {
+            isolate.setGlobal(key, copy);
+            worker.names[ObjFactory::copyString(name->chars, name->length)] = loop;
+        } else {
+            vm.markUnshared(key, describe(refused));
+        }
+    }
+    return std::all_of(worker.names.begin(), worker.names.end(), [&](const auto& set) { return set.second == loop; });
+}
+
+static void setUp(Job& job, Worker& worker, int index) {
+    const Program* program = job.body->byteCode.program();
+    if (worker.isolate != nullptr && (worker.program.get() != program || worker.retained > MaxRetained)) {
+        worker.isolate.reset();
+    }
+    while (true) {
+        if (worker.isolate == nullptr) {
+            worker.isolate = std::make_unique<Isolate>();
+            worker.program = program->shared_from_this();
+            worker.names.clear();
+            worker.retained = 0;
+            worker.isolate->vm().setGlobalsReadOnly(true);
+        }
+        Isolate::Scope scope{*worker.isolate};
+        worker.isolate->vm().output().redirect(appendOutput, &job.output[index]);
+        if (setGlobals(job, worker)) return;
+        worker.isolate.reset();
+    }
+}
+
+static void work(Job& job, int worker, int workers) {
+    // a body that starts a loop of its own runs it in isolates made for it
+    Worker nested;
+    Worker& self = t_worker.busy ? nested : t_worker;
+    bool ready = false; // set up once there is a chunk to run
+    u64 heapSize = memory::g_stats.heapSize;
+
+    std::int64_t chunk;
+    while (!job.failed.load(std::memory_order_relaxed) && takeChunk(job, worker, workers, chunk)) {
+        if (!ready) {
+            setUp(job, self, worker);
+            self.busy = true;
+            ready = true;
+        }
+        Isolate* isolate = self.isolate.get();
+        Isolate::Scope scope{*isolate};
+
+        std::int64_t first = job.count * chunk / job.chunks;
+        std::int64_t last = job.count * (chunk + 1) / job.chunks;
+        Value args[] = {
+            Value::createNumber(static_cast<double>(first)),
+            Value::createNumber(static_cast<double>(last)),
+            Value::createNumber(job.start),
+            Value::createNumber(job.step),
+            job.identity,
+        };
+        Value partial;
+        OutputBuffer& output = isolate->vm().output();
+        output.flush();
+        size printed = job.output[worker].size();
+        if (isolate->vm().callFunction(job.body, 5, args, partial) != Result::Ok) {
+            // one error is enough: the others' are dropped
+            if (job.failed.exchange(true)) job.output[worker].resize(printed);
+            break;
+        }
+        if (!job.identity.isNil() && !partial.isNumber()) {
+            job.notNumber.store(true);
+            job.failed.store(true);
+            break;
+        }
+        job.partials[chunk] = partial;
+    }
+    if (!ready) return;
+
+    self.isolate->vm().output().flush();
+    self.isolate->vm().output().redirect(nullptr, nullptr);
+    {
+        // the channels it was given are only used again once given anew
+        Isolate::Scope scope{*self.isolate};
+        Heap::current().releaseChannels();
+    }
+    self.busy = false;
+    if (memory::g_stats.heapSize > heapSize) self.retained += memory::g_stats.heapSize - heapSize;
+}
+
+// how many values 'range' holds, or -1 if it is endless
+static std::int64_t countOf(ObjRange* range) {
+    double count = std::ceil((range->end - range->start) / range->step);
+    if (!std::isfinite(count) || count > 9007199254740992.0) return -1;
+    return count > 0 ? static_cast<std::int64_t>(count) : 0;
+}
+
+bool run(GlangVm& vm, const HashTable& globals, ObjFunction* body, ObjRange* range, Reduction reduction, Value& result) {
+    std::int64_t count = countOf(range);
+    if (count < 0) {
+        vm.runtimeError("A parallel loop needs a finite range.");
+        return false;
+    }
+
+    WorkerPool& pool = WorkerPool::shared();
+    int workers = pool.size();
+
+    Job job;
+    job.globals = &globals;
+    job.body = body;
+    job.start = range->start;
+    job.step = range->step;
+    job.count = count;
+    job.chunks = std::min(count, workers * ChunksPerWorker);
+    job.identity = reduction == Reduction::None      ? Value::createNil()
+                   : reduction == Reduction::Product ? Value::createNumber(1)
+                                                     : Value::createNumber(0);
+    job.deques = std::make_unique<Deque[]>(workers);
+    for (int i = 0; i < workers; ++i) {
+        job.deques[i].front = job.chunks * i / workers;
+        job.deques[i].back = job.chunks * (i + 1) / workers;
+    }
+    job.partials.assign(job.chunks, job.identity);
+    job.output.resize(workers);
+
+    if (job.chunks > 0) {
+        std::vector<ObjArray*> lent;
+        for (const auto& [name, value] : globals) lend(value, lent);
+        pool.run([&](int worker) { work(job, worker, workers); });
+        for (ObjArray* array : lent) array->lent = false;
+    }
+
+    OutputBuffer& output = vm.output();
+    for (const auto& text : job.output) output.write(text);
+    if (job.notNumber.load()) {
+        vm.runtimeError("A parallel loop can only reduce numbers.");
+        return false;
+    }
+    if (job.failed.load()) {
+        output.flush();
+        return false;
+    }
+
+    result = job.identity;
+    for (Value partial : job.partials) {
+        if (reduction == Reduction::Sum) {
+            result = Value::createNumber(result.asNumber() + partial.asNumber());
+        } else if (reduction == Reduction::Product) {
+            result = Value::createNumber(result.asNumber() * partial.asNumber());
+        }
+    }
+    return true;
+}
+}
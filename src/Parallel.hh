@@ -0,0 +1,68 @@
+#pragma once
+
+#include "common.hh"
+#include "instructions.hh"
+#include "Value.hh"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class GlangVm;
+class HashTable;
+struct ObjFunction;
+struct ObjRange;
+
+// Threads that stay around for the life of the process, one per core with
+// the caller counted in, so a parallel loop does not pay for starting any.
+class WorkerPool {
+public:
+    static WorkerPool& shared();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    [[nodiscard]] int size() const { return static_cast<int>(threads_.size()) + 1; }
+
+    // calls 'task' once for every worker index in [0, size()), the caller
+    // taking 0, and returns when all calls have. Jobs from different
+    // threads take turns; a task that starts a job of its own gets the
+    // calling thread alone, as index 0.
+    void run(const std::function<void(int)>& task);
+
+private:
+    explicit WorkerPool(int threads);
+    ~WorkerPool();
+
+    void work(int index);
+
+private:
+    std::vector<std::thread> threads_;
+    std::mutex jobMutex_; // held for a whole job
+
+    std::mutex mutex_;
+    std::condition_variable started_;
+    std::condition_variable finished_;
+    const std::function<void(int)>* task_{};
+    u64 generation_{}; // bumped for every job
+    int running_{};
+    bool stopping_{};
+};
+
+namespace parallel {
+// Runs a 'parallel for': 'body', as the parser built it, over 'range',
+// which is cut into chunks that the workers take from their own deque
+// and, once that is empty, steal from the back of the others'. Each
+// worker thread keeps an isolate of its own from loop to loop, in which
+// writing a global fails. Functions, and arrays of numbers and functions,
+// are used as they are, read-only while the loop runs; strings share their
+// characters; other arrays, maps, ranges and channels are copied, the
+// arrays and maps read-only too, as a write would be lost with the copy. The
+// chunks' accumulators are combined in range order, so the result does not
+// depend on who ran what. What the workers print is written to 'vm' once
+// they are done. False, with the error written, if the body failed on any
+// of them.
+bool run(GlangVm& vm, const HashTable& globals, ObjFunction* body, ObjRange* range, Reduction reduction, Value& result);
+}
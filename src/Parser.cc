@@ -10,15 +10,18 @@ static bool identifiersEqual(Token* a, Token* b) {
 
 // clang-format off
 ParseRule Parser::rules_[] = {
-    [TokenLeftParen]    = {&Parser::grouping, nullptr, Precedence::None},
+    [TokenLeftParen]    = {&Parser::grouping, &Parser::call, Precedence::Call},
     [TokenRightParen]   = {nullptr, nullptr, Precedence::None},
-    [TokenLeftBrace]    = {nullptr, nullptr, Precedence::None},
+    [TokenLeftBrace]    = {&Parser::mapLiteral, nullptr, Precedence::None},
     [TokenRightBrace]   = {nullptr, nullptr, Precedence::None},
+    [TokenLeftBracket]  = {&Parser::arrayLiteral, &Parser::index, Precedence::Call},
+    [TokenRightBracket] = {nullptr, nullptr, Precedence::None},
     [TokenComma]        = {nullptr, nullptr, Precedence::None},
-    [TokenDot]          = {nullptr, nullptr, Precedence::None},
+    [TokenDot]          = {nullptr, &Parser::dot, Precedence::Call},
     [TokenMinus]        = {&Parser::unary, &Parser::binary, Precedence::Term},
     [TokenPlus]         = {nullptr, &Parser::binary, Precedence::Term},
     [TokenSemiColon]    = {nullptr, nullptr, Precedence::None},
+    [TokenColon]        = {nullptr, nullptr, Precedence::None},
     [TokenSlash]        = {nullptr, &Parser::binary, Precedence::Factor},
     [TokenStar]         = {nullptr, &Parser::binary, Precedence::Factor},
     [TokenNot]          = {&Parser::unary, nullptr, Precedence::None},
@@ -44,10 +47,14 @@ ParseRule Parser::rules_[] = {
     [TokenPrint]        = {nullptr, nullptr, Precedence::None},
     [TokenReturn]       = {nullptr, nullptr, Precedence::None},
     [TokenParent]       = {nullptr, nullptr, Precedence::None},
-    [TokenThis]         = {nullptr, nullptr, Precedence::None},
+    [TokenThis]         = {&Parser::this_, nullptr, Precedence::None},
     [TokenTrue]         = {&Parser::literal, nullptr, Precedence::None},
     [TokenDef]          = {nullptr, nullptr, Precedence::None},
     [TokenWhile]        = {nullptr, nullptr, Precedence::None},
+    [TokenYield]        = {nullptr, nullptr, Precedence::None},
+    [TokenIn]           = {nullptr, nullptr, Precedence::None},
+    [TokenParallel]     = {nullptr, nullptr, Precedence::None},
+    [TokenReduce]       = {nullptr, nullptr, Precedence::None},
     [TokenError]        = {nullptr, nullptr, Precedence::None},
     [TokenEof]          = {nullptr, nullptr, Precedence::None},
 };
@@ -58,8 +65,8 @@ ParseRule* Parser::getRule(TokenType type) {
     return &rules_[type];
 }
 
-Parser::Parser(Scanner& scanner, ByteCode& byteCode) : scanner_{scanner},
-                                                       byteCode_{byteCode} {}
+Parser::Parser(Scanner& scanner, Compiler& compiler, OutputBuffer& errors)
+    : scanner_{scanner}, compiler_{&compiler}, errors_{errors} {}
 
 void Parser::advance() {
     previous_ = current_;
@@ -94,27 +101,27 @@ void Parser::errorAt(Token& token, std::string_view msg) {
 
     panicMode_ = true;
 
-    fmt::print("[line {}] Error", token.line);
+    errors_.write(fmt::format("[line {}] Error", token.line));
 
     if (token.type == TokenEof) {
-        fmt::print(" at end");
+        errors_.write(" at end");
     } else if (token.type == TokenError) {
         // Nothing
     } else {
-        fmt::print(" at '{}'", token.name);
+        errors_.write(fmt::format(" at '{}'", token.name));
     }
 
-    fmt::print(": {}\n", msg);
+    errors_.write(fmt::format(": {}", msg));
+    errors_.newline();
     hadError_ = true;
-    DEBUG_BREAK();
 }
 
 void Parser::emitByte(u8 byte) {
-    byteCode_.writeByte(byte, previous_.line);
+    currentByteCode().writeByte(byte, previous_.line);
 }
 
 void Parser::emitOpCode(OpCode code) {
-    byteCode_.writeOpCode(code, previous_.line);
+    currentByteCode().writeOpCode(code, previous_.line);
 }
 
 void Parser::emitOpCodes(OpCode code1, OpCode code2) {
@@ -122,6 +129,11 @@ void Parser::emitOpCodes(OpCode code1, OpCode code2) {
     emitOpCode(code2);
 }
 void Parser::emitReturn() {
+    if (compiler_->type == FunctionType::Initializer) {
+        emitOpCodeAndOperand(OpCode::GetLocal, 0);
+    } else {
+        emitOpCode(OpCode::Nil);
+    }
     emitOpCode(OpCode::Return);
 }
 
@@ -132,19 +144,38 @@ void Parser::emitOpCodeAndOperand(OpCode code, u8 operand) {
 
 void Parser::emitConstant(Value value) {
     // byteCode_.writeConstantInstr(value, previous_.line);
-    auto operand = byteCode_.writeValue(value);
+    emitOpCodeAndOperand(OpCode::Constant, makeConstant(value));
+}
+
+u8 Parser::makeConstant(Value value) {
+    auto operand = currentByteCode().writeValue(value);
 
     if (operand > UINT8_MAX) {
         error("Too many constants in one chunk");
-        return;
+        return 0;
     }
 
-    emitOpCodeAndOperand(OpCode::Constant, static_cast<u8>(operand));
+    return static_cast<u8>(operand);
+}
+
+void Parser::emitShort(u16 value) {
+    emitByte((value >> 8) & 0xff);
+    emitByte(value & 0xff);
+}
+
+void Parser::emitCacheSlot() {
+    auto cache = currentByteCode().addCache();
+    if (cache > UINT16_MAX) {
+        error("Too many property accesses in one function.");
+        return;
+    }
+    emitShort(static_cast<u16>(cache));
 }
+
 void Parser::emitLoop(int loopstart) {
     emitOpCode(OpCode::Loop);
 
-    auto offset = byteCode_.codeSize() - loopstart + 2;
+    auto offset = currentByteCode().codeSize() - loopstart + 2;
     if (offset > UINT16_MAX) error("Loop body too large");
 
     emitByte((offset >> 8) & 0xff);
@@ -286,6 +317,106 @@ void Parser::string(bool canAssign) {
     emitConstant(Value::createObj(ObjFactory::copyString(previous_.name.data() + 1, previous_.name.length() - 2)));
 }
 
+void Parser::call(bool canAssign) {
+    u8 argCount = argumentList();
+    lastCall_ = static_cast<int>(currentByteCode().codeSize());
+    emitOpCodeAndOperand(OpCode::Call, argCount);
+}
+
+void Parser::arrayLiteral(bool canAssign) {
+    int count = 0;
+    if (!check(TokenRightBracket)) {
+        do {
+            if (check(TokenRightBracket)) break; // trailing comma
+            expression();
+            if (count == UINT8_MAX) {
+                error("Can't have more than 255 elements in an array literal.");
+            }
+            count++;
+        } while (match(TokenComma));
+    }
+
+    consume(TokenRightBracket, "Expect ']' after array elements.");
+    emitOpCodeAndOperand(OpCode::BuildArray, static_cast<u8>(count));
+}
+
+// a '{' that starts a statement opens a block, so map literals only
+// appear where an expression is expected
+void Parser::mapLiteral(bool canAssign) {
+    int count = 0;
+    if (!check(TokenRightBrace)) {
+        do {
+            if (check(TokenRightBrace)) break; // trailing comma
+            expression();
+            consume(TokenColon, "Expect ':' after map key.");
+            expression();
+            if (count == UINT8_MAX) {
+                error("Can't have more than 255 entries in a map literal.");
+            }
+            count++;
+        } while (match(TokenComma));
+    }
+
+    consume(TokenRightBrace, "Expect '}' after map entries.");
+    emitOpCodeAndOperand(OpCode::BuildMap, static_cast<u8>(count));
+}
+
+void Parser::dot(bool canAssign) {
+    consume(TokenIdentifier, "Expect property name after '.'.");
+    u8 name = identifierConstant(&previous_);
+
+    if (canAssign && match(TokenEqual)) {
+        expression();
+        emitOpCodeAndOperand(OpCode::SetProperty, name);
+        emitCacheSlot();
+    } else if (match(TokenLeftParen)) {
+        u8 argCount = argumentList();
+        emitOpCodeAndOperand(OpCode::Invoke, name);
+        emitByte(argCount);
+        emitCacheSlot();
+    } else {
+        emitOpCodeAndOperand(OpCode::GetProperty, name);
+        emitCacheSlot();
+    }
+}
+
+void Parser::this_(bool canAssign) {
+    if (classDepth_ == 0) {
+        error("Can't use 'this' outside of a class.");
+        return;
+    }
+
+    variable(false);
+}
+
+void Parser::index(bool canAssign) {
+    expression();
+    consume(TokenRightBracket, "Expect ']' after index.");
+
+    if (canAssign && match(TokenEqual)) {
+        expression();
+        emitOpCode(OpCode::IndexSet);
+    } else {
+        emitOpCode(OpCode::IndexGet);
+    }
+}
+
+u8 Parser::argumentList() {
+    u8 argCount = 0;
+    if (!check(TokenRightParen)) {
+        do {
+            expression();
+            if (argCount == UINT8_MAX) {
+                error("Can't have more than 255 arguments.");
+            }
+            argCount++;
+        } while (match(TokenComma));
+    }
+
+    consume(TokenRightParen, "Expect ')' after arguments.");
+    return argCount;
+}
+
 void Parser::variable(bool canAssigns) {
     namedVariable(previous_, canAssigns);
 }
@@ -303,21 +434,29 @@ int Parser::resolveLocal(Compiler* compiler, Token* name) {
     return -1;
 }
 
+// the innermost parallel loop body 'compiler' is part of, if any
+static Compiler* parallelBody(Compiler* compiler) {
+    while (compiler != nullptr && compiler->type != FunctionType::Parallel) compiler = compiler->enclosing;
+    return compiler;
+}
+
 void Parser::namedVariable(Token name, bool canAssign) {
 
     OpCode getOp, setOp;
-    int arg = resolveLocal(g_current, &name);
+    int arg = resolveLocal(compiler_, &name);
+    bool assigns = canAssign && match(TokenEqual);
 
     if (arg != -1) {
         getOp = OpCode::GetLocal;
         setOp = OpCode::SetLocal;
     } else {
+        if (parallelBody(compiler_) != nullptr) checkParallelAccess(name, assigns);
         arg = identifierConstant(&name);
         getOp = OpCode::GetGlobal;
         setOp = OpCode::SetGlobal;
     }
 
-    if (canAssign && match(TokenEqual)) {
+    if (assigns) {
         expression();
         emitOpCodeAndOperand(setOp, arg);
     } else {
@@ -325,6 +464,21 @@ void Parser::namedVariable(Token name, bool canAssign) {
     }
 }
 
+// Workers run a parallel loop body with copies of the globals and none of
+// the locals around it, so assigning the one or using the other could only
+// ever reach the worker's copy.
+void Parser::checkParallelAccess(Token& name, bool assigns) {
+    for (Compiler* compiler = compiler_->enclosing; compiler != nullptr; compiler = compiler->enclosing) {
+        for (int i = compiler->localCount - 1; i >= 0; i--) {
+            if (identifiersEqual(&name, &compiler->locals[i].name)) {
+                errorAt(name, fmt::format("Can't use local '{}' from outside a parallel loop body.", name.name));
+                return;
+            }
+        }
+    }
+    if (assigns) errorAt(name, fmt::format("Can't assign global '{}' in a parallel loop body.", name.name));
+}
+
 bool Parser::match(TokenType type) {
     if (!check(type)) return false;
     advance();
@@ -332,7 +486,11 @@ bool Parser::match(TokenType type) {
 }
 
 void Parser::declaration() {
-    if (match(TokenDef)) {
+    if (match(TokenClass)) {
+        classDeclaration();
+    } else if (match(TokenFun)) {
+        funDeclaration();
+    } else if (match(TokenDef)) {
         variableDeclaration();
     } else {
         statement();
@@ -356,15 +514,114 @@ void Parser::variableDeclaration() {
     defineVariable(global);
 }
 
+void Parser::funDeclaration() {
+    u8 global = parseVariable("Expect function name.");
+    // a function may refer to itself, so it is usable before its body is compiled
+    if (compiler_->scopeDepth > 0) markInitialized();
+    function(FunctionType::Function);
+    defineVariable(global);
+}
+
+void Parser::classDeclaration() {
+    consume(TokenIdentifier, "Expect class name.");
+    Token className = previous_;
+    u8 nameConstant = identifierConstant(&previous_);
+    declareVariable();
+
+    emitOpCodeAndOperand(OpCode::Class, nameConstant);
+    defineVariable(nameConstant);
+
+    ++classDepth_;
+    namedVariable(className, false);
+    consume(TokenLeftBrace, "Expect '{' before class body.");
+    while (!check(TokenRightBrace) && !check(TokenEof)) {
+        method();
+    }
+    consume(TokenRightBrace, "Expect '}' after class body.");
+    emitOpCode(OpCode::Pop);
+    --classDepth_;
+}
+
+void Parser::method() {
+    consume(TokenIdentifier, "Expect method name.");
+    u8 constant = identifierConstant(&previous_);
+
+    FunctionType type = previous_.name == "init" ? FunctionType::Initializer : FunctionType::Method;
+    function(type);
+    emitOpCodeAndOperand(OpCode::Method, constant);
+}
+
+void Parser::function(FunctionType type) {
+    Compiler compiler;
+    initCompiler(compiler, type);
+    beginScope();
+
+    consume(TokenLeftParen, "Expect '(' after function name.");
+    if (!check(TokenRightParen)) {
+        do {
+            compiler_->function->arity++;
+            if (compiler_->function->arity > UINT8_MAX) {
+                errorAtCurrent("Can't have more than 255 parameters.");
+            }
+            u8 constant = parseVariable("Expect parameter name.");
+            defineVariable(constant);
+        } while (match(TokenComma));
+    }
+    consume(TokenRightParen, "Expect ')' after parameters.");
+    consume(TokenLeftBrace, "Expect '{' before function body.");
+    block();
+
+    ObjFunction* function = endCompiler();
+    emitConstant(Value::createObj(function));
+}
+
+void Parser::initCompiler(Compiler& compiler, FunctionType type) {
+    compiler.enclosing = compiler_;
+    compiler.type = type;
+    compiler.function = ObjFactory::newFunction();
+    compiler.function->name = ObjFactory::copyString(previous_.name.data(), previous_.name.length());
+    compiler.byteCode = &compiler.function->byteCode;
+    compiler_ = &compiler;
+
+    // slot zero holds the function being called, or the receiver in methods
+    Local* local = &compiler_->locals[compiler_->localCount++];
+    local->depth = 0;
+    bool method = type == FunctionType::Initializer || type == FunctionType::Method;
+    std::string_view slotName = method ? "this" : "";
+    local->name = Token{.type = TokenIdentifier, .name = slotName, .line = previous_.line};
+}
+
+ObjFunction* Parser::endCompiler() {
+    emitReturn();
+    ObjFunction* function = compiler_->function;
+
+    // known only now that the body is compiled; every jump is relative, so
+    // none needs patching
+    if (compiler_->generator) {
+        ByteCode& code = currentByteCode();
+        code.code_.insert(code.code_.begin(), toU8(OpCode::Generator));
+        code.lineNumbers_.insert(code.lineNumbers_.begin(), code.lineNumbers_.front());
+    }
+
+    compiler_ = compiler_->enclosing;
+    return function;
+}
+
 void Parser::statement() {
     if (match(TokenPrint)) {
         printStatement();
+    } else if (match(TokenReturn)) {
+        returnStatement();
     } else if (match(TokenFor)) {
         forStatement();
     } else if (match(TokenIf)) {
         ifStatement();
     } else if (match(TokenWhile)) {
         whileStatement();
+    } else if (match(TokenYield)) {
+        yieldStatement();
+    } else if (match(TokenParallel)) {
+        parallelStatement();
     } else if (match(TokenLeftBrace)) {
         beginScope();
         block();
@@ -378,6 +635,21 @@ void Parser::forStatement() {
     beginScope();
 
     consume(TokenLeftParen, "Expect '(' after for.");
+
+    if (isForIn()) {
+        forInLoop();
+        endScope();
+        return;
+    }
+
+    bool inclusive = false;
+    double step = 0;
+    if (check(TokenDef) && isCountingLoop(inclusive, step)) {
+        rangeLoop(inclusive, step);
+        endScope();
+        return;
+    }
+
     if (match(TokenSemiColon)) {
 
     } else if (match(TokenDef)) {
@@ -386,7 +658,7 @@ void Parser::forStatement() {
         expressionStatement();
     }
 
-    int loopStart = byteCode_.codeSize();
+    int loopStart = currentByteCode().codeSize();
     int exitJump = -1;
     if (!match(TokenSemiColon)) {
         expression();
@@ -398,7 +670,7 @@ void Parser::forStatement() {
 
     if (!match(TokenRightParen)) {
         int bodyJump = emitJump(OpCode::Jmp);
-        auto incrementStart = byteCode_.codeSize();
+        auto incrementStart = currentByteCode().codeSize();
         expression();
         emitOpCode(OpCode::Pop);
         consume(TokenRightParen, "Expect ')' after for clauses.");
@@ -418,8 +690,179 @@ void Parser::forStatement() {
 
     endScope();
 }
+// 'for ([def] name in ...)'
+bool Parser::isForIn() {
+    if (!check(TokenDef) && !check(TokenIdentifier)) return false;
+
+    auto checkpoint = scanner_.checkpoint();
+    bool result = true;
+    if (check(TokenDef)) result = scanner_.scanToken().type == TokenIdentifier;
+    result = result && scanner_.scanToken().type == TokenIn;
+    scanner_.rewind(checkpoint);
+    return result;
+}
+
+// The iterable and a cursor into it live in two hidden locals below the
+// loop variable. ForIn advances the cursor and sets the variable, or jumps
+// out once the iterable is exhausted, so nothing is materialized up front.
+void Parser::forInLoop() {
+    match(TokenDef);
+    consume(TokenIdentifier, "Expect loop variable name.");
+    Token name = previous_;
+    consume(TokenIn, "Expect 'in' after loop variable.");
+
+    expression();
+    addLocal(Token{.type = TokenIdentifier, .name = "", .line = previous_.line});
+    markInitialized();
+    emitOpCode(OpCode::Nil);
+    addLocal(Token{.type = TokenIdentifier, .name = "", .line = previous_.line});
+    markInitialized();
+    emitOpCode(OpCode::Nil);
+    addLocal(name);
+    markInitialized();
+    consume(TokenRightParen, "Expect ')' after for clauses.");
+
+    int loopStart = static_cast<int>(currentByteCode().codeSize());
+    emitOpCodeAndOperand(OpCode::ForIn, static_cast<u8>(compiler_->localCount - 3));
+    emitShort(0xffff);
+    int exitJump = static_cast<int>(currentByteCode().codeSize()) - 2;
+
+    statement();
+    emitLoop(loopStart);
+    patchJump(exitJump);
+}
+
+/*
+Looks ahead, without emitting anything, for the canonical counting loop
+    for (def i = <init>; i < <limit>; i = i + <step>) { <body> }
+where '<' may also be '<=', <limit> is a number or a variable and <step> a
+positive number. The body must not assign 'i' or the limit variable, and
+if the limit is a global the body must not call anything, yield or run a
+for-in either, since a callee or another fiber could reassign it. Anything
+else gets the general lowering.
+*/
+bool Parser::isCountingLoop(bool& inclusive, double& step) {
+    auto checkpoint = scanner_.checkpoint();
+    bool result = scanCountingLoop(inclusive, step);
+    scanner_.rewind(checkpoint);
+    return result;
+}
+
+bool Parser::scanCountingLoop(bool& inclusive, double& step) {
+    // current_ is the 'def'
+    Token counter = scanner_.scanToken();
+    if (counter.type != TokenIdentifier) return false;
+    if (scanner_.scanToken().type != TokenEqual) return false;
+
+    int depth = 0;
+    Token token;
+    do {
+        token = scanner_.scanToken();
+        if (token.type == TokenEof || token.type == TokenError) return false;
+        if (token.type == TokenLeftParen || token.type == TokenLeftBracket || token.type == TokenLeftBrace) depth++;
+        if (token.type == TokenRightParen || token.type == TokenRightBracket || token.type == TokenRightBrace) depth--;
+    } while (token.type != TokenSemiColon || depth != 0);
+
+    token = scanner_.scanToken();
+    if (token.type != TokenIdentifier || !identifiersEqual(&token, &counter)) return false;
+    token = scanner_.scanToken();
+    if (token.type != TokenLess && token.type != TokenLessEqual) return false;
+    inclusive = token.type == TokenLessEqual;
+
+    Token limit = scanner_.scanToken();
+    if (limit.type != TokenNumber && limit.type != TokenIdentifier) return false;
+    if (limit.type == TokenIdentifier && identifiersEqual(&limit, &counter)) return false;
+    bool limitIsGlobal = false;
+    if (limit.type == TokenIdentifier) {
+        limitIsGlobal = true;
+        for (int i = compiler_->localCount - 1; i >= 0; i--) {
+            if (identifiersEqual(&limit, &compiler_->locals[i].name)) {
+                limitIsGlobal = false;
+                break;
+            }
+        }
+    }
+    if (scanner_.scanToken().type != TokenSemiColon) return false;
+
+    // i = i + step
+    token = scanner_.scanToken();
+    if (token.type != TokenIdentifier || !identifiersEqual(&token, &counter)) return false;
+    if (scanner_.scanToken().type != TokenEqual) return false;
+    token = scanner_.scanToken();
+    if (token.type != TokenIdentifier || !identifiersEqual(&token, &counter)) return false;
+    if (scanner_.scanToken().type != TokenPlus) return false;
+    token = scanner_.scanToken();
+    if (token.type != TokenNumber) return false;
+    step = strtod(token.name.data(), nullptr);
+    if (step <= 0) return false;
+    if (scanner_.scanToken().type != TokenRightParen) return false;
+
+    if (scanner_.scanToken().type != TokenLeftBrace) return false;
+    depth = 1;
+    Token previous = token;
+    while (depth > 0) {
+        token = scanner_.scanToken();
+        if (token.type == TokenEof || token.type == TokenError) return false;
+        if (token.type == TokenLeftBrace) depth++;
+        if (token.type == TokenRightBrace) depth--;
+
+        bool assigns = token.type == TokenEqual && previous.type == TokenIdentifier &&
+                       (identifiersEqual(&previous, &counter) || (limit.type == TokenIdentifier && identifiersEqual(&previous, &limit)));
+        bool calls = token.type == TokenLeftParen &&
+                     (previous.type == TokenIdentifier || previous.type == TokenRightParen || previous.type == TokenRightBracket);
+        // other fibers run at a yield, and while a for-in waits on a
+        // generator or a read, so they may change a global limit too
+        bool switches = token.type == TokenYield || token.type == TokenIn;
+        if (assigns || (limitIsGlobal && (calls || switches))) return false;
+        previous = token;
+    }
+
+    return true;
+}
+
+// Compiles a loop accepted by isCountingLoop(). The limit is evaluated once
+// into a hidden local next to the counter; ForRangeInit does the type checks
+// and the first test, and ForRangeStep increments, tests and jumps back in a
+// single dispatch.
+void Parser::rangeLoop(bool inclusive, double step) {
+    consume(TokenDef, "Expect 'def'.");
+    variableDeclaration();
+    auto counter = static_cast<u8>(compiler_->localCount - 1);
+
+    advance(); // the counter
+    advance(); // '<' or '<='
+    expression();
+    addLocal(Token{.type = TokenIdentifier, .name = "", .line = previous_.line});
+    markInitialized();
+    consume(TokenSemiColon, "Expect ';' after loop condition");
+
+    // 'i = i + step' is folded into ForRangeStep
+    for (int i = 0; i < 5; ++i) {
+        advance();
+    }
+    consume(TokenRightParen, "Expect ')' after for clauses.");
+
+    emitOpCodeAndOperand(OpCode::ForRangeInit, counter);
+    emitByte(inclusive ? 1 : 0);
+    emitShort(0xffff);
+    int exitJump = static_cast<int>(currentByteCode().codeSize()) - 2;
+
+    int bodyStart = static_cast<int>(currentByteCode().codeSize());
+    statement();
+
+    u8 stepConstant = makeConstant(Value::createNumber(step));
+    emitOpCodeAndOperand(OpCode::ForRangeStep, counter);
+    emitByte(inclusive ? 1 : 0);
+    emitByte(stepConstant);
+    auto offset = currentByteCode().codeSize() - bodyStart + 2;
+    if (offset > UINT16_MAX) error("Loop body too large");
+    emitShort(static_cast<u16>(offset));
+
+    patchJump(exitJump);
+}
+
 void Parser::whileStatement() {
-    int loopStart = byteCode_.codeSize();
+    int loopStart = currentByteCode().codeSize();
     consume(TokenLeftParen, "Expect '(' after while.");
     expression();
     consume(TokenRightParen, "Expect ')' after condition.");
@@ -456,22 +899,22 @@ int Parser::emitJump(OpCode opcode) {
     emitOpCode(opcode);
     emitByte(0xff);
     emitByte(0xff);
-    return byteCode_.codeSize() - 2;
+    return currentByteCode().codeSize() - 2;
 }
 
 void Parser::patchJump(int offset) {
-    int jump = byteCode_.codeSize() - offset - 2;
+    int jump = currentByteCode().codeSize() - offset - 2;
 
     if (jump > UINT16_MAX) {
         error("Too much code to jump over");
     }
 
-    byteCode_.code_[offset] = (jump >> 8) & 0xff;
-    byteCode_.code_[offset + 1] = jump & 0xff;
+    currentByteCode().code_[offset] = (jump >> 8) & 0xff;
+    currentByteCode().code_[offset + 1] = jump & 0xff;
 }
 
 void Parser::beginScope() {
-    g_current->scopeDepth++;
+    compiler_->scopeDepth++;
 }
 void Parser::block() {
     while (!check(TokenRightBrace) && !check(TokenEof)) {
@@ -481,11 +924,11 @@ void Parser::block() {
     consume(TokenRightBrace, "Expect '}' after block");
 }
 void Parser::endScope() {
-    g_current->scopeDepth--;
+    compiler_->scopeDepth--;
 
-    while (g_current->localCount > 0 && g_current->locals[g_current->localCount - 1].depth > g_current->scopeDepth) {
+    while (compiler_->localCount > 0 && compiler_->locals[compiler_->localCount - 1].depth > compiler_->scopeDepth) {
         emitOpCode(OpCode::Pop);
-        g_current->localCount--;
+        compiler_->localCount--;
     }
 }
 
@@ -495,6 +938,163 @@ void Parser::printStatement() {
     emitOpCode(OpCode::Print);
 }
 
+void Parser::returnStatement() {
+    if (compiler_->type == FunctionType::Script) {
+        error("Can't return from top-level code.");
+    }
+    if (compiler_->type == FunctionType::Parallel) {
+        error("Can't return from a parallel loop body.");
+    }
+
+    if (match(TokenSemiColon)) {
+        emitReturn();
+        return;
+    }
+
+    if (compiler_->type == FunctionType::Initializer) {
+        error("Can't return a value from an initializer.");
+    }
+
+    lastCall_ = -1;
+    expression();
+    consume(TokenSemiColon, "Expect ';' after return value.");
+
+    // 'return f(...)': the call's frame can replace ours. The Return stays
+    // behind for jumps that land after the call (e.g. 'return a and f()').
+    if (lastCall_ != -1 && lastCall_ == static_cast<int>(currentByteCode().codeSize()) - 2) {
+        currentByteCode().code_[lastCall_] = toU8(OpCode::TailCall);
+    }
+    emitOpCode(OpCode::Return);
+}
+
+// 'yield' in a function makes it a generator; in top-level code it only
+// lets other fibers run
+void Parser::yieldStatement() {
+    if (compiler_->type == FunctionType::Initializer) {
+        error("Can't yield from an initializer.");
+    }
+    if (compiler_->type == FunctionType::Parallel) {
+        error("Can't yield from a parallel loop body.");
+    }
+    if (compiler_->type != FunctionType::Script) compiler_->generator = true;
+
+    if (match(TokenSemiColon)) {
+        emitOpCode(OpCode::Nil);
+    } else {
+        expression();
+        consume(TokenSemiColon, "Expect ';' after yielded value.");
+    }
+    emitOpCode(OpCode::Yield);
+}
+
+/*
+    parallel for ([def] i in <range>) [reduce (+: total)] <body>
+
+The body becomes a function that the VM hands to its workers, each of them
+calling it for chunks of the range:
+
+    (first, last, start, step, total): for k in [first, last) the loop
+    variable is start + k * step; returns total
+
+Inside the body the reduction's variable is the worker's own accumulator,
+starting at 0 for '+' and 1 for '*'. Once every chunk is done, the
+accumulators are combined in range order and into the variable itself.
+*/
+void Parser::parallelStatement() {
+    consume(TokenFor, "Expect 'for' after 'parallel'.");
+    consume(TokenLeftParen, "Expect '(' after for.");
+    match(TokenDef);
+    consume(TokenIdentifier, "Expect loop variable name.");
+    Token name = previous_;
+    consume(TokenIn, "Expect 'in' after loop variable.");
+    expression();
+    consume(TokenRightParen, "Expect ')' after for clauses.");
+
+    Token hidden{.type = TokenIdentifier, .name = "", .line = previous_.line};
+    Token target = hidden;
+    auto reduction = Reduction::None;
+    if (match(TokenReduce)) {
+        consume(TokenLeftParen, "Expect '(' after reduce.");
+        if (match(TokenPlus)) {
+            reduction = Reduction::Sum;
+        } else if (match(TokenStar)) {
+            reduction = Reduction::Product;
+        } else {
+            errorAtCurrent("Expect '+' or '*' to reduce with.");
+        }
+        consume(TokenColon, "Expect ':' after the reduction.");
+        consume(TokenIdentifier, "Expect variable name to reduce into.");
+        target = previous_;
+        consume(TokenRightParen, "Expect ')' after reduction.");
+    }
+
+    Compiler compiler;
+    initCompiler(compiler, FunctionType::Parallel);
+    compiler.function->name = ObjFactory::copyString("parallel for", 12);
+    compiler.function->arity = 5;
+    beginScope();
+    for (int i = 0; i < 4; ++i) {
+        addLocal(hidden);
+        markInitialized();
+    }
+    addLocal(target);
+    markInitialized();
+
+    // the counter k and its limit
+    auto counter = static_cast<u8>(compiler_->localCount);
+    emitOpCodeAndOperand(OpCode::GetLocal, 1);
+    addLocal(hidden);
+    markInitialized();
+    emitOpCodeAndOperand(OpCode::GetLocal, 2);
+    addLocal(hidden);
+    markInitialized();
+
+    emitOpCodeAndOperand(OpCode::ForRangeInit, counter);
+    emitByte(0);
+    emitShort(0xffff);
+    int exitJump = static_cast<int>(currentByteCode().codeSize()) - 2;
+
+    int bodyStart = static_cast<int>(currentByteCode().codeSize());
+    beginScope();
+    emitOpCodeAndOperand(OpCode::GetLocal, 3);
+    emitOpCodeAndOperand(OpCode::GetLocal, counter);
+    emitOpCodeAndOperand(OpCode::GetLocal, 4);
+    emitOpCode(OpCode::Multiply);
+    emitOpCode(OpCode::Add);
+    addLocal(name);
+    markInitialized();
+    statement();
+    endScope();
+
+    u8 stepConstant = makeConstant(Value::createNumber(1));
+    emitOpCodeAndOperand(OpCode::ForRangeStep, counter);
+    emitByte(0);
+    emitByte(stepConstant);
+    auto offset = currentByteCode().codeSize() - bodyStart + 2;
+    if (offset > UINT16_MAX) error("Loop body too large");
+    emitShort(static_cast<u16>(offset));
+    patchJump(exitJump);
+
+    emitOpCodeAndOperand(OpCode::GetLocal, 5);
+    emitOpCode(OpCode::Return);
+    ObjFunction* body = endCompiler();
+
+    emitOpCodeAndOperand(OpCode::ParallelFor, makeConstant(Value::createObj(body)));
+    emitByte(static_cast<u8>(reduction));
+    if (reduction == Reduction::None) {
+        emitOpCode(OpCode::Pop);
+        return;
+    }
+
+    // total = total + result, through the same slot or global either way
+    int local = resolveLocal(compiler_, &target);
+    u8 arg = local != -1 ? static_cast<u8>(local) : identifierConstant(&target);
+    emitOpCodeAndOperand(local != -1 ? OpCode::GetLocal : OpCode::GetGlobal, arg);
+    emitOpCode(reduction == Reduction::Sum ? OpCode::Add : OpCode::Multiply);
+    emitOpCodeAndOperand(local != -1 ? OpCode::SetLocal : OpCode::SetGlobal, arg);
+    emitOpCode(OpCode::Pop);
+}
+
 void Parser::expressionStatement() {
     expression();
     consume(TokenSemiColon, "Expect ';' after expression");
@@ -521,6 +1121,8 @@ void Parser::synchronize() {
         case TokenWhile:
         case TokenPrint:
         case TokenReturn:
+        case TokenYield:
+        case TokenParallel:
             return;
         default:;
         }
@@ -531,18 +1133,18 @@ void Parser::synchronize() {
 u8 Parser::parseVariable(std::string_view errorMsg) {
     consume(TokenIdentifier, errorMsg);
     declareVariable();
-    if (g_current->scopeDepth > 0) return 0;
+    if (compiler_->scopeDepth > 0) return 0;
 
     return identifierConstant(&previous_);
 }
 
 void Parser::declareVariable() {
-    if (g_current->scopeDepth == 0) return;
+    if (compiler_->scopeDepth == 0) return;
 
     Token* name = &previous_;
-    for (int i = g_current->localCount - 1; i >= 0; i--) {
-        Local* local = &g_current->locals[i];
-        if (local->depth != -1 && local->depth < g_current->scopeDepth) {
+    for (int i = compiler_->localCount - 1; i >= 0; i--) {
+        Local* local = &compiler_->locals[i];
+        if (local->depth != -1 && local->depth < compiler_->scopeDepth) {
             break;
         }
 
@@ -555,22 +1157,22 @@ void Parser::declareVariable() {
 }
 
 void Parser::addLocal(Token name) {
-    if (g_current->localCount == UINT8_MAX + 1) {
+    if (compiler_->localCount == UINT8_MAX + 1) {
         error("Too many local variables in function");
         return;
     }
 
-    Local* local = &g_current->locals[g_current->localCount++];
+    Local* local = &compiler_->locals[compiler_->localCount++];
     local->name = name;
     local->depth = -1;
 }
 
 void Parser::markInitialized() {
-    g_current->locals[g_current->localCount - 1].depth = g_current->scopeDepth;
+    compiler_->locals[compiler_->localCount - 1].depth = compiler_->scopeDepth;
 }
 
 void Parser::defineVariable(u8 global) {
-    if (g_current->scopeDepth > 0) {
+    if (compiler_->scopeDepth > 0) {
         markInitialized();
         return;
     }
@@ -579,5 +1181,5 @@ void Parser::defineVariable(u8 global) {
 }
 
 u8 Parser::identifierConstant(Token* name) {
-    return byteCode_.writeValue(Value::createObj(ObjFactory::copyString(name->name.data(), name->name.length())));
+    return currentByteCode().writeValue(Value::createObj(ObjFactory::copyString(name->name.data(), name->name.length())));
 }
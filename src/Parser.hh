@@ -5,6 +5,7 @@
 #include "instructions.hh"
 #include "Value.hh"
 #include "compiler.hh"
+#include "OutputBuffer.hh"
 
 #include <string_view>
 #include <functional>
@@ -43,7 +44,7 @@ class ByteCode;
 
 class Parser {
 public:
-    explicit Parser(Scanner& scanner, ByteCode& byteCode);
+    Parser(Scanner& scanner, Compiler& compiler, OutputBuffer& errors);
     ~Parser() = default;
 
     Parser(const Parser&) = delete;
@@ -60,12 +61,21 @@ public:
     void emitOpCode(OpCode code);
     void emitOpCodeAndOperand(OpCode code, u8 operand);
     void emitConstant(Value value);
+    u8 makeConstant(Value value);
     void emitOpCodes(OpCode code1, OpCode code2);
     int emitJump(OpCode opcode);
     void emitLoop(int loopstart);
+    void emitShort(u16 value);
+    void emitCacheSlot();
     void patchJump(int offset);
     void and_(bool canAssign);
     void or_(bool canAssign);
+    void call(bool canAssign);
+    void arrayLiteral(bool canAssign);
+    void mapLiteral(bool canAssign);
+    void index(bool canAssign);
+    void dot(bool canAssign);
+    void this_(bool canAssign);
 
 private:
     void errorAtCurrent(std::string_view msg);
@@ -75,12 +85,14 @@ private:
         return current_.type == type;
     }
     void synchronize();
+    ByteCode& currentByteCode() { return *compiler_->byteCode; }
 
     u8 parseVariable(std::string_view errorMsg);
     void defineVariable(u8 global);
     u8 identifierConstant(Token* name);
 
     void namedVariable(Token name, bool canAssign);
+    void checkParallelAccess(Token& name, bool assigns);
     void beginScope();
     void block();
     void endScope();
@@ -88,16 +100,32 @@ private:
     void addLocal(Token name);
     int resolveLocal(Compiler* compiler, Token* name);
     void markInitialized();
+    u8 argumentList();
+
+    void initCompiler(Compiler& compiler, FunctionType type);
+    ObjFunction* endCompiler();
+    void function(FunctionType type);
 
 public:
     void ifStatement();
     void declaration();
     void variableDeclaration();
+    void funDeclaration();
+    void classDeclaration();
+    void method();
     void statement();
     void printStatement();
+    void returnStatement();
     void forStatement();
+    bool isForIn();
+    void forInLoop();
+    bool isCountingLoop(bool& inclusive, double& step);
+    bool scanCountingLoop(bool& inclusive, double& step);
+    void rangeLoop(bool inclusive, double step);
     void expressionStatement();
     void whileStatement();
+    void yieldStatement();
+    void parallelStatement();
     void expression();
     void number(bool canAssign);
     void grouping(bool canAssign);
@@ -110,9 +138,12 @@ public:
 
 private:
     Scanner& scanner_;
-    ByteCode& byteCode_;
+    Compiler* compiler_; // the innermost function being compiled
+    OutputBuffer& errors_;
     Token current_{};
     Token previous_{};
+    int lastCall_ = -1; // offset of the most recently emitted Call, used to spot tail calls
+    int classDepth_ = 0;
     bool hadError_ = false;
     bool panicMode_ = false;
 
@@ -0,0 +1,167 @@
+#include "Profiler.hh"
+
+#include "Vm.hh"
+#include "debug.hh"
+#include "object.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static u64 readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+static const char* chunkName(const ObjFunction* function) {
+    return function == nullptr ? "script" : function->name->chars;
+}
+
+static double percent(u64 part, u64 total) {
+    return total == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(total);
+}
+
+Profiler::Profiler()
+    : pairs_(OpCodeCount * OpCodeCount) {}
+
+Profiler::Chunk& Profiler::chunkFor(const CallFrame& frame) {
+    auto [it, inserted] = chunks_.try_emplace(frame.code);
+    Chunk& chunk = it->second;
+    if (inserted) {
+        chunk.code = frame.code;
+        chunk.function = frame.function;
+        for (size offset = 0; offset < frame.code->codeSize(); ++offset) {
+            chunk.lines.push_back(frame.code->getLineNumber(static_cast<int>(offset)));
+        }
+        chunk.counts.resize(frame.code->codeSize());
+        chunk.cycles.resize(frame.code->codeSize());
+    }
+    return chunk;
+}
+
+void Profiler::closeSample(u64 now) {
+    u64 elapsed = now - sampleStart_;
+    sampleChunk_->cycles[sampleOffset_] += elapsed;
+    opCycles_[sampleOp_] += elapsed;
+    sampleChunk_ = nullptr;
+}
+
+void Profiler::instruction(const CallFrame* frames, int frameCount, int offset, OpCode op) {
+    if (sampleChunk_ != nullptr) closeSample(readCycles());
+
+    const CallFrame& frame = frames[frameCount - 1];
+    if (current_ == nullptr || current_->code != frame.code) {
+        current_ = &chunkFor(frame);
+    }
+
+    int index = toU8(op);
+    ++executed_;
+    ++opCounts_[index];
+    ++current_->counts[offset];
+    if (previous_ != -1) ++pairs_[previous_ * OpCodeCount + index];
+    previous_ = index;
+
+    if (executed_ % SamplePeriod == 0) {
+        std::vector<ObjFunction*> stack;
+        stack.reserve(frameCount);
+        for (int i = 0; i < frameCount; ++i) {
+            stack.push_back(frames[i].function);
+        }
+        ++stacks_[stack];
+
+        sampleChunk_ = current_;
+        sampleOffset_ = offset;
+        sampleOp_ = index;
+        sampleStart_ = readCycles();
+    }
+}
+
+void Profiler::finish() {
+    if (sampleChunk_ != nullptr) closeSample(readCycles());
+    previous_ = -1;
+}
+
+void Profiler::report(std::FILE* out) const {
+    constexpr size Top = 20;
+
+    u64 totalCycles = 0;
+    for (u64 cycles : opCycles_) totalCycles += cycles;
+
+    fmt::print(out, "== profile: {} instructions, 1 in {} timed ==\n", executed_, SamplePeriod);
+
+    std::vector<int> ops;
+    for (int op = 0; op < OpCodeCount; ++op) {
+        if (opCounts_[op] != 0) ops.push_back(op);
+    }
+    std::sort(ops.begin(), ops.end(), [&](int a, int b) { return opCounts_[a] > opCounts_[b]; });
+
+    fmt::print(out, "\n-- opcodes --\n{:>12} {:>7} {:>7}  opcode\n", "count", "%", "cycles%");
+    for (int op : ops) {
+        fmt::print(out, "{:>12} {:>6.2f}% {:>6.2f}%  {}\n", opCounts_[op], percent(opCounts_[op], executed_),
+                   percent(opCycles_[op], totalCycles), debug::opCodeName(toOp(op)));
+    }
+
+    struct Line {
+        const Chunk* chunk;
+        int line;
+        u64 count;
+        u64 cycles;
+    };
+    std::vector<Line> lines;
+    for (const auto& [code, chunk] : chunks_) {
+        std::map<int, Line> byLine;
+        for (size offset = 0; offset < chunk.counts.size(); ++offset) {
+            if (chunk.counts[offset] == 0) continue;
+            int line = chunk.lines[offset];
+            auto& entry = byLine.try_emplace(line, Line{&chunk, line, 0, 0}).first->second;
+            entry.count += chunk.counts[offset];
+            entry.cycles += chunk.cycles[offset];
+        }
+        for (const auto& [line, entry] : byLine) lines.push_back(entry);
+    }
+    std::sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) {
+        return a.cycles != b.cycles ? a.cycles > b.cycles : a.count > b.count;
+    });
+
+    fmt::print(out, "\n-- hot lines --\n{:>12} {:>7} {:>7}  line\n", "count", "%", "cycles%");
+    for (size i = 0; i < std::min(Top, lines.size()); ++i) {
+        const Line& line = lines[i];
+        fmt::print(out, "{:>12} {:>6.2f}% {:>6.2f}%  {} in {}\n", line.count, percent(line.count, executed_),
+                   percent(line.cycles, totalCycles), line.line, chunkName(line.chunk->function));
+    }
+
+    std::vector<int> pairs;
+    for (int i = 0; i < OpCodeCount * OpCodeCount; ++i) {
+        if (pairs_[i] != 0) pairs.push_back(i);
+    }
+    std::sort(pairs.begin(), pairs.end(), [&](int a, int b) { return pairs_[a] > pairs_[b]; });
+
+    fmt::print(out, "\n-- opcode pairs --\n{:>12} {:>7}  pair\n", "count", "%");
+    for (size i = 0; i < std::min(Top, pairs.size()); ++i) {
+        int pair = pairs[i];
+        fmt::print(out, "{:>12} {:>6.2f}%  {} -> {}\n", pairs_[pair], percent(pairs_[pair], executed_),
+                   debug::opCodeName(toOp(pair / OpCodeCount)), debug::opCodeName(toOp(pair % OpCodeCount)));
+    }
+}
+
+bool Profiler::writeFolded(const char* path) const {
+    std::FILE* file = std::fopen(path, "w");
+    if (file == nullptr) return false;
+
+    for (const auto& [stack, count] : stacks_) {
+        std::string frames;
+        for (const ObjFunction* function : stack) {
+            if (!frames.empty()) frames += ';';
+            frames += chunkName(function);
+        }
+        fmt::print(file, "{} {}\n", frames, count);
+    }
+    return std::fclose(file) == 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "common.hh"
+#include "instructions.hh"
+
+#include <cstdio>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+class ByteCode;
+struct ObjFunction;
+struct CallFrame;
+
+// Counts every instruction the VM executes, per opcode, per bytecode offset
+// and per consecutive opcode pair, and times one instruction in every
+// 'SamplePeriod' with the cycle counter. Timed instructions also record the
+// call stack for folded (flamegraph) output. Only the profiled instantiation
+// of the interpreter loop calls into it, so a normal run pays nothing.
+class Profiler {
+public:
+    static constexpr u64 SamplePeriod = 64;
+
+    Profiler();
+
+    // called before each instruction is dispatched
+    void instruction(const CallFrame* frames, int frameCount, int offset, OpCode op);
+    // closes the sample still open when the run ends
+    void finish();
+
+    void report(std::FILE* out) const;
+    // one "script;outer;inner count" line per distinct sampled stack
+    bool writeFolded(const char* path) const;
+
+private:
+    struct Chunk {
+        const ByteCode* code;
+        ObjFunction* function; // nullptr for the top-level script
+        // copied, the script's code goes away with its VM before the report
+        std::vector<int> lines;
+        std::vector<u64> counts;
+        std::vector<u64> cycles;
+    };
+
+    Chunk& chunkFor(const CallFrame& frame);
+    void closeSample(u64 now);
+
+private:
+    std::unordered_map<const ByteCode*, Chunk> chunks_;
+    Chunk* current_{};
+
+    u64 executed_{};
+    u64 opCounts_[OpCodeCount]{};
+    u64 opCycles_[OpCodeCount]{};
+    std::vector<u64> pairs_; // OpCodeCount x OpCodeCount, indexed [previous][next]
+    int previous_{-1};
+
+    // the instruction being timed, if any
+    Chunk* sampleChunk_{};
+    int sampleOffset_{};
+    int sampleOp_{};
+    u64 sampleStart_{};
+
+    std::map<std::vector<ObjFunction*>, u64> stacks_;
+};
@@ -0,0 +1,51 @@
+#include "Program.hh"
+#include "compiler.hh"
+#include "object.hh"
+#include "verifier.hh"
+
+ProgramRef Program::compile(const std::string& code, OutputBuffer& errors) {
+    std::shared_ptr<Program> program{new Program};
+    {
+        Heap::Scope scope{program->heap_};
+        if (!::compile(code, program->script_, errors)) return nullptr;
+    }
+    if (!program->prepare(errors)) return nullptr;
+    return program;
+}
+
+ProgramRef Program::compile(const std::string& code) {
+    OutputBuffer errors;
+    return compile(code, errors);
+}
+
+ProgramRef Program::fromByteCode(ByteCode script) {
+    std::shared_ptr<Program> program{new Program};
+    program->script_ = std::move(script);
+    OutputBuffer errors;
+    if (!program->prepare(errors)) return nullptr;
+    return program;
+}
+
+// everything the interpreter assumes about the code is established here, once
+bool Program::prepare(OutputBuffer& errors) {
+    std::string error;
+    if (!verifier::verify(script_, 0, error)) {
+        errors.write(fmt::format("Invalid bytecode: {}", error));
+        errors.newline();
+        errors.flush();
+        return false;
+    }
+    addChunk(script_);
+    return true;
+}
+
+void Program::addChunk(ByteCode& code) {
+    code.program_ = this;
+    code.index_ = static_cast<int>(chunks_.size());
+    chunks_.push_back(&code);
+
+    for (size i = 0; i < code.constantCount(); ++i) {
+        Value constant = code.getConstantAtOffset(static_cast<int>(i));
+        if (object::isFunction(constant)) addChunk(object::asFunction(constant)->byteCode);
+    }
+}
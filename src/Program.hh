@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common.hh"
+#include "ByteCode.hh"
+#include "Heap.hh"
+#include "OutputBuffer.hh"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class Program;
+using ProgramRef = std::shared_ptr<const Program>;
+
+// A compiled and verified script. It never changes once built, so any
+// number of VMs, on any threads, can run it at once without copying it.
+// What a VM changes while running, its inline caches and the strings and
+// global slots the constants resolve to, lives in that VM's side tables,
+// indexed by ByteCode::index().
+class Program : public std::enable_shared_from_this<Program> {
+public:
+    // nullptr if the code has errors, which have been written to 'errors'
+    static ProgramRef compile(const std::string& code, OutputBuffer& errors);
+    // the same, with the errors going to stdout
+    static ProgramRef compile(const std::string& code);
+    // adopts code put together by hand, for benchmarks
+    static ProgramRef fromByteCode(ByteCode script);
+
+    Program(const Program&) = delete;
+    Program& operator=(const Program&) = delete;
+
+    [[nodiscard]] const ByteCode& script() const { return script_; }
+    // the script first, then every function, each at its index()
+    [[nodiscard]] const std::vector<const ByteCode*>& chunks() const { return chunks_; }
+
+private:
+    Program() = default;
+
+    bool prepare(OutputBuffer& errors);
+    void addChunk(ByteCode& code);
+
+private:
+    Heap heap_; // the functions and strings the compiler created
+    ByteCode script_;
+    std::vector<const ByteCode*> chunks_;
+};
@@ -0,0 +1,205 @@
+#include "Sampler.hh"
+
+#include "Vm.hh"
+#include "object.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+
+static std::atomic<Sampler*> g_active{nullptr};
+
+static const char* frameName(const ObjFunction* function) {
+    return function == nullptr ? "script" : function->name->chars;
+}
+
+static double percent(u64 part, u64 total) {
+    return total == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(total);
+}
+
+static void setTimer(int hz) {
+    itimerval timer{};
+    if (hz > 0) {
+        long period = std::max(1L, 1000000L / hz);
+        timer.it_interval.tv_sec = period / 1000000;
+        timer.it_interval.tv_usec = period % 1000000;
+        timer.it_value = timer.it_interval;
+    }
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+Sampler::Sampler(int hz)
+    : hz_{hz},
+      ring_{new Sample[Capacity]} {}
+
+Sampler::~Sampler() {
+    stop();
+}
+
+void Sampler::handleSignal(int) {
+    // the timer counts the whole process's CPU time, so the signal can land on
+    // any thread that has not blocked it; only the VM's own stack is sampled
+    Sampler* sampler = g_active.load(std::memory_order_relaxed);
+    if (sampler != nullptr && pthread_equal(pthread_self(), sampler->thread_)) sampler->record();
+}
+
+// runs inside the signal handler: plain loads and stores only
+void Sampler::record() {
+    u32 head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == Capacity) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Sample& sample = ring_[head % Capacity];
+    int frameCount = vm_->frameCount_;
+    sample.depth = 0;
+    for (int i = std::max(0, frameCount - MaxDepth); i < frameCount; ++i) {
+        const CallFrame& frame = vm_->frames_[i];
+        const u8* ip = i == frameCount - 1 ? vm_->iPtr_ : frame.ip;
+
+        SampleFrame& out = sample.frames[sample.depth++];
+        out.code = frame.code;
+        out.function = frame.function;
+        out.offset = -1;
+        if (frame.code != nullptr && ip != nullptr) {
+            const u8* begin = frame.code->code_.data();
+            // ip has already moved past the opcode being executed
+            if (ip > begin && ip <= begin + frame.code->code_.size()) {
+                out.offset = static_cast<int>(ip - begin - 1);
+            }
+        }
+    }
+
+    head_.store(head + 1, std::memory_order_release);
+}
+
+void Sampler::drain() {
+    u32 tail = tail_.load(std::memory_order_relaxed);
+    u32 head = head_.load(std::memory_order_acquire);
+
+    for (; tail != head; ++tail) {
+        const Sample& sample = ring_[tail % Capacity];
+        std::vector<Frame> stack;
+        stack.reserve(sample.depth);
+        for (int i = 0; i < sample.depth; ++i) {
+            const SampleFrame& frame = sample.frames[i];
+            if (frame.code == nullptr) continue;
+            int line = frame.offset < 0 ? 0 : frame.code->getLineNumber(frame.offset);
+            stack.push_back(Frame{frame.function, line});
+        }
+        if (stack.empty()) continue;
+
+        ++stacks_[stack];
+        ++samples_;
+    }
+
+    tail_.store(tail, std::memory_order_release);
+}
+
+bool Sampler::start(const GlangVm& vm) {
+    Sampler* expected = nullptr;
+    if (!g_active.compare_exchange_strong(expected, this)) return false;
+
+    vm_ = &vm;
+    thread_ = pthread_self();
+    stopping_.store(false);
+
+    // the drain thread inherits a mask that keeps SIGPROF on the VM's thread
+    sigset_t profSet;
+    sigset_t previousSet;
+    sigemptyset(&profSet);
+    sigaddset(&profSet, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &profSet, &previousSet);
+    drainer_ = std::thread([this] {
+        while (!stopping_.load()) {
+            drain();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+    pthread_sigmask(SIG_SETMASK, &previousSet, nullptr);
+
+    struct sigaction action {};
+    action.sa_handler = handleSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+
+    setTimer(hz_);
+    return true;
+}
+
+void Sampler::stop() {
+    if (g_active.load() != this) return;
+
+    // a SIGPROF still pending after the timer is disarmed must not kill us
+    setTimer(0);
+    signal(SIGPROF, SIG_IGN);
+    g_active.store(nullptr);
+
+    stopping_.store(true);
+    drainer_.join();
+    drain();
+    vm_ = nullptr;
+}
+
+void Sampler::report(std::FILE* out) const {
+    constexpr size Top = 20;
+
+    std::map<ObjFunction*, u64> self;
+    std::map<ObjFunction*, u64> total;
+    std::map<Frame, u64> lines;
+    for (const auto& [stack, count] : stacks_) {
+        self[stack.back().function] += count;
+        lines[stack.back()] += count;
+
+        std::vector<ObjFunction*> seen;
+        for (const Frame& frame : stack) {
+            if (std::find(seen.begin(), seen.end(), frame.function) != seen.end()) continue;
+            seen.push_back(frame.function);
+            total[frame.function] += count;
+        }
+    }
+
+    fmt::print(out, "== samples: {} at {} Hz, {} dropped ==\n", samples_, hz_, dropped_.load());
+
+    std::vector<std::pair<ObjFunction*, u64>> functions(total.begin(), total.end());
+    std::sort(functions.begin(), functions.end(), [&](const auto& a, const auto& b) {
+        return self[a.first] != self[b.first] ? self[a.first] > self[b.first] : a.second > b.second;
+    });
+
+    fmt::print(out, "\n-- functions --\n{:>7} {:>7}  function\n", "self%", "total%");
+    for (size i = 0; i < std::min(Top, functions.size()); ++i) {
+        auto [function, count] = functions[i];
+        fmt::print(out, "{:>6.2f}% {:>6.2f}%  {}\n", percent(self[function], samples_), percent(count, samples_),
+                   frameName(function));
+    }
+
+    std::vector<std::pair<Frame, u64>> hot(lines.begin(), lines.end());
+    std::sort(hot.begin(), hot.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    fmt::print(out, "\n-- lines --\n{:>10} {:>7}  line\n", "samples", "%");
+    for (size i = 0; i < std::min(Top, hot.size()); ++i) {
+        auto [frame, count] = hot[i];
+        fmt::print(out, "{:>10} {:>6.2f}%  {} in {}\n", count, percent(count, samples_), frame.line, frameName(frame.function));
+    }
+}
+
+bool Sampler::writeFolded(const char* path) const {
+    std::FILE* file = std::fopen(path, "w");
+    if (file == nullptr) return false;
+
+    for (const auto& [stack, count] : stacks_) {
+        std::string frames;
+        for (const Frame& frame : stack) {
+            if (!frames.empty()) frames += ';';
+            frames += fmt::format("{}:{}", frameName(frame.function), frame.line);
+        }
+        fmt::print(file, "{} {}\n", frames, count);
+    }
+    return std::fclose(file) == 0;
+}
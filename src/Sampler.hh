@@ -0,0 +1,81 @@
+#pragma once
+
+#include "common.hh"
+
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+
+class ByteCode;
+class GlangVm;
+struct ObjFunction;
+
+// Statistical profiler: a SIGPROF timer interrupts the running script
+// 'hz' times per CPU second and the handler copies the VM's call stack,
+// as (code, offset) pairs, into a lock-free single-producer ring. A
+// background thread drains the ring, resolves offsets to source lines and
+// aggregates. Nothing runs in the interpreter loop itself; samples taken
+// while a frame is being pushed may be slightly stale, which is the usual
+// price of sampling.
+class Sampler {
+public:
+    explicit Sampler(int hz = 1000);
+    ~Sampler();
+
+    Sampler(const Sampler&) = delete;
+    Sampler& operator=(const Sampler&) = delete;
+
+    // only one sampler can be running in the process at a time
+    bool start(const GlangVm& vm);
+    void stop();
+
+    void report(std::FILE* out) const;
+    // one "script:line;outer:line;inner:line count" line per distinct stack
+    bool writeFolded(const char* path) const;
+
+private:
+    static constexpr int MaxDepth = 32; // innermost frames kept per sample
+    static constexpr u32 Capacity = 1024;
+
+    struct SampleFrame {
+        const ByteCode* code;
+        ObjFunction* function;
+        int offset; // -1 when the instruction pointer looked inconsistent
+    };
+    struct Sample {
+        int depth;
+        SampleFrame frames[MaxDepth];
+    };
+    struct Frame {
+        ObjFunction* function;
+        int line;
+        bool operator<(const Frame& other) const {
+            return function != other.function ? function < other.function : line < other.line;
+        }
+    };
+
+    static void handleSignal(int);
+    void record();
+    void drain();
+
+private:
+    int hz_;
+    const GlangVm* vm_{};
+    pthread_t thread_{}; // the thread running vm_, the only one sampled
+
+    std::unique_ptr<Sample[]> ring_;
+    std::atomic<u32> head_{}; // written by the signal handler
+    std::atomic<u32> tail_{}; // written by the drain thread
+    std::atomic<u64> dropped_{};
+
+    std::thread drainer_;
+    std::atomic<bool> stopping_{};
+
+    u64 samples_{};
+    std::map<std::vector<Frame>, u64> stacks_; // outermost frame first
+};
@@ -36,8 +36,14 @@ Token Scanner::scanToken() {
         return makeToken(TokenLeftBrace);
     case '}':
         return makeToken(TokenRightBrace);
+    case '[':
+        return makeToken(TokenLeftBracket);
+    case ']':
+        return makeToken(TokenRightBracket);
     case ';':
         return makeToken(TokenSemiColon);
+    case ':':
+        return makeToken(TokenColon);
     case ',':
         return makeToken(TokenComma);
     case '.':
@@ -118,7 +124,15 @@ TokenType Scanner::identifierType() {
         }
         break;
     case 'i':
-        return checkKeyword(1, 1, "f", TokenIf);
+        if (current_ - start_ > 1) {
+            switch (start_[1]) {
+            case 'f':
+                return checkKeyword(2, 0, "", TokenIf);
+            case 'n':
+                return checkKeyword(2, 0, "", TokenIn);
+            }
+        }
+        break;
     case 'n':
         return checkKeyword(1, 2, "il", TokenNil);
     case 'o':
@@ -129,12 +143,21 @@ TokenType Scanner::identifierType() {
             case 'r':
                 return checkKeyword(2, 3, "int", TokenPrint);
             case 'a':
+                if (current_ - start_ > 3 && start_[3] == 'a') return checkKeyword(2, 6, "rallel", TokenParallel);
                 return checkKeyword(2, 4, "rent", TokenPrint);
             }
         }
         break;
     case 'r':
-        return checkKeyword(1, 5, "eturn", TokenReturn);
+        if (current_ - start_ > 2 && start_[1] == 'e') {
+            switch (start_[2]) {
+            case 'd':
+                return checkKeyword(3, 3, "uce", TokenReduce);
+            case 't':
+                return checkKeyword(3, 3, "urn", TokenReturn);
+            }
+        }
+        break;
     case 't':
         if (current_ - start_ > 1) {
             switch (start_[1]) {
@@ -147,6 +170,8 @@ TokenType Scanner::identifierType() {
         break;
     case 'w':
         return checkKeyword(1, 4, "hile", TokenWhile);
+    case 'y':
+        return checkKeyword(1, 4, "ield", TokenYield);
     }
 
     return TokenIdentifier;
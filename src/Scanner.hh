@@ -10,11 +10,14 @@ enum TokenType {
     TokenRightParen,
     TokenLeftBrace,
     TokenRightBrace,
+    TokenLeftBracket,
+    TokenRightBracket,
     TokenComma,
     TokenDot,
     TokenMinus,
     TokenPlus,
     TokenSemiColon,
+    TokenColon,
     TokenSlash,
     TokenStar,
 
@@ -50,6 +53,10 @@ enum TokenType {
     TokenTrue,
     TokenDef,
     TokenWhile,
+    TokenYield,
+    TokenIn,
+    TokenParallel,
+    TokenReduce,
 
     TokenEof,
     TokenError,
@@ -64,12 +71,26 @@ struct Token {
 
 class Scanner {
 public:
+    // a scanning position to come back to after looking ahead
+    struct Checkpoint {
+        const char* start;
+        const char* current;
+        int line;
+    };
+
     explicit Scanner(const std::string& source);
     ~Scanner() = default;
 
     void init(const std::string& source);
     Token scanToken();
 
+    [[nodiscard]] Checkpoint checkpoint() const { return {start_, current_, line_}; }
+    void rewind(const Checkpoint& checkpoint) {
+        start_ = checkpoint.start;
+        current_ = checkpoint.current;
+        line_ = checkpoint.line;
+    }
+
 private:
     bool isAtEnd();
     Token makeToken(TokenType type);
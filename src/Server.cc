@@ -0,0 +1,311 @@
+#include "Server.hh"
+#include "Isolate.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<bool> g_stop{false};
+
+static void requestStop(int) {
+    g_stop.store(true);
+}
+
+static bool writeAll(int fd, const void* data, size length) {
+    auto bytes = static_cast<const char*>(data);
+    while (length > 0) {
+        ssize_t written = ::send(fd, bytes, length, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += written;
+        length -= static_cast<size>(written);
+    }
+    return true;
+}
+
+// false once 'deadline' passes with the bytes still incomplete
+static bool readAll(int fd, void* data, size length, Clock::time_point deadline) {
+    auto bytes = static_cast<char*>(data);
+    while (length > 0) {
+        if (deadline != Clock::time_point::max()) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            pollfd readable{fd, POLLIN, 0};
+            int ready = left > 0 ? ::poll(&readable, 1, static_cast<int>(left)) : 0;
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready <= 0) return false;
+        }
+        ssize_t got = ::read(fd, bytes, length);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        bytes += got;
+        length -= static_cast<size>(got);
+    }
+    return true;
+}
+
+static bool writeFrame(int fd, char type, const void* payload, u32 length) {
+    char header[5];
+    header[0] = type;
+    std::memcpy(header + 1, &length, sizeof(length));
+    return writeAll(fd, header, sizeof(header)) && writeAll(fd, payload, length);
+}
+
+// requests are small; anything claiming more than this is rejected
+static constexpr u32 MaxFrame = 64 * 1024 * 1024;
+
+static bool readFrame(int fd, char& type, std::string& payload,
+                      Clock::time_point deadline = Clock::time_point::max()) {
+    char header[5];
+    if (!readAll(fd, header, sizeof(header), deadline)) return false;
+    type = header[0];
+
+    u32 length;
+    std::memcpy(&length, header + 1, sizeof(length));
+    if (length > MaxFrame) return false;
+
+    payload.resize(length);
+    return readAll(fd, payload.data(), length, deadline);
+}
+
+static bool readJob(int fd, Job& job, Clock::time_point deadline) {
+    char type;
+    std::string payload;
+    bool hasScript = false;
+
+    while (readFrame(fd, type, payload, deadline)) {
+        switch (type) {
+        case 'P':
+        case 'S':
+            job.inlineSource = type == 'S';
+            job.script = std::move(payload);
+            hasScript = true;
+            break;
+        case 'A':
+            job.arguments.push_back(std::move(payload));
+            break;
+        case 'E':
+            return hasScript;
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+static int exitCode(Result result) {
+    switch (result) {
+    case Result::Ok:
+        return 0;
+    case Result::CompileError:
+        return 65;
+    case Result::RuntimeError:
+        return 70;
+    }
+    return 70;
+}
+
+static void sendOutput(const char* text, size length, void* userdata) {
+    // a client that went away only loses the rest of its output
+    writeFrame(*static_cast<int*>(userdata), 'O', text, static_cast<u32>(length));
+}
+
+static void sendExit(int client, int code) {
+    auto value = static_cast<u32>(code);
+    writeFrame(client, 'X', &value, sizeof(value));
+}
+
+// FNV-1a over the whole source
+static u64 hashSource(const std::string& source) {
+    u64 hash = 14695981039346656037ull;
+    for (char c : source) hash = (hash ^ static_cast<u8>(c)) * 1099511628211ull;
+    return hash;
+}
+
+Server::Server(std::string socketPath, int workers)
+    : socketPath_{std::move(socketPath)},
+      workers_{workers > 0 ? workers : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))} {
+}
+
+bool Server::run() {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath_.size() >= sizeof(address.sun_path)) {
+        fmt::print(stderr, "Socket path too long: {}\n", socketPath_);
+        return false;
+    }
+    std::memcpy(address.sun_path, socketPath_.c_str(), socketPath_.size() + 1);
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ::unlink(socketPath_.c_str());
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(listener, static_cast<int>(QueueCapacity)) != 0) {
+        fmt::print(stderr, "Failed to listen on {}: {}\n", socketPath_, std::strerror(errno));
+        if (listener >= 0) ::close(listener);
+        return false;
+    }
+
+    g_stop.store(false);
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < workers_; ++i) workers.emplace_back(&Server::work, this);
+    fmt::print(stderr, "glang serving on {} with {} workers\n", socketPath_, workers_);
+
+    // polls with a timeout so a stop request is noticed without a connection
+    while (!g_stop.load()) {
+        pollfd waiting{listener, POLLIN, 0};
+        if (::poll(&waiting, 1, 200) <= 0) continue;
+
+        int client = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) continue;
+
+        std::unique_lock lock{queueMutex_};
+        queueSpace_.wait(lock, [&] { return queue_.size() < QueueCapacity; });
+        queue_.push_back(client);
+        queueReady_.notify_one();
+    }
+
+    {
+        std::lock_guard lock{queueMutex_};
+        stopping_ = true;
+    }
+    queueReady_.notify_all();
+    for (auto& worker : workers) worker.join();
+
+    ::close(listener);
+    ::unlink(socketPath_.c_str());
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    return true;
+}
+
+void Server::work() {
+    // built while waiting, so a job never waits for its isolate
+    auto isolate = std::make_unique<Isolate>();
+
+    while (true) {
+        int client;
+        {
+            std::unique_lock lock{queueMutex_};
+            queueReady_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            client = queue_.front();
+            queue_.pop_front();
+        }
+        queueSpace_.notify_one();
+
+        handle(client, *isolate);
+        ::close(client);
+
+        // jobs never see each other's globals, and their heaps are freed
+        isolate.reset();
+        isolate = std::make_unique<Isolate>();
+    }
+}
+
+void Server::handle(int client, Isolate& isolate) {
+    // a client that never finishes its request would hold the worker
+    Job job;
+    if (!readJob(client, job, Clock::now() + std::chrono::seconds{RequestTimeout})) {
+        sendExit(client, 64);
+        return;
+    }
+
+    // line by line, so the client sees a long job's progress as it goes
+    OutputBuffer& output = isolate.vm().output();
+    output.redirect(sendOutput, &client, true);
+
+    std::string source;
+    if (job.inlineSource) {
+        source = std::move(job.script);
+    } else if (!utils::tryReadTextFile(job.script.c_str(), source)) {
+        output.write(fmt::format("Failed to open file: {}", job.script));
+        output.newline();
+        output.redirect(nullptr, nullptr);
+        sendExit(client, 74);
+        return;
+    }
+
+    isolate.setArguments(job.arguments);
+    ProgramRef program = compile(source, output);
+    int code = program != nullptr ? exitCode(isolate.run(program)) : 65;
+
+    output.redirect(nullptr, nullptr);
+    sendExit(client, code);
+}
+
+// programs that fail to compile are not cached; their errors are written
+// again each time
+ProgramRef Server::compile(const std::string& source, OutputBuffer& errors) {
+    u64 hash = hashSource(source);
+    {
+        std::lock_guard lock{cacheMutex_};
+        auto found = cache_.find(hash);
+        if (found != cache_.end() && found->second.source == source) return found->second.program;
+    }
+
+    ProgramRef program = Program::compile(source, errors);
+    if (program == nullptr) return nullptr;
+
+    std::lock_guard lock{cacheMutex_};
+    if (cache_.size() >= CacheCapacity && cache_.find(hash) == cache_.end()) cache_.erase(cache_.begin());
+    cache_[hash] = CachedProgram{source, program};
+    return program;
+}
+
+int Server::submit(const char* socketPath, const Job& job) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (std::strlen(socketPath) >= sizeof(address.sun_path)) {
+        fmt::print(stderr, "Socket path too long: {}\n", socketPath);
+        return 74;
+    }
+    std::strcpy(address.sun_path, socketPath);
+
+    int server = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server < 0 || ::connect(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        fmt::print(stderr, "Failed to connect to {}: {}\n", socketPath, std::strerror(errno));
+        if (server >= 0) ::close(server);
+        return 74;
+    }
+
+    bool sent = writeFrame(server, job.inlineSource ? 'S' : 'P', job.script.data(), static_cast<u32>(job.script.size()));
+    for (const auto& argument : job.arguments) {
+        sent = sent && writeFrame(server, 'A', argument.data(), static_cast<u32>(argument.size()));
+    }
+    sent = sent && writeFrame(server, 'E', nullptr, 0);
+
+    int code = 74; // unless the server says otherwise
+    char type;
+    std::string payload;
+    while (sent && readFrame(server, type, payload)) {
+        if (type == 'O') {
+            // passed on as it comes, whatever stdout is
+            std::fwrite(payload.data(), 1, payload.size(), stdout);
+            std::fflush(stdout);
+        } else if (type == 'X' && payload.size() == sizeof(u32)) {
+            u32 value;
+            std::memcpy(&value, payload.data(), sizeof(value));
+            code = static_cast<int>(value);
+            break;
+        }
+    }
+    std::fflush(stdout);
+    ::close(server);
+    return code;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "common.hh"
+#include "Program.hh"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Isolate;
+
+// A script submitted to a server: a path the server reads, or the source
+// itself, plus the arguments the script sees as 'args'.
+struct Job {
+    bool inlineSource{};
+    std::string script; // a path, or the source when 'inlineSource' is set
+    std::vector<std::string> arguments;
+};
+
+// A resident interpreter serving jobs over a Unix domain socket, so a job
+// pays for neither exec nor runtime start-up. A fixed pool of workers
+// takes connections off a bounded queue; once it is full, accepting waits.
+// Every job runs in a fresh isolate, which the worker builds while idle,
+// and programs are cached by a hash of their source, so a script that
+// does not change is compiled once.
+//
+// The protocol is a sequence of frames: a type byte, a 4-byte length in
+// host order and that many bytes. A client sends 'P' (a path) or 'S' (the
+// source), an 'A' per argument and 'E'. The server answers with 'O' frames
+// of output as it is produced and ends with 'X', a 4-byte exit code that
+// follows runFile: 0, 65 for compile and 70 for runtime errors, 74 when
+// the script cannot be read and 64 for a malformed request, or one that
+// does not arrive whole within RequestTimeout seconds.
+class Server {
+public:
+    Server(std::string socketPath, int workers);
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // serves until SIGINT or SIGTERM; false if the socket could not be set up
+    bool run();
+
+    // sends 'job', copies its output to stdout and returns its exit code
+    static int submit(const char* socketPath, const Job& job);
+
+private:
+    static constexpr size QueueCapacity = 64;
+    static constexpr size CacheCapacity = 256;
+    static constexpr int RequestTimeout = 10; // seconds
+
+    struct CachedProgram {
+        std::string source;
+        ProgramRef program;
+    };
+
+    void work();
+    void handle(int client, Isolate& isolate);
+    ProgramRef compile(const std::string& source, OutputBuffer& errors);
+
+private:
+    std::string socketPath_;
+    int workers_;
+
+    std::mutex queueMutex_;
+    std::condition_variable queueReady_;
+    std::condition_variable queueSpace_;
+    std::deque<int> queue_; // accepted connections
+    bool stopping_{};
+
+    std::mutex cacheMutex_;
+    std::unordered_map<u64, CachedProgram> cache_; // by hash of the source
+};
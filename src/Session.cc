@@ -0,0 +1,46 @@
+#include "Session.hh"
+#include "Scanner.hh"
+
+std::optional<Result> Session::feed(std::string_view line) {
+    buffer_.append(line);
+    buffer_.push_back('\n');
+    if (!isComplete(buffer_)) return std::nullopt;
+
+    std::string snippet;
+    snippet.swap(buffer_);
+    return evaluate(snippet);
+}
+
+Result Session::evaluate(const std::string& snippet, const RunOptions& options) {
+    return isolate_.interpret(snippet, options);
+}
+
+bool Session::isComplete(const std::string& code) {
+    Scanner scanner{code};
+    int depth = 0;
+
+    while (true) {
+        Token token = scanner.scanToken();
+        switch (token.type) {
+        case TokenLeftParen:
+        case TokenLeftBrace:
+        case TokenLeftBracket:
+            ++depth;
+            break;
+        case TokenRightParen:
+        case TokenRightBrace:
+        case TokenRightBracket:
+            --depth;
+            break;
+        case TokenError:
+            // anything else is an error the compiler will report
+            if (token.name == "Unterminated string") return false;
+            break;
+        case TokenEof:
+            // too many closing brackets cannot be fixed by more input
+            return depth <= 0;
+        default:
+            break;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.hh"
+#include "Isolate.hh"
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+// An interactive session for the REPL and notebook-style tools: one
+// isolate whose globals, and the strings they are interned under, stay
+// alive from one snippet to the next. Each snippet is compiled on its own
+// and linked against the globals already there. Input can span lines;
+// it is held back until its brackets balance and its strings are closed.
+class Session {
+public:
+    Session() = default;
+
+    // adds a line of input and runs the snippet once it is complete;
+    // nothing is run, and std::nullopt returned, while it is not
+    std::optional<Result> feed(std::string_view line);
+    // runs 'snippet' straight away
+    Result evaluate(const std::string& snippet, const RunOptions& options = {});
+
+    // whether feed() holds the start of an unfinished snippet
+    [[nodiscard]] bool pending() const { return !buffer_.empty(); }
+    void discardPending() { buffer_.clear(); }
+
+    Isolate& isolate() { return isolate_; }
+
+    // false if 'code' ends inside brackets or a string, so more is to come
+    static bool isComplete(const std::string& code);
+
+private:
+    Isolate isolate_;
+    std::string buffer_;
+};
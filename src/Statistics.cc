@@ -0,0 +1,120 @@
+#include "Statistics.hh"
+
+#include "ByteCode.hh"
+
+#include <algorithm>
+#include <ctime>
+#include <vector>
+
+#include <sys/resource.h>
+
+static const char* const g_phaseNames[] = {"read", "compile", "run"};
+static const char* const g_typeNames[ObjTypeCount] = {
+    "string", "function", "native", "array", "map", "class", "shape", "instance", "bound method", "fiber", "range", "lines", "channel"};
+
+static double clockMs(clockid_t clock) {
+    timespec now{};
+    clock_gettime(clock, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static double hitRate(const ObjFactory::Stats& stats) {
+    u64 lookups = stats.internHits + stats.internMisses;
+    return lookups == 0 ? 0.0 : 100.0 * static_cast<double>(stats.internHits) / static_cast<double>(lookups);
+}
+
+void Statistics::begin(Phase phase) {
+    phases_[phase].wallStart = clockMs(CLOCK_MONOTONIC);
+    phases_[phase].cpuStart = clockMs(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void Statistics::end(Phase phase) {
+    phases_[phase].wallMs += clockMs(CLOCK_MONOTONIC) - phases_[phase].wallStart;
+    phases_[phase].cpuMs += clockMs(CLOCK_PROCESS_CPUTIME_ID) - phases_[phase].cpuStart;
+}
+
+void Statistics::recordCode(const ByteCode& script) {
+    std::vector<const ByteCode*> pending{&script};
+    std::vector<const ByteCode*> seen;
+
+    while (!pending.empty()) {
+        const ByteCode* code = pending.back();
+        pending.pop_back();
+        if (std::find(seen.begin(), seen.end(), code) != seen.end()) continue;
+        seen.push_back(code);
+
+        ++functions_;
+        codeBytes_ += code->codeSize();
+        constants_ += code->constantCount();
+        lineEntries_ += code->codeSize(); // one line number per code byte
+
+        for (size i = 0; i < code->constantCount(); ++i) {
+            Value constant = code->getConstantAtOffset(static_cast<int>(i));
+            if (object::isFunction(constant)) pending.push_back(&object::asFunction(constant)->byteCode);
+        }
+    }
+}
+
+void Statistics::recordAllocations() {
+    memory_ = memory::g_stats;
+    objects_ = ObjFactory::stats();
+
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    maxRssKb_ = usage.ru_maxrss;
+}
+
+void Statistics::report(std::FILE* out) const {
+    fmt::print(out, "== stats ==\n{:<10} {:>10} {:>10}\n", "phase", "wall ms", "cpu ms");
+    for (int phase = 0; phase < PhaseCount; ++phase) {
+        fmt::print(out, "{:<10} {:>10.3f} {:>10.3f}\n", g_phaseNames[phase], phases_[phase].wallMs, phases_[phase].cpuMs);
+    }
+
+    fmt::print(out, "\nfunctions {}, bytecode {} bytes, constants {}, line table {} entries\n",
+               functions_, codeBytes_, constants_, lineEntries_);
+    fmt::print(out, "instructions executed {}\n", instructions_);
+
+    fmt::print(out, "\n{:<14} {:>12} {:>14}\n", "object", "count", "bytes");
+    for (int type = 0; type < ObjTypeCount; ++type) {
+        if (objects_.objects[type] == 0) continue;
+        fmt::print(out, "{:<14} {:>12} {:>14}\n", g_typeNames[type], objects_.objects[type], objects_.bytes[type]);
+    }
+
+    fmt::print(out, "\ninterned lookups {} hits / {} misses ({:.1f}% hit rate)\n",
+               objects_.internHits, objects_.internMisses, hitRate(objects_));
+    fmt::print(out, "heap: {} blocks, {} bytes allocated, {} freed, {} live, {} peak; max rss {} KiB\n",
+               memory_.allocations, memory_.bytesAllocated, memory_.bytesFreed, memory_.heapSize,
+               memory_.peakHeapSize, maxRssKb_);
+}
+
+bool Statistics::writeJson(const char* path) const {
+    std::FILE* file = std::fopen(path, "w");
+    if (file == nullptr) return false;
+
+    fmt::print(file, "{{\n  \"phases\": {{");
+    for (int phase = 0; phase < PhaseCount; ++phase) {
+        fmt::print(file, "{}\n    \"{}\": {{\"wall_ms\": {:.3f}, \"cpu_ms\": {:.3f}}}", phase == 0 ? "" : ",",
+                   g_phaseNames[phase], phases_[phase].wallMs, phases_[phase].cpuMs);
+    }
+    fmt::print(file, "\n  }},\n");
+    fmt::print(file, "  \"code\": {{\"functions\": {}, \"bytecode_bytes\": {}, \"constants\": {}, \"line_entries\": {}}},\n",
+               functions_, codeBytes_, constants_, lineEntries_);
+    fmt::print(file, "  \"instructions\": {},\n", instructions_);
+
+    fmt::print(file, "  \"objects\": {{");
+    bool first = true;
+    for (int type = 0; type < ObjTypeCount; ++type) {
+        if (objects_.objects[type] == 0) continue;
+        fmt::print(file, "{}\n    \"{}\": {{\"count\": {}, \"bytes\": {}}}", first ? "" : ",", g_typeNames[type],
+                   objects_.objects[type], objects_.bytes[type]);
+        first = false;
+    }
+    fmt::print(file, "\n  }},\n");
+    fmt::print(file, "  \"intern\": {{\"hits\": {}, \"misses\": {}, \"hit_rate\": {:.4f}}},\n",
+               objects_.internHits, objects_.internMisses, hitRate(objects_) / 100);
+    fmt::print(file, "  \"heap\": {{\"allocations\": {}, \"bytes_allocated\": {}, \"bytes_freed\": {}, "
+                     "\"live_bytes\": {}, \"peak_bytes\": {}, \"max_rss_kb\": {}}}\n}}\n",
+               memory_.allocations, memory_.bytesAllocated, memory_.bytesFreed, memory_.heapSize,
+               memory_.peakHeapSize, maxRssKb_);
+    return std::fclose(file) == 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.hh"
+#include "memory.hh"
+#include "object.hh"
+
+#include <cstdio>
+
+class ByteCode;
+
+// Everything --stats reports: wall and CPU time per phase, the size of the
+// compiled program, instructions executed and the allocation counters kept
+// by memory::reallocate() and ObjFactory. The counters are always on and
+// cost an add or two per allocation; only the instruction count needs the
+// counting instantiation of the interpreter loop.
+class Statistics {
+public:
+    enum Phase {
+        Read,
+        Compile,
+        Run,
+        PhaseCount
+    };
+
+    void begin(Phase phase);
+    void end(Phase phase);
+
+    // sums the script and every function reachable through its constants
+    void recordCode(const ByteCode& script);
+    void recordInstructions(u64 executed) { instructions_ = executed; }
+    // copies the allocation counters as they stand now
+    void recordAllocations();
+
+    void report(std::FILE* out) const;
+    bool writeJson(const char* path) const;
+
+private:
+    struct Timing {
+        double wallStart;
+        double cpuStart;
+        double wallMs;
+        double cpuMs;
+    };
+
+    Timing phases_[PhaseCount]{};
+
+    u64 functions_{};
+    u64 codeBytes_{};
+    u64 constants_{};
+    u64 lineEntries_{};
+    u64 instructions_{};
+
+    memory::Stats memory_{};
+    ObjFactory::Stats objects_{};
+    long maxRssKb_{};
+};
@@ -0,0 +1,37 @@
+#include "Tracer.hh"
+
+#include "Vm.hh"
+#include "object.hh"
+
+#include <iterator>
+
+Tracer::Tracer(debug::Filter filter, std::FILE* stream)
+    : filter_{filter},
+      stream_{stream} {}
+
+Tracer::~Tracer() {
+    flush();
+}
+
+void Tracer::instruction(const CallFrame& frame, int offset, const Value* stackTop) {
+    const ByteCode& code = *frame.code;
+    if (!filter_.matches(code.getLineNumber(offset), code.getOpCode(offset))) return;
+
+    auto out = std::back_inserter(buffer_);
+    fmt::format_to(out, "{:<16}", frame.function == nullptr ? "<script>" : object::functionName(frame.function));
+    for (const Value* slot = frame.slots; slot < stackTop; ++slot) {
+        Value value = *slot;
+        fmt::format_to(out, "[ {} ]", value.toString());
+    }
+    fmt::format_to(out, "\n");
+    debug::disassembleInstruction(code, offset, buffer_);
+
+    if (buffer_.size() >= Threshold) flush();
+}
+
+void Tracer::flush() {
+    if (buffer_.size() == 0) return;
+    std::fwrite(buffer_.data(), 1, buffer_.size(), stream_);
+    std::fflush(stream_);
+    buffer_.clear();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "common.hh"
+#include "debug.hh"
+#include "Value.hh"
+
+#include <cstdio>
+
+struct CallFrame;
+
+// Writes the running frame's value stack and the disassembled instruction
+// for every executed instruction that passes the filter. Text collects in a
+// buffer and goes to the stream in large writes, so tracing costs formatting
+// but not a write per instruction. Only the traced instantiation of the
+// interpreter loop calls into it.
+class Tracer {
+public:
+    explicit Tracer(debug::Filter filter, std::FILE* stream = stderr);
+    ~Tracer();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // called before the instruction at 'offset' in 'frame' is dispatched
+    void instruction(const CallFrame& frame, int offset, const Value* stackTop);
+    void flush();
+
+private:
+    static constexpr size Threshold = 64 * 1024;
+
+    debug::Filter filter_;
+    std::FILE* stream_;
+    debug::Buffer buffer_;
+};
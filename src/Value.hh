@@ -34,7 +34,7 @@ struct Value {
     static Value createObj(T* object) { return Value{.type = ValObj, .as{(Obj*)object}}; }
 
     std::string toString();
-    void print() { fmt::print(toString()); }
+    void print() { fmt::print("{}", toString()); }
     static bool equal(Value a, Value b);
 
     ValueType type;
@@ -1,23 +1,24 @@
 #include "Vm.hh"
 #include "debug.hh"
-#include "compiler.hh"
 #include "object.hh"
 #include "memory.hh"
+#include "natives.hh"
+#include "Parallel.hh"
+#include "EventLoop.hh"
+#include "array.hh"
+#include "map.hh"
+#include "shape.hh"
+#include "Profiler.hh"
+#include "Sampler.hh"
+#include "Tracer.hh"
 
-Result interpret(const std::string& code) {
-    ByteCode byteCode;
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
 
-    if (!compile(code, byteCode)) {
-        return Result::CompileError;
-    }
-
-    GlangVm vMachine{byteCode};
-
-    auto result = vMachine.interpret();
-
-    // fmt::print("{}\n", code);
-    return result;
-}
+#include <unistd.h>
 
 static bool isFalsey(Value value) {
     return value.isNil() || (value.isBool() && !value.asBool());
@@ -34,38 +35,157 @@ static bool isFalsey(Value value) {
         pushToStack(valueType(op1 op op2));                         \
     } while (false)
 
-GlangVm::GlangVm(const ByteCode& code)
-    : code_{code},
-      iPtr_{nullptr},
-      stack_{},
-      stackTop_{stack_} {
+GlangVm::GlangVm()
+    : initString_{ObjFactory::copyString("init", 4)} {
+    root_.obj.type = OBJ_FIBER;
+    root_.frameCapacity = FRAMES_MAX;
+    root_.frames = rootFrames_;
+    root_.stackCapacity = STACK_MAX;
+    root_.stack = rootStack_;
+    natives::defineStandard(*this);
+}
+
+GlangVm::~GlangVm() {
+    dropWaits();
 }
 
-void GlangVm::init(const ByteCode& code) {
-    code_ = code;
-    iPtr_ = nullptr;
+void GlangVm::defineNative(std::string_view name, NativeFn function, int arity, void* data) {
+    ObjString* nameString = ObjFactory::copyString(name.data(), static_cast<int>(name.size()));
+    globals_.set(nameString, Value::createObj(ObjFactory::newNative(function, arity, nameString, data)));
+}
+
+Result GlangVm::interpret(const ProgramRef& program) {
+    const ByteCode& script = program->script();
+    if (script.maxStack() > STACK_MAX) {
+        output_.write("Stack overflow.");
+        output_.newline();
+        output_.flush();
+        return Result::RuntimeError;
+    }
+    running_ = &link(*program);
+
+    startRoot(nullptr, script, &running_->chunks[0]);
+    return execute();
+}
+
+Result GlangVm::callFunction(ObjFunction* function, int argCount, const Value* args, Value& result) {
+    const ByteCode& code = function->byteCode;
+    if (code.maxStack() > STACK_MAX) {
+        output_.write("Stack overflow.");
+        output_.newline();
+        output_.flush();
+        return Result::RuntimeError;
+    }
+    running_ = &link(*code.program());
+
+    startRoot(function, code, &running_->chunks[code.index()]);
+    stack_[0] = Value::createObj(function);
+    std::copy(args, args + argCount, stack_ + 1);
+    stackTop_ = stack_ + argCount + 1;
+
+    Result outcome = execute();
+    if (outcome == Result::Ok) result = root_.result;
+    return outcome;
+}
+
+void GlangVm::startRoot(ObjFunction* function, const ByteCode& code, CodeState* state) {
+    // fibers an earlier run left behind, after an error, are not resumed
+    root_.state = FiberState::Running;
+    fiber_ = &root_;
+    readyHead_ = readyTail_ = nullptr;
+    dropWaits();
+    budget_ = SliceLength;
+
+    frames_ = rootFrames_;
+    stack_ = rootStack_;
+    stackEnd_ = rootStack_ + STACK_MAX;
     stackTop_ = stack_;
+    frameCount_ = 1;
+    frame_ = &frames_[0];
+    frame_->function = function;
+    frame_->code = &code;
+    frame_->state = state;
+    frame_->slots = stack_;
+    iPtr_ = code.code_.data();
+}
+
+Result GlangVm::execute() {
+    if (sampler_ != nullptr) sampler_->start(*this);
+
+    using Loop = Result (GlangVm::*)();
+    static constexpr Loop loops[] = {
+        &GlangVm::run<Normal>,
+        &GlangVm::run<Profiled>,
+        &GlangVm::run<Traced>,
+        &GlangVm::run<Profiled | Traced>,
+        &GlangVm::run<Counted>,
+        &GlangVm::run<Counted | Profiled>,
+        &GlangVm::run<Counted | Traced>,
+        &GlangVm::run<Counted | Profiled | Traced>,
+    };
+    unsigned mode = (profiler_ != nullptr ? Profiled : Normal) |
+                    (tracer_ != nullptr ? Traced : Normal) |
+                    (counting_ ? Counted : Normal);
+    Result result = (this->*loops[mode])();
+
+    if (profiler_ != nullptr) profiler_->finish();
+    if (tracer_ != nullptr) tracer_->flush();
+
+    if (sampler_ != nullptr) sampler_->stop();
+    return result;
 }
 
-Result GlangVm::interpret() {
-    iPtr_ = code_.code_.data();
-    return run();
+LinkedProgram& GlangVm::link(const Program& program) {
+    auto found = linked_.find(&program);
+    if (found != linked_.end()) return found->second;
+
+    // a script without functions leaves nothing behind that calls back
+    // into it, so once this VM holds the last reference no one can run it
+    // again and its side tables go; REPL and session snippets are such
+    for (auto iter = linked_.begin(); iter != linked_.end();) {
+        const LinkedProgram& other = iter->second;
+        bool unreachable = &other != running_ && other.program->chunks().size() == 1 && other.program.use_count() == 1;
+        iter = unreachable ? linked_.erase(iter) : std::next(iter);
+    }
+
+    LinkedProgram& linked = linked_[&program];
+    linked.program = program.shared_from_this();
+    linked.chunks.resize(program.chunks().size());
+    for (const ByteCode* code : program.chunks()) {
+        CodeState& state = linked.chunks[code->index()];
+        state.constants = code->constants_;
+        for (Value& constant : state.constants) {
+            if (!object::isString(constant)) continue;
+            ObjString* string = object::asString(constant);
+            constant = Value::createObj(ObjFactory::copyString(string->chars, string->length));
+        }
+        state.globals.assign(code->constantCount(), nullptr);
+        state.caches.assign(code->cacheCount(), PropertyCache{});
+    }
+    return linked;
 }
-Result GlangVm::interpret(const ByteCode& code) {
-    code_ = code;
-    return interpret();
+
+// a function can come from a different program than its caller, when
+// an earlier script on this VM stored it in a global
+CodeState* GlangVm::stateFor(const ByteCode& code) {
+    if (code.program() != running_->program.get()) running_ = &link(*code.program());
+    return &running_->chunks[code.index()];
 }
 
+template <unsigned Mode>
 Result GlangVm::run() {
-#ifdef TRACE_VM_EXECUTION
-    fmt::print("==== Tracing execution ====\n");
-#endif
-
     while (true) {
-#ifdef TRACE_VM_EXECUTION
-        printStack();
-        debug::disassembleInstruction(code_, static_cast<int>(iPtr_ - code_.code_.data()));
-#endif
+        if constexpr ((Mode & Counted) != 0) {
+            ++executed_;
+        }
+        if constexpr ((Mode & Traced) != 0) {
+            auto offset = static_cast<int>(iPtr_ - frame_->code->code_.data());
+            tracer_->instruction(*frame_, offset, stackTop_);
+        }
+        if constexpr ((Mode & Profiled) != 0) {
+            auto offset = static_cast<int>(iPtr_ - frame_->code->code_.data());
+            profiler_->instruction(frames_, frameCount_, offset, toOp(*iPtr_));
+        }
 
         // fetch instruction
         auto instruction = readInstr();
@@ -73,8 +193,33 @@ Result GlangVm::run() {
         // decode and execute
         switch (instruction) {
 
+        case OpCode::Generator: {
+            // the call of a generator function: its frame moves to a fiber
+            // that waits to be iterated, which is returned in its place
+            ObjFunction* function = frame_->function;
+            ObjFiber* generator = makeFiber(function, frame_->slots[0], frame_->slots + 1, function->arity, iPtr_);
+            generator->state = FiberState::Suspended;
+            pushToStack(Value::createObj(generator));
+            [[fallthrough]];
+        }
         case OpCode::Return: {
-            return Result::Ok;
+            Value result = popFromStack();
+            if (frameCount_ == 1) {
+                if (fiber_ == &root_ && readyHead_ == nullptr) {
+                    root_.result = result;
+                    return Result::Ok;
+                }
+                // the script is done once every fiber is
+                if (!finishFiber(result)) return root_.state == FiberState::Done ? Result::Ok : Result::RuntimeError;
+                break;
+            }
+
+            stackTop_ = frame_->slots;
+            --frameCount_;
+            frame_ = &frames_[frameCount_ - 1];
+            iPtr_ = frame_->ip;
+            pushToStack(result);
+            break;
         }
 
         case OpCode::Constant: {
@@ -84,7 +229,7 @@ Result GlangVm::run() {
         }
 
         case OpCode::Negate: {
-            if (peekStack(0).isNumber()) {
+            if (!peekStack(0).isNumber()) {
                 runtimeError("Operand must be a number");
                 return Result::RuntimeError;
             }
@@ -149,8 +294,8 @@ Result GlangVm::run() {
             break;
 
         case OpCode::Print:
-            popFromStack().print();
-            fmt::print("\n");
+            output_.write(popFromStack());
+            output_.newline();
             break;
 
         case OpCode::Pop:
@@ -165,37 +310,39 @@ Result GlangVm::run() {
         }
 
         case OpCode::GetGlobal: {
-            ObjString* name = object::asString(readConstant());
-
-            auto val = globals_.get(name);
-            if (!val.has_value()) {
-                runtimeError("Undefined variable {}.", name->chars);
+            Value* slot = readGlobal();
+            if (slot == nullptr) {
+                undefinedGlobal("Undefined variable {}.");
                 return Result::RuntimeError;
             }
 
-            pushToStack(val.value());
+            pushToStack(*slot);
             break;
         }
 
         case OpCode::SetGlobal: {
-            ObjString* name = object::asString(readConstant());
-            if (globals_.set(name, peekStack(0))) {
-                globals_.deleteEntry(name);
-                runtimeError("Undefined Variable {}.", name->chars);
+            Value* slot = readGlobal();
+            if (slot == nullptr) {
+                undefinedGlobal("Undefined Variable {}.");
+                return Result::RuntimeError;
+            }
+            if (globalsReadOnly_) {
+                runtimeError("Can't assign global {} in a parallel loop.", object::asCString(frame_->state->constants[iPtr_[-1]]));
                 return Result::RuntimeError;
             }
+            *slot = peekStack(0);
             break;
         }
 
         case OpCode::GetLocal: {
             auto slot = readByte();
-            pushToStack(stack_[slot]);
+            pushToStack(frame_->slots[slot]);
             break;
         }
 
         case OpCode::SetLocal: {
             auto slot = readByte();
-            stack_[slot] = peekStack(0);
+            frame_->slots[slot] = peekStack(0);
             break;
         }
         case OpCode::JmpIfFalse: {
@@ -211,6 +358,300 @@ Result GlangVm::run() {
         case OpCode::Loop: {
             auto offset = readShort();
             iPtr_ -= offset;
+            if (--budget_ == 0 && !reschedule()) return Result::RuntimeError;
+            break;
+        }
+        case OpCode::Call: {
+            int argCount = readByte();
+            if (!callValue(peekStack(argCount), argCount)) {
+                return Result::RuntimeError;
+            }
+            if (--budget_ == 0 && !reschedule()) return Result::RuntimeError;
+            break;
+        }
+        case OpCode::TailCall: {
+            int argCount = readByte();
+            Value callee = peekStack(argCount);
+            bool ok = object::isFunction(callee) ? tailCall(object::asFunction(callee), argCount)
+                                                 : callValue(callee, argCount);
+            if (!ok) return Result::RuntimeError;
+            if (--budget_ == 0 && !reschedule()) return Result::RuntimeError;
+            break;
+        }
+        case OpCode::BuildArray: {
+            int count = readByte();
+            ObjArray* array = ObjFactory::newArray(count);
+            for (Value* element = stackTop_ - count; element < stackTop_; ++element) {
+                array::push(array, *element);
+            }
+            stackTop_ -= count;
+            pushToStack(Value::createObj(array));
+            break;
+        }
+        case OpCode::BuildMap: {
+            int count = readByte();
+            ObjMap* map = ObjFactory::newMap();
+            for (Value* entry = stackTop_ - 2 * count; entry < stackTop_; entry += 2) {
+                map::set(map, entry[0], entry[1]);
+            }
+            stackTop_ -= 2 * count;
+            pushToStack(Value::createObj(map));
+            break;
+        }
+        case OpCode::IndexGet: {
+            Value target = peekStack(1);
+            if (object::isArray(target)) {
+                ObjArray* array = object::asArray(target);
+                int index = array::checkedIndex(array, peekStack(0));
+                if (index < 0) {
+                    runtimeError("Array index {} out of bounds for length {}.", peekStack(0).toString(), array->count);
+                    return Result::RuntimeError;
+                }
+
+                stackTop_ -= 2;
+                pushToStack(array::get(array, index));
+            } else if (object::isMap(target)) {
+                Value value = map::get(object::asMap(target), peekStack(0));
+                stackTop_ -= 2;
+                pushToStack(value);
+            } else {
+                runtimeError("Only arrays and maps can be indexed.");
+                return Result::RuntimeError;
+            }
+            break;
+        }
+        case OpCode::IndexSet: {
+            Value target = peekStack(2);
+            Value value = peekStack(0);
+            if (object::isArray(target)) {
+                ObjArray* array = object::asArray(target);
+                int index = array::checkedIndex(array, peekStack(1));
+                if (index < 0) {
+                    runtimeError("Array index {} out of bounds for length {}.", peekStack(1).toString(), array->count);
+                    return Result::RuntimeError;
+                }
+                if (!array::writable(array)) {
+                    runtimeError("Can't modify a global array in a parallel loop.");
+                    return Result::RuntimeError;
+                }
+                array::set(array, index, value);
+            } else if (object::isMap(target)) {
+                ObjMap* map = object::asMap(target);
+                if (map->readOnly) {
+                    runtimeError("Can't modify a global map in a parallel loop.");
+                    return Result::RuntimeError;
+                }
+                map::set(map, peekStack(1), value);
+            } else {
+                runtimeError("Only arrays and maps can be indexed.");
+                return Result::RuntimeError;
+            }
+
+            stackTop_ -= 3;
+            pushToStack(value);
+            break;
+        }
+        case OpCode::Class:
+            pushToStack(Value::createObj(ObjFactory::newClass(object::asString(readConstant()))));
+            break;
+        case OpCode::Method: {
+            ObjString* name = object::asString(readConstant());
+            ObjClass* klass = object::asClass(peekStack(1));
+            klass->methods.set(name, peekStack(0));
+            if (name == initString_) {
+                klass->initializer = object::asFunction(peekStack(0));
+            }
+            popFromStack();
+            break;
+        }
+        case OpCode::GetProperty: {
+            ObjString* name = object::asString(readConstant());
+            PropertyCache& cache = readCache();
+            if (!object::isInstance(peekStack(0))) {
+                runtimeError("Only instances have properties.");
+                return Result::RuntimeError;
+            }
+
+            ObjInstance* instance = object::asInstance(peekStack(0));
+            const CacheEntry* entry = cache.find(instance->shape);
+            CacheEntry miss{};
+            if (entry == nullptr) {
+                if (!lookupProperty(instance, name, miss)) {
+                    runtimeError("Undefined property '{}'.", name->chars);
+                    return Result::RuntimeError;
+                }
+                cache.add(miss);
+                entry = &miss;
+            }
+
+            if (entry->method != nullptr) {
+                stackTop_[-1] = Value::createObj(ObjFactory::newBoundMethod(peekStack(0), entry->method));
+            } else {
+                stackTop_[-1] = instance->fields[entry->slot];
+            }
+            break;
+        }
+        case OpCode::SetProperty: {
+            ObjString* name = object::asString(readConstant());
+            PropertyCache& cache = readCache();
+            if (!object::isInstance(peekStack(1))) {
+                runtimeError("Only instances have fields.");
+                return Result::RuntimeError;
+            }
+
+            ObjInstance* instance = object::asInstance(peekStack(1));
+            const CacheEntry* entry = cache.find(instance->shape);
+            CacheEntry miss{};
+            if (entry == nullptr) {
+                miss.shape = instance->shape;
+                miss.slot = shape::lookup(instance->shape, name);
+                if (miss.slot < 0) {
+                    miss.slot = static_cast<int>(instance->shape->keys.size());
+                    miss.transition = shape::transition(instance->shape, name);
+                }
+                cache.add(miss);
+                entry = &miss;
+            }
+
+            if (entry->transition != nullptr) {
+                instance::reshape(instance, entry->transition);
+            }
+            instance->fields[entry->slot] = peekStack(0);
+
+            Value value = popFromStack();
+            stackTop_[-1] = value;
+            break;
+        }
+        case OpCode::Invoke: {
+            ObjString* name = object::asString(readConstant());
+            int argCount = readByte();
+            PropertyCache& cache = readCache();
+            if (!object::isInstance(peekStack(argCount))) {
+                runtimeError("Only instances have methods.");
+                return Result::RuntimeError;
+            }
+
+            ObjInstance* instance = object::asInstance(peekStack(argCount));
+            const CacheEntry* entry = cache.find(instance->shape);
+            CacheEntry miss{};
+            if (entry == nullptr) {
+                if (!lookupProperty(instance, name, miss)) {
+                    runtimeError("Undefined property '{}'.", name->chars);
+                    return Result::RuntimeError;
+                }
+                cache.add(miss);
+                entry = &miss;
+            }
+
+            bool ok;
+            if (entry->method != nullptr) {
+                ok = call(entry->method, argCount);
+            } else {
+                // a field holding something callable
+                stackTop_[-argCount - 1] = instance->fields[entry->slot];
+                ok = callValue(stackTop_[-argCount - 1], argCount);
+            }
+            if (!ok) return Result::RuntimeError;
+            if (--budget_ == 0 && !reschedule()) return Result::RuntimeError;
+            break;
+        }
+        case OpCode::ForRangeInit: {
+            auto slot = readByte();
+            bool inclusive = readByte();
+            auto offset = readShort();
+            Value counter = frame_->slots[slot];
+            Value limit = frame_->slots[slot + 1];
+            if (!counter.isNumber() || !limit.isNumber()) {
+                runtimeError("Operands must be numbers");
+                return Result::RuntimeError;
+            }
+
+            double i = counter.asNumber();
+            double n = limit.asNumber();
+            if (!(inclusive ? i <= n : i < n)) iPtr_ += offset;
+            break;
+        }
+        case OpCode::ForRangeStep: {
+            // the counter and limit were checked by ForRangeInit and the body never assigns them
+            auto slot = readByte();
+            bool inclusive = readByte();
+            double step = readConstant().asNumber();
+            auto offset = readShort();
+            double i = frame_->slots[slot].asNumber() + step;
+            double n = frame_->slots[slot + 1].asNumber();
+            frame_->slots[slot] = Value::createNumber(i);
+            if (inclusive ? i <= n : i < n) {
+                iPtr_ -= offset;
+                if (--budget_ == 0 && !reschedule()) return Result::RuntimeError;
+            }
+            break;
+        }
+        case OpCode::Yield: {
+            Value value = popFromStack();
+            ObjFiber* resumer = fiber_->resumer;
+            if (resumer == nullptr) {
+                // a spawned fiber or the script: nobody takes the value
+                if (!reschedule()) return Result::RuntimeError;
+                break;
+            }
+
+            fiber_->result = value;
+            fiber_->pending = true;
+            fiber_->resumer = nullptr;
+            fiber_->state = FiberState::Suspended;
+            switchTo(resumer);
+            break;
+        }
+        case OpCode::ForIn: {
+            auto slot = readByte();
+            auto offset = readShort();
+            Value* loop = &frame_->slots[slot]; // the iterable, its cursor and the loop variable
+
+            if (object::isArray(loop[0])) {
+                ObjArray* array = object::asArray(loop[0]);
+                int index = loop[1].isNil() ? 0 : static_cast<int>(loop[1].asNumber());
+                if (index < array->count) {
+                    loop[2] = array::get(array, index);
+                    loop[1] = Value::createNumber(index + 1);
+                } else {
+                    iPtr_ += offset;
+                }
+            } else if (object::isRange(loop[0])) {
+                ObjRange* range = object::asRange(loop[0]);
+                double i = loop[1].isNil() ? range->start : loop[1].asNumber();
+                if (range->step > 0 ? i < range->end : i > range->end) {
+                    loop[2] = Value::createNumber(i);
+                    loop[1] = Value::createNumber(i + range->step);
+                } else {
+                    iPtr_ += offset;
+                }
+            } else {
+                switch (iterate(loop)) {
+                case Iteration::Next:
+                case Iteration::Resumed:
+                    break;
+                case Iteration::Done:
+                    iPtr_ += offset;
+                    break;
+                case Iteration::Failed:
+                    return Result::RuntimeError;
+                }
+            }
+            break;
+        }
+        case OpCode::ParallelFor: {
+            ObjFunction* body = object::asFunction(readConstant());
+            auto reduction = static_cast<Reduction>(readByte());
+            if (!object::isRange(peekStack(0))) {
+                runtimeError("A parallel loop needs a range.");
+                return Result::RuntimeError;
+            }
+
+            Value result;
+            if (!parallel::run(*this, globals_, body, object::asRange(peekStack(0)), reduction, result)) {
+                return Result::RuntimeError;
+            }
+            stackTop_[-1] = result;
             break;
         }
         }
@@ -233,7 +674,37 @@ OpCode GlangVm::readInstr() {
 Value GlangVm::readConstant() {
     auto operand = *iPtr_;
     ++iPtr_;
-    return code_.getConstantAtOffset(operand);
+    return frame_->state->constants[operand];
+}
+
+PropertyCache& GlangVm::readCache() {
+    auto index = readShort();
+    return frame_->state->caches[index];
+}
+
+// the slot of the global a Get/SetGlobal names, looked up by name the
+// first time only; nullptr while the global is undefined
+Value* GlangVm::readGlobal() {
+    auto operand = readByte();
+    Value*& slot = frame_->state->globals[operand];
+    if (slot == nullptr) slot = globals_.find(object::asString(frame_->state->constants[operand]));
+    return slot;
+}
+
+void GlangVm::markUnshared(std::string_view name, std::string what) {
+    unshared_[ObjFactory::copyString(name.data(), static_cast<int>(name.size()))] = std::move(what);
+}
+
+// reports the global the Get/SetGlobal just read as undefined, unless it
+// is one a parallel loop's worker could not be given
+void GlangVm::undefinedGlobal(std::string_view message) {
+    ObjString* name = object::asString(frame_->state->constants[iPtr_[-1]]);
+    auto unshared = unshared_.find(name);
+    if (unshared != unshared_.end()) {
+        runtimeError("A parallel loop can't use global {}: it holds {}.", name->chars, unshared->second);
+        return;
+    }
+    runtimeError(message, name->chars);
 }
 
 void GlangVm::pushToStack(Value value) {
@@ -248,21 +719,495 @@ Value GlangVm::peekStack(int distance) {
     return stackTop_[-1 - distance];
 }
 
-void GlangVm::printStack() {
-    fmt::print("Stack: [");
-    for (auto slot = stack_; slot < stackTop_; ++slot) {
-        fmt::print(" {} ", slot->toString());
+void GlangVm::printStackTrace() {
+    frame_->ip = iPtr_;
+    for (int i = frameCount_ - 1; i >= 0; --i) {
+        CallFrame* frame = &frames_[i];
+        size_t instruction = frame->ip - frame->code->code_.data() - 1;
+        auto line = frame->code->lineNumbers_[instruction];
+        if (frame->function == nullptr) {
+            output_.write(fmt::format("[line {}] in script", line));
+        } else {
+            output_.write(fmt::format("[line {}] in {}()", line, frame->function->name->chars));
+        }
+        output_.newline();
+    }
+}
+
+bool GlangVm::callValue(Value callee, int argCount) {
+    if (object::isFunction(callee)) {
+        return call(object::asFunction(callee), argCount);
+    }
+    if (object::isNative(callee)) {
+        return callNative(object::asNative(callee), argCount);
+    }
+    if (object::isClass(callee)) {
+        ObjClass* klass = object::asClass(callee);
+        stackTop_[-argCount - 1] = Value::createObj(ObjFactory::newInstance(klass));
+        if (klass->initializer != nullptr) {
+            return call(klass->initializer, argCount);
+        }
+        if (argCount != 0) {
+            runtimeError("Expected 0 arguments but got {}.", argCount);
+            return false;
+        }
+        return true;
+    }
+    if (object::isBoundMethod(callee)) {
+        ObjBoundMethod* bound = object::asBoundMethod(callee);
+        stackTop_[-argCount - 1] = bound->receiver;
+        return call(bound->method, argCount);
+    }
+
+    runtimeError("Can only call functions and classes.");
+    return false;
+}
+
+// fills 'entry' with where 'name' lives for instances of the current
+// shape: a field slot, or else a method of the class
+bool GlangVm::lookupProperty(ObjInstance* instance, ObjString* name, CacheEntry& entry) {
+    entry.shape = instance->shape;
+    entry.transition = nullptr;
+    entry.slot = shape::lookup(instance->shape, name);
+    entry.method = nullptr;
+    if (entry.slot >= 0) return true;
+
+    auto method = instance->klass->methods.get(name);
+    if (!method.has_value()) return false;
+
+    entry.method = object::asFunction(method.value());
+    return true;
+}
+
+// the arguments are handed over in place: no copy and no frame
+bool GlangVm::callNative(ObjNative* native, int argCount) {
+    if (native->arity != -1 && argCount != native->arity) {
+        runtimeError("Expected {} arguments but got {}.", native->arity, argCount);
+        return false;
+    }
+
+    Value* args = stackTop_ - argCount;
+    if (!native->function(*this, argCount, args)) {
+        return false;
+    }
+
+    stackTop_ = args; // the result sits in the callee's slot
+    return true;
+}
+
+bool GlangVm::call(ObjFunction* function, int argCount) {
+    if (argCount != function->arity) {
+        runtimeError("Expected {} arguments but got {}.", function->arity, argCount);
+        return false;
+    }
+
+    // the verifier bounded how deep the callee's stack can get, so room is
+    // reserved here and run() never checks for it
+    Value* slots = stackTop_ - argCount - 1;
+    int needed = function->byteCode.maxStack();
+    if ((frameCount_ == fiber_->frameCapacity && !growFrames()) ||
+        (slots + needed > stackEnd_ && !growStack(slots, needed))) {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
+    frame_->ip = iPtr_;
+    frame_ = &frames_[frameCount_++];
+    frame_->function = function;
+    frame_->code = &function->byteCode;
+    frame_->state = stateFor(function->byteCode);
+    frame_->slots = slots;
+    iPtr_ = function->byteCode.code_.data();
+    return true;
+}
+
+// replaces the running frame with a call to 'function', so a chain of
+// tail calls runs in constant frame and value-stack space
+bool GlangVm::tailCall(ObjFunction* function, int argCount) {
+    if (argCount != function->arity) {
+        runtimeError("Expected {} arguments but got {}.", function->arity, argCount);
+        return false;
+    }
+
+    Value* slots = frame_->slots;
+    int needed = function->byteCode.maxStack();
+    if (slots + needed > stackEnd_ && !growStack(slots, needed)) {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
+    Value* callee = stackTop_ - argCount - 1;
+    std::copy(callee, stackTop_, frame_->slots);
+    stackTop_ = frame_->slots + argCount + 1;
+
+    frame_->function = function;
+    frame_->code = &function->byteCode;
+    frame_->state = stateFor(function->byteCode);
+    iPtr_ = function->byteCode.code_.data();
+    return true;
+}
+
+ObjFiber* GlangVm::spawn(Value callee, int argCount, const Value* args) {
+    ObjFunction* function;
+    Value receiver = callee;
+    if (object::isFunction(callee)) {
+        function = object::asFunction(callee);
+    } else if (object::isBoundMethod(callee)) {
+        function = object::asBoundMethod(callee)->method;
+        receiver = object::asBoundMethod(callee)->receiver;
+    } else {
+        runtimeError("spawn() expects a function.");
+        return nullptr;
+    }
+    if (argCount != function->arity) {
+        runtimeError("Expected {} arguments but got {}.", function->arity, argCount);
+        return nullptr;
+    }
+
+    // a generator function's body runs as the fiber itself
+    const u8* ip = function->byteCode.code_.data();
+    if (toOp(*ip) == OpCode::Generator) ++ip;
+
+    ObjFiber* fiber = makeFiber(function, receiver, args, argCount, ip);
+    enqueue(fiber);
+    return fiber;
+}
+
+// a fiber about to run 'function' from 'ip', with a stack sized for the
+// function alone; calls grow it
+ObjFiber* GlangVm::makeFiber(ObjFunction* function, Value receiver, const Value* args, int argCount, const u8* ip) {
+    const ByteCode& code = function->byteCode;
+    ObjFiber* fiber = ObjFactory::newFiber();
+    fiber->stackCapacity = code.maxStack();
+    fiber->stack = memory::allocate<Value>(fiber->stackCapacity);
+    fiber->stack[0] = receiver;
+    std::copy(args, args + argCount, fiber->stack + 1);
+    fiber->stackTop = fiber->stack + argCount + 1;
+
+    fiber->frameCapacity = 1;
+    fiber->frameCount = 1;
+    fiber->frames = memory::allocate<CallFrame>(1);
+    fiber->frames[0] = CallFrame{function, &code, stateFor(code), ip, fiber->stack};
+    return fiber;
+}
+
+bool GlangVm::join(ObjFiber* fiber, Value* result) {
+    if (fiber->state == FiberState::Done) {
+        *result = fiber->result;
+        return true;
+    }
+    if (fiber == fiber_) {
+        runtimeError("A fiber cannot join itself.");
+        return false;
+    }
+
+    // finishFiber() fills in the result
+    *result = Value::createNil();
+    fiber_->state = FiberState::Waiting;
+    fiber_->next = fiber->waiters;
+    fiber->waiters = fiber_;
+    budget_ = 1; // so the switch point after the call gives way at once
+    return true;
+}
+
+void GlangVm::park(std::unique_ptr<Wait> wait) {
+    fiber_->wait = wait.release();
+    fiber_->state = FiberState::Waiting;
+    fiber_->parkedAt = static_cast<int>(parked_.size());
+    parked_.push_back(fiber_);
+    budget_ = 1;
+}
+
+void GlangVm::enqueue(ObjFiber* fiber) {
+    fiber->state = FiberState::Ready;
+    fiber->next = nullptr;
+    if (readyTail_ != nullptr) {
+        readyTail_->next = fiber;
+    } else {
+        readyHead_ = fiber;
     }
-    fmt::print("]\n");
+    readyTail_ = fiber;
 }
 
-// void GlangVm::runtimeError(std::string_view msg) {
+ObjFiber* GlangVm::dequeue() {
+    ObjFiber* fiber = readyHead_;
+    readyHead_ = fiber->next;
+    if (readyHead_ == nullptr) readyTail_ = nullptr;
+    return fiber;
+}
+
+// a switch point: the running fiber goes to the back of the run queue, or
+// stays off it if it blocked, and the first ready fiber takes over
+bool GlangVm::reschedule() {
+    budget_ = SliceLength;
+    if (!parked_.empty()) resumeWaits(false);
+    if (fiber_->state == FiberState::Running) {
+        if (readyHead_ == nullptr) return true;
+        enqueue(fiber_);
+    } else if (!awaitReady()) {
+        runtimeError("Deadlock: every fiber is waiting.");
+        return false;
+    }
+
+    switchTo(dequeue());
+    return true;
+}
 
-//     fmt::print("{}\n", msg);
-//     size_t instruction = iPtr_ - code_.code_.data() - 1;
-//     auto line = code_.lineNumbers_[instruction];
-//     fmt::print("[line {}] in script\n", line);
-// }
+// the running fiber returned 'result': its joiners get it and the loop
+// iterating it, if it is a generator, or else the next ready fiber takes
+// over; false once there is none
+bool GlangVm::finishFiber(Value result) {
+    ObjFiber* finished = fiber_;
+    finished->state = FiberState::Done;
+    finished->result = result;
+    while (finished->waiters != nullptr) {
+        ObjFiber* waiter = finished->waiters;
+        finished->waiters = waiter->next;
+        // parked right after its join() returned, so its result is on top
+        waiter->stackTop[-1] = result;
+        enqueue(waiter);
+    }
+
+    ObjFiber* next = finished->resumer;
+    finished->resumer = nullptr;
+    if (next == nullptr) {
+        // once the script is done, parked fibers are left where they are
+        if (root_.state == FiberState::Done ? readyHead_ == nullptr : !awaitReady()) {
+            if (root_.state != FiberState::Done) runtimeError("Deadlock: every fiber is waiting.");
+            return false;
+        }
+        next = dequeue();
+    }
+
+    switchTo(next);
+    if (finished != &root_) {
+        memory::free(finished->frames, sizeof(CallFrame) * finished->frameCapacity);
+        memory::free(finished->stack, sizeof(Value) * finished->stackCapacity);
+        finished->frames = nullptr;
+        finished->frameCapacity = 0;
+        finished->stack = finished->stackTop = nullptr;
+        finished->stackCapacity = 0;
+    }
+    return true;
+}
+
+// resumes the waits of the fibers posted to the inbox, or whose I/O is
+// done; those that are over join the run queue, with what they waited for
+// as their native's result
+void GlangVm::resumeWaits(bool block) {
+    if (loop_ != nullptr) {
+        // the loop's wait ends with a post as well
+        loop_->poll(block && !inbox_->pending(), woken_);
+        if (loop_->waits()) block = false;
+    }
+    inbox_->take(block && woken_.empty(), woken_);
+
+    for (ObjFiber* fiber : woken_) {
+        // a post may come after the wait it was for is over
+        Wait* wait = fiber->wait;
+        Value result;
+        if (wait == nullptr || !wait->resume(result)) continue;
+
+        bool retries = wait->retries();
+        delete wait;
+        fiber->wait = nullptr;
+        unpark(fiber);
+        if (!retries) {
+            // parked right after its native returned, so its result is on
+            // top; the running fiber's registers are not saved yet
+            Value* top = fiber == fiber_ ? stackTop_ : fiber->stackTop;
+            top[-1] = result;
+        }
+        enqueue(fiber);
+    }
+    woken_.clear();
+}
+
+// takes 'fiber' off the parked ones, moving the last into its place
+void GlangVm::unpark(ObjFiber* fiber) {
+    ObjFiber* last = parked_.back();
+    parked_[fiber->parkedAt] = last;
+    last->parkedAt = fiber->parkedAt;
+    parked_.pop_back();
+}
+
+// sleeps until a fiber is ready; false if none ever will be, because every
+// parked one is stuck
+bool GlangVm::awaitReady() {
+    while (readyHead_ == nullptr && !parked_.empty()) {
+        bool stuck = std::all_of(parked_.begin(), parked_.end(), [](ObjFiber* fiber) { return fiber->wait->stuck(); });
+        // what was posted before the channels went stuck still counts
+        resumeWaits(!stuck);
+        if (stuck) break;
+    }
+    return readyHead_ != nullptr;
+}
+
+// the waits of fibers that will never run again, which takes them off
+// whatever they wait on
+void GlangVm::dropWaits() {
+    for (ObjFiber* fiber : parked_) {
+        delete fiber->wait;
+        fiber->wait = nullptr;
+    }
+    parked_.clear();
+    if (loop_ != nullptr) loop_->poll(false, woken_);
+    inbox_->take(false, woken_);
+    woken_.clear();
+}
+
+EventLoop& GlangVm::eventLoop() {
+    if (loop_ == nullptr) loop_ = std::make_unique<EventLoop>(inbox_);
+    return *loop_;
+}
+
+void Inbox::post(ObjFiber* fiber) {
+    {
+        std::lock_guard lock{mutex_};
+        fibers_.push_back(fiber);
+        pending_.store(true, std::memory_order_release);
+        if (wakeFd_ >= 0) {
+            u64 one = 1;
+            [[maybe_unused]] auto written = ::write(wakeFd_, &one, sizeof(one));
+        }
+    }
+    posted_.notify_one();
+}
+
+void Inbox::take(bool block, std::vector<ObjFiber*>& fibers) {
+    if (!block && !pending_.load(std::memory_order_acquire)) return;
+
+    std::unique_lock lock{mutex_};
+    if (block) posted_.wait(lock, [&] { return !fibers_.empty(); });
+    fibers.insert(fibers.end(), fibers_.begin(), fibers_.end());
+    fibers_.clear();
+    pending_.store(false, std::memory_order_relaxed);
+}
+
+void Inbox::setWakeFd(int fd) {
+    std::lock_guard lock{mutex_};
+    wakeFd_ = fd;
+}
+
+// ForIn over anything but arrays and ranges, which run() handles itself
+GlangVm::Iteration GlangVm::iterate(Value* loop) {
+    Value iterable = loop[0];
+
+    if (object::isMap(iterable)) {
+        // the keys, in insertion order
+        ObjMap* map = object::asMap(iterable);
+        int position = loop[1].isNil() ? 0 : static_cast<int>(loop[1].asNumber());
+        while (position < map->entryCount && map->entries[position].deleted) ++position;
+        if (position >= map->entryCount) return Iteration::Done;
+
+        loop[2] = map->entries[position].key;
+        loop[1] = Value::createNumber(position + 1);
+        return Iteration::Next;
+    }
+
+    if (object::isLines(iterable)) {
+        ObjString* line;
+        switch (io::nextLine(*this, object::asLines(iterable), line)) {
+        case io::Line::Next:
+            loop[2] = Value::createObj(line);
+            return Iteration::Next;
+        case io::Line::Done:
+            return Iteration::Done;
+        case io::Line::Parked:
+            // this ForIn runs again once more is read
+            iPtr_ -= instructionLength(OpCode::ForIn);
+            return reschedule() ? Iteration::Resumed : Iteration::Failed;
+        }
+    }
+
+    if (object::isFiber(iterable)) {
+        ObjFiber* generator = object::asFiber(iterable);
+        if (generator->pending) {
+            loop[2] = generator->result;
+            generator->pending = false;
+            return Iteration::Next;
+        }
+        if (generator->state == FiberState::Done) return Iteration::Done;
+        if (generator->state != FiberState::Suspended) {
+            runtimeError("Can't iterate a fiber that is running or scheduled.");
+            return Iteration::Failed;
+        }
+
+        // the generator runs until it yields or returns, then this ForIn
+        // runs again and finds out which
+        iPtr_ -= instructionLength(OpCode::ForIn);
+        generator->resumer = fiber_;
+        fiber_->state = FiberState::Waiting;
+        switchTo(generator);
+        return Iteration::Resumed;
+    }
+
+    runtimeError("Can only iterate over arrays, maps, ranges, lines and generators.");
+    return Iteration::Failed;
+}
+
+// a context switch: the running fiber's registers are saved into it and
+// 'fiber''s loaded, nothing else is touched
+void GlangVm::switchTo(ObjFiber* fiber) {
+    frame_->ip = iPtr_;
+    fiber_->frameCount = frameCount_;
+    fiber_->stackTop = stackTop_;
+
+    fiber_ = fiber;
+    fiber->state = FiberState::Running;
+
+    // the sampler's signal handler walks frames_[0, frameCount_) at any point
+    frameCount_ = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    frames_ = fiber->frames;
+    frame_ = &frames_[fiber->frameCount - 1];
+    iPtr_ = frame_->ip;
+    stack_ = fiber->stack;
+    stackTop_ = fiber->stackTop;
+    stackEnd_ = stack_ + fiber->stackCapacity;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    frameCount_ = fiber->frameCount;
+}
+
+// moves the running fiber's stack to a bigger one, with room for 'needed'
+// values from 'slots' on, and rebases every pointer into it. The root's
+// stack already is as big as stacks get.
+bool GlangVm::growStack(Value*& slots, int needed) {
+    auto used = static_cast<int>(slots - stack_);
+    if (used + needed > STACK_MAX) return false;
+
+    int capacity = fiber_->stackCapacity;
+    while (capacity < used + needed) capacity *= 2;
+    capacity = std::min(capacity, STACK_MAX);
+
+    Value* stack = memory::allocate<Value>(capacity);
+    std::copy(stack_, stackTop_, stack);
+    for (int i = 0; i < frameCount_; ++i) frames_[i].slots = stack + (frames_[i].slots - stack_);
+    stackTop_ = stack + (stackTop_ - stack_);
+    slots = stack + used;
+
+    memory::free(stack_, sizeof(Value) * fiber_->stackCapacity);
+    fiber_->stack = stack_ = stack;
+    fiber_->stackCapacity = capacity;
+    stackEnd_ = stack + capacity;
+    return true;
+}
+
+bool GlangVm::growFrames() {
+    int capacity = fiber_->frameCapacity;
+    if (capacity == FRAMES_MAX) return false;
+
+    int grown = std::min(capacity * 2, FRAMES_MAX);
+    CallFrame* frames = memory::allocate<CallFrame>(grown);
+    std::copy(frames_, frames_ + frameCount_, frames);
+    frame_ = frames + (frame_ - frames_);
+
+    CallFrame* old = frames_;
+    frames_ = fiber_->frames = frames;
+    fiber_->frameCapacity = grown;
+    memory::free(old, sizeof(CallFrame) * capacity);
+    return true;
+}
 
 void GlangVm::concatenate() {
     ObjString* b = object::asString(popFromStack());
@@ -3,52 +3,263 @@
 #include "common.hh"
 #include "ByteCode.hh"
 #include "HashTable.hh"
+#include "object.hh"
+#include "OutputBuffer.hh"
+#include "InlineCache.hh"
+#include "Program.hh"
+#include "debug.hh"
 
-#define STACK_MAX 256
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
-Result interpret(const std::string& code);
+#define FRAMES_MAX 64
+#define STACK_MAX (FRAMES_MAX * (UINT8_MAX + 1))
+
+class Profiler;
+class Sampler;
+class Tracer;
+class Statistics;
+
+struct RunOptions {
+    Profiler* profiler{}; // when set, every instruction is counted into it
+    Sampler* sampler{};   // when set, samples the call stack while the script runs
+    Tracer* tracer{};     // when set, every instruction is logged to it
+    const debug::Filter* disassemble{}; // when set, the compiled code is listed on stderr
+    Statistics* stats{};  // when set, phases are timed and instructions counted into it
+};
+
+// What one VM keeps for one chunk of a program it runs: the constants,
+// with strings interned in the VM's heap, the global slots its
+// Get/SetGlobal sites resolved to and its inline caches.
+struct CodeState {
+    std::vector<Value> constants;
+    std::vector<Value*> globals; // by constant index; nullptr until resolved
+    std::vector<PropertyCache> caches;
+};
+
+struct LinkedProgram {
+    ProgramRef program; // kept alive while its functions may still be called
+    std::vector<CodeState> chunks; // by ByteCode::index()
+};
+
+struct CallFrame {
+    ObjFunction* function; // nullptr for the top-level script
+    const ByteCode* code;
+    CodeState* state;
+    const u8* ip; // only up to date for frames below the running one
+    Value* slots;
+};
+
+class Isolate;
+class EventLoop;
+
+// What a fiber parked by GlangVm::park() waits for, such as a message.
+class Wait {
+public:
+    virtual ~Wait() = default;
+
+    // called on the VM's thread whenever the fiber is posted to the VM's
+    // inbox: true, with 'result' set, once the wait is over
+    virtual bool resume(Value& result) = 0;
+    // true if nothing any thread does can end the wait
+    [[nodiscard]] virtual bool stuck() const = 0;
+    // true if the fiber runs the instruction that parked it again, rather
+    // than taking 'result' as its native's
+    [[nodiscard]] virtual bool retries() const { return false; }
+};
+
+// Where other threads post a VM's parked fibers once what they wait for
+// may have happened.
+class Inbox {
+public:
+    // thread-safe
+    void post(ObjFiber* fiber);
+    // appends the fibers posted since the last call; if 'block', waits
+    // for one
+    void take(bool block, std::vector<ObjFiber*>& fibers);
+    [[nodiscard]] bool pending() const { return pending_.load(std::memory_order_acquire); }
+    // posts also write to the eventfd 'fd', so an event loop can wait for
+    // them with everything else; -1 for none
+    void setWakeFd(int fd);
+
+private:
+    std::atomic<bool> pending_{}; // so looking into an empty inbox is free
+    std::mutex mutex_;
+    std::condition_variable posted_;
+    std::vector<ObjFiber*> fibers_;
+    int wakeFd_{-1};
+};
 
 class GlangVm {
+    friend Sampler;
+    friend Isolate;
+
 public:
-    explicit GlangVm(const ByteCode& code);
-    GlangVm() = default;
-    ~GlangVm() = default;
+    GlangVm();
+    ~GlangVm();
+
+    // the first run of a program links it into side tables, later runs
+    // reuse them and neither copy nor allocate anything
+    Result interpret(const ProgramRef& program);
+
+    // runs 'function' with 'args' as interpret() runs a script, on the
+    // VM's own stacks, and stores what it returns in 'result'
+    Result callFunction(ObjFunction* function, int argCount, const Value* args, Value& result);
 
-    void init(const ByteCode& code);
+    // makes 'function' callable from scripts as the global 'name'; it can
+    // find 'data' in the ObjNative it is called through, at args[-1]
+    void defineNative(std::string_view name, NativeFn function, int arity, void* data = nullptr);
 
-    Result interpret();
-    Result interpret(const ByteCode& code);
+    // a fiber that will call 'callee' with 'args' once the running fiber
+    // gives way; nullptr, with an error reported, if it cannot be called
+    ObjFiber* spawn(Value callee, int argCount, const Value* args);
+    // for a native: stores what 'fiber' returned in 'result' if it is done,
+    // and otherwise blocks the running fiber until it is, from the native's
+    // return on. False, with an error reported, if that would never happen.
+    bool join(ObjFiber* fiber, Value* result);
+    // for a native: blocks the running fiber, from the native's return on,
+    // until 'wait' is over, and makes what it resumes with the native's
+    // result. The other fibers run meanwhile; once none can, the thread
+    // sleeps until the inbox gets a post.
+    void park(std::unique_ptr<Wait> wait);
+    [[nodiscard]] ObjFiber* runningFiber() const { return fiber_; }
+    [[nodiscard]] const std::shared_ptr<Inbox>& inbox() const { return inbox_; }
+    // made on first use, so VMs that do no I/O have none
+    EventLoop& eventLoop();
+
+    OutputBuffer& output() { return output_; }
+    void setProfiler(Profiler* profiler) { profiler_ = profiler; }
+    void setSampler(Sampler* sampler) { sampler_ = sampler; }
+    void setTracer(Tracer* tracer) { tracer_ = tracer; }
+    void setCounting(bool counting) { counting_ = counting; }
+    // scripts that assign a global fail, as in the workers of a parallel loop
+    void setGlobalsReadOnly(bool readOnly) { globalsReadOnly_ = readOnly; }
+    // for a worker of a parallel loop: the script's global 'name' holds
+    // 'what', which the worker can't have; an error says so if it is used
+    void markUnshared(std::string_view name, std::string what);
+    void clearUnshared() { unshared_.clear(); }
+    [[nodiscard]] u64 instructionsExecuted() const { return executed_; }
+
+    // errors go to the same place as the script's output
+    template <typename... T>
+    void runtimeError(std::string_view msg, T&&... args) {
+        output_.write(fmt::format(msg, std::forward<T>(args)...));
+        output_.newline();
+        printStackTrace();
+        output_.flush();
+    }
 
 private:
+    // run() is instantiated once per combination of hooks, so a run
+    // without any pays nothing for them
+    enum RunMode : unsigned {
+        Normal = 0,
+        Profiled = 1 << 0,
+        Traced = 1 << 1,
+        Counted = 1 << 2
+    };
+
+    enum class Iteration {
+        Next,    // the loop variable holds the next value
+        Done,
+        Resumed, // a generator runs for the next value
+        Failed
+    };
+
+    void startRoot(ObjFunction* function, const ByteCode& code, CodeState* state);
+    Result execute();
+    template <unsigned Mode>
     Result run();
     u8 readByte();
     u16 readShort();
 
     OpCode readInstr();
     Value readConstant();
+    PropertyCache& readCache();
+    Value* readGlobal();
+
+    void undefinedGlobal(std::string_view message);
+
+    LinkedProgram& link(const Program& program);
+    CodeState* stateFor(const ByteCode& code);
 
     void pushToStack(Value value);
     Value popFromStack();
     Value peekStack(int distance);
-    void printStack();
 
     void concatenate();
 
-    template <typename... T>
-    void runtimeError(std::string_view msg, T&&... args) {
-        size_t instruction = iPtr_ - code_.code_.data() - 1;
-        auto line = code_.lineNumbers_[instruction];
-        fmt::print(msg, std::forward<T>(args)...);
-        fmt::print("\n");
-        fmt::print("[line {}] in script\n", line);
-    }
+    bool callValue(Value callee, int argCount);
+    bool call(ObjFunction* function, int argCount);
+    bool tailCall(ObjFunction* function, int argCount);
+    bool callNative(ObjNative* native, int argCount);
+
+    Iteration iterate(Value* loop);
+
+    ObjFiber* makeFiber(ObjFunction* function, Value receiver, const Value* args, int argCount, const u8* ip);
+    bool growStack(Value*& slots, int needed);
+    bool growFrames();
+    void enqueue(ObjFiber* fiber);
+    ObjFiber* dequeue();
+    bool reschedule();
+    bool finishFiber(Value result);
+    void resumeWaits(bool block);
+    void unpark(ObjFiber* fiber);
+    bool awaitReady();
+    void dropWaits();
+    void switchTo(ObjFiber* fiber);
+    bool lookupProperty(ObjInstance* instance, ObjString* name, CacheEntry& entry);
+
+    void printStackTrace();
 
 private:
-    ByteCode code_;
-    u8* iPtr_{};
+    // fibers switch at Loop, calls and Yield once this many have gone by
+    static constexpr int SliceLength = 1024;
+
+    const u8* iPtr_{};
 
-    Value stack_[STACK_MAX]{};
+    // the running fiber's frames and stack
+    CallFrame* frames_{};
+    CallFrame* frame_{};
+    int frameCount_{};
+
+    Value* stack_{};
     Value* stackTop_{}; // points to where the next element is to be pushed
+    Value* stackEnd_{};
+
+    // the script itself runs on a fiber whose stacks are part of the VM
+    // and never grow
+    CallFrame rootFrames_[FRAMES_MAX]{};
+    Value rootStack_[STACK_MAX]{};
+    ObjFiber root_{};
+
+    ObjFiber* fiber_{}; // running
+    ObjFiber* readyHead_{};
+    ObjFiber* readyTail_{};
+    int budget_{SliceLength}; // switch points left in the running fiber's slice
+    std::vector<ObjFiber*> parked_; // in no order: see unpark()
+    std::shared_ptr<Inbox> inbox_{std::make_shared<Inbox>()};
+    std::unique_ptr<EventLoop> loop_;
+    std::vector<ObjFiber*> woken_; // reused by resumeWaits()
 
     HashTable globals_;
+    bool globalsReadOnly_{};
+    std::unordered_map<ObjString*, std::string> unshared_; // see markUnshared()
+    ObjString* initString_{};
+
+    // programs with functions stay, as the functions may be stored anywhere
+    std::unordered_map<const Program*, LinkedProgram> linked_;
+    LinkedProgram* running_{}; // the program of the code last called into
+
+    OutputBuffer output_;
+    Profiler* profiler_{};
+    Sampler* sampler_{};
+    Tracer* tracer_{};
+    bool counting_{};
+    u64 executed_{};
 };
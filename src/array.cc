@@ -0,0 +1,80 @@
+#include "array.hh"
+#include "memory.hh"
+
+namespace array {
+
+static int growCapacity(int capacity) {
+    return capacity < 8 ? 8 : capacity * 2;
+}
+
+void box(ObjArray* array) {
+    if (!array->packed) return;
+
+    double* numbers = array->numbers;
+    Value* values = memory::allocate<Value>(array->capacity);
+    for (int i = 0; i < array->count; ++i) {
+        values[i] = Value::createNumber(numbers[i]);
+    }
+    memory::free(numbers, sizeof(double) * array->capacity);
+
+    array->values = values;
+    array->packed = false;
+}
+
+bool pack(ObjArray* array) {
+    if (array->packed) return true;
+
+    Value* values = array->values;
+    for (int i = 0; i < array->count; ++i) {
+        if (!values[i].isNumber()) return false;
+    }
+
+    double* numbers = memory::allocate<double>(array->capacity);
+    for (int i = 0; i < array->count; ++i) {
+        numbers[i] = values[i].asNumber();
+    }
+    memory::free(values, sizeof(Value) * array->capacity);
+
+    array->numbers = numbers;
+    array->packed = true;
+    return true;
+}
+
+void reserve(ObjArray* array, int capacity) {
+    if (capacity <= array->capacity) return;
+
+    if (array->packed) {
+        array->numbers = static_cast<double*>(memory::reallocate(array->numbers, sizeof(double) * array->capacity, sizeof(double) * capacity));
+    } else {
+        array->values = static_cast<Value*>(memory::reallocate(array->values, sizeof(Value) * array->capacity, sizeof(Value) * capacity));
+    }
+    array->capacity = capacity;
+}
+
+void push(ObjArray* array, Value value) {
+    if (array->count == array->capacity) {
+        reserve(array, growCapacity(array->capacity));
+    }
+    if (array->packed && !value.isNumber()) {
+        box(array);
+    }
+
+    if (array->packed) {
+        array->numbers[array->count++] = value.asNumber();
+    } else {
+        array->values[array->count++] = value;
+    }
+}
+}
+
+namespace object {
+std::string arrayToString(ObjArray* array) {
+    std::string result = "[";
+    for (int i = 0; i < array->count; ++i) {
+        if (i > 0) result += ", ";
+        result += array::get(array, i).toString();
+    }
+    result += "]";
+    return result;
+}
+}
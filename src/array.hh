@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common.hh"
+#include "object.hh"
+
+namespace array {
+// moves a packed array to boxed storage
+void box(ObjArray* array);
+// moves a boxed array back to packed storage if it holds only numbers;
+// returns whether the array is packed afterwards
+bool pack(ObjArray* array);
+void reserve(ObjArray* array, int capacity);
+void push(ObjArray* array, Value value);
+
+inline Value get(ObjArray* array, int index) {
+    return array->packed ? Value::createNumber(array->numbers[index]) : array->values[index];
+}
+
+inline void set(ObjArray* array, int index, Value value) {
+    if (array->packed) {
+        if (value.isNumber()) {
+            array->numbers[index] = value.asNumber();
+            return;
+        }
+        box(array);
+    }
+    array->values[index] = value;
+}
+
+// false for an array a parallel loop's workers read: a write would be lost
+// with a worker's copy, or race with the others on a lent array
+inline bool writable(ObjArray* array) {
+    return !array->readOnly && !array->lent;
+}
+
+// converts 'index' to a slot of 'array', or returns -1 if it is not an
+// integer in [0, count). The bounds are checked on the double, so NaN and
+// numbers too large for an integer never reach the cast.
+inline int checkedIndex(ObjArray* array, Value index) {
+    if (!index.isNumber()) return -1;
+    double number = index.asNumber();
+    if (!(number >= 0 && number < array->count)) return -1;
+    auto slot = static_cast<int>(number);
+    return static_cast<double>(slot) == number ? slot : -1;
+}
+}
@@ -0,0 +1,260 @@
+#include "natives.hh"
+#include "Vm.hh"
+#include "object.hh"
+#include "array.hh"
+#include "simd.hh"
+
+#include <algorithm>
+#include <vector>
+
+// Bulk numeric builtins. They work on packed arrays only, so a loop over a
+// whole array runs as one SIMD kernel instead of an instruction per element.
+namespace natives {
+
+static ObjArray* numericArray(GlangVm& vm, Value value, const char* name) {
+    if (!object::isArray(value) || !array::pack(object::asArray(value))) {
+        vm.runtimeError("{}() expects an array of numbers.", name);
+        return nullptr;
+    }
+    return object::asArray(value);
+}
+
+static ObjArray* newPackedArray(int count) {
+    ObjArray* array = ObjFactory::newArray(count);
+    array->count = count;
+    return array;
+}
+
+static bool sumNative(GlangVm& vm, int, Value* args) {
+    ObjArray* array = numericArray(vm, args[0], "sum");
+    if (array == nullptr) return false;
+
+    args[-1] = Value::createNumber(simd::sum(array->numbers, array->count));
+    return true;
+}
+
+template <double (*Kernel)(const double*, size)>
+static bool extremumNative(GlangVm& vm, Value* args, const char* name) {
+    ObjArray* array = numericArray(vm, args[0], name);
+    if (array == nullptr) return false;
+    if (array->count == 0) {
+        vm.runtimeError("{}() of an empty array.", name);
+        return false;
+    }
+
+    args[-1] = Value::createNumber(Kernel(array->numbers, array->count));
+    return true;
+}
+
+static bool minNative(GlangVm& vm, int, Value* args) {
+    return extremumNative<simd::min>(vm, args, "min");
+}
+
+static bool maxNative(GlangVm& vm, int, Value* args) {
+    return extremumNative<simd::max>(vm, args, "max");
+}
+
+static bool dotNative(GlangVm& vm, int, Value* args) {
+    ObjArray* a = numericArray(vm, args[0], "dot");
+    if (a == nullptr) return false;
+    ObjArray* b = numericArray(vm, args[1], "dot");
+    if (b == nullptr) return false;
+    if (a->count != b->count) {
+        vm.runtimeError("dot() of arrays with lengths {} and {}.", a->count, b->count);
+        return false;
+    }
+
+    args[-1] = Value::createNumber(simd::dot(a->numbers, b->numbers, a->count));
+    return true;
+}
+
+using ArrayKernel = void (*)(const double*, const double*, double*, size);
+using ScalarKernel = void (*)(const double*, double, double*, size);
+
+// elementwise 'array op array', or 'array op number' broadcast from either side
+template <ArrayKernel Kernel, ScalarKernel Broadcast>
+static bool elementwiseNative(GlangVm& vm, Value* args, const char* name) {
+    Value lhs = args[0];
+    Value rhs = args[1];
+    if (lhs.isNumber()) std::swap(lhs, rhs);
+
+    ObjArray* a = numericArray(vm, lhs, name);
+    if (a == nullptr) return false;
+
+    if (rhs.isNumber()) {
+        ObjArray* result = newPackedArray(a->count);
+        Broadcast(a->numbers, rhs.asNumber(), result->numbers, a->count);
+        args[-1] = Value::createObj(result);
+        return true;
+    }
+
+    ObjArray* b = numericArray(vm, rhs, name);
+    if (b == nullptr) return false;
+    if (a->count != b->count) {
+        vm.runtimeError("{}() of arrays with lengths {} and {}.", name, a->count, b->count);
+        return false;
+    }
+
+    ObjArray* result = newPackedArray(a->count);
+    Kernel(a->numbers, b->numbers, result->numbers, a->count);
+    args[-1] = Value::createObj(result);
+    return true;
+}
+
+static bool addNative(GlangVm& vm, int, Value* args) {
+    return elementwiseNative<simd::add, simd::addScalar>(vm, args, "add");
+}
+
+static bool mulNative(GlangVm& vm, int, Value* args) {
+    return elementwiseNative<simd::mul, simd::mulScalar>(vm, args, "mul");
+}
+
+static bool fillNative(GlangVm& vm, int, Value* args) {
+    if (!object::isArray(args[0])) {
+        vm.runtimeError("fill() expects an array.");
+        return false;
+    }
+
+    ObjArray* array = object::asArray(args[0]);
+    if (!array::writable(array)) {
+        vm.runtimeError("fill() can't modify a global array in a parallel loop.");
+        return false;
+    }
+    if (args[1].isNumber() && array::pack(array)) {
+        simd::fill(array->numbers, args[1].asNumber(), array->count);
+    } else {
+        array::box(array);
+        std::fill(array->values, array->values + array->count, args[1]);
+    }
+
+    args[-1] = args[0];
+    return true;
+}
+
+// map() accepts a "numeric lambda": a one-parameter function whose body is
+// a single 'return' of arithmetic over the parameter and number literals.
+// Such a body is replayed over blocks of elements, one kernel per opcode.
+struct LambdaOp {
+    OpCode op;
+    double constant;
+};
+
+static bool compileLambda(ObjFunction* function, std::vector<LambdaOp>& ops, int& maxDepth) {
+    if (function->arity != 1) return false;
+
+    const ByteCode& code = function->byteCode;
+    int depth = 0;
+    maxDepth = 0;
+    for (int offset = 0; offset < static_cast<int>(code.codeSize());) {
+        OpCode op = code.getOpCode(offset);
+        switch (op) {
+        case OpCode::Constant: {
+            Value constant = code.getConstantAtOffset(toU8(code.getOpCode(offset + 1)));
+            if (!constant.isNumber()) return false;
+            ops.push_back({op, constant.asNumber()});
+            ++depth;
+            offset += 2;
+            break;
+        }
+        case OpCode::GetLocal:
+            if (toU8(code.getOpCode(offset + 1)) != 1) return false;
+            ops.push_back({op, 0});
+            ++depth;
+            offset += 2;
+            break;
+        case OpCode::Negate:
+            if (depth < 1) return false;
+            ops.push_back({op, 0});
+            offset += 1;
+            break;
+        case OpCode::Add:
+        case OpCode::Subtract:
+        case OpCode::Multiply:
+        case OpCode::Divide:
+            if (depth < 2) return false;
+            ops.push_back({op, 0});
+            --depth;
+            offset += 1;
+            break;
+        case OpCode::Return:
+            return depth == 1;
+        default:
+            return false;
+        }
+        maxDepth = std::max(maxDepth, depth);
+    }
+
+    return false;
+}
+
+static void runLambda(const std::vector<LambdaOp>& ops, int maxDepth, const double* in, double* out, size count) {
+    constexpr size Block = 512;
+    std::vector<double> stack(static_cast<size>(maxDepth) * Block);
+    auto slot = [&](int index) { return stack.data() + static_cast<size>(index) * Block; };
+
+    for (size base = 0; base < count; base += Block) {
+        size n = std::min(Block, count - base);
+        int top = 0;
+        for (const LambdaOp& op : ops) {
+            switch (op.op) {
+            case OpCode::Constant:
+                simd::fill(slot(top++), op.constant, n);
+                break;
+            case OpCode::GetLocal:
+                std::copy(in + base, in + base + n, slot(top++));
+                break;
+            case OpCode::Negate:
+                simd::negate(slot(top - 1), slot(top - 1), n);
+                break;
+            case OpCode::Add:
+                simd::add(slot(top - 2), slot(top - 1), slot(top - 2), n);
+                --top;
+                break;
+            case OpCode::Subtract:
+                simd::sub(slot(top - 2), slot(top - 1), slot(top - 2), n);
+                --top;
+                break;
+            case OpCode::Multiply:
+                simd::mul(slot(top - 2), slot(top - 1), slot(top - 2), n);
+                --top;
+                break;
+            case OpCode::Divide:
+                simd::div(slot(top - 2), slot(top - 1), slot(top - 2), n);
+                --top;
+                break;
+            default:
+                break;
+            }
+        }
+        std::copy(slot(0), slot(0) + n, out + base);
+    }
+}
+
+static bool mapNative(GlangVm& vm, int, Value* args) {
+    ObjArray* array = numericArray(vm, args[0], "map");
+    if (array == nullptr) return false;
+
+    std::vector<LambdaOp> ops;
+    int maxDepth = 0;
+    if (!object::isFunction(args[1]) || !compileLambda(object::asFunction(args[1]), ops, maxDepth)) {
+        vm.runtimeError("map() expects a one-parameter function returning arithmetic on its parameter.");
+        return false;
+    }
+
+    ObjArray* result = newPackedArray(array->count);
+    runLambda(ops, maxDepth, array->numbers, result->numbers, array->count);
+    args[-1] = Value::createObj(result);
+    return true;
+}
+
+void defineArrayOps(GlangVm& vm) {
+    vm.defineNative("sum", sumNative, 1);
+    vm.defineNative("min", minNative, 1);
+    vm.defineNative("max", maxNative, 1);
+    vm.defineNative("dot", dotNative, 2);
+    vm.defineNative("add", addNative, 2);
+    vm.defineNative("mul", mulNative, 2);
+    vm.defineNative("fill", fillNative, 2);
+    vm.defineNative("map", mapNative, 2);
+}
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "common.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bench {
+
+// keeps the optimiser from discarding a value a benchmark computed
+template <typename T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Stats {
+    std::string name;
+    u64 opsPerIteration;
+    int samples;
+    double medianNs; // per operation
+    double p99Ns;    // per operation
+    double opsPerSecond;
+};
+
+// Runs each benchmark body until its timings settle, then times a fixed
+// number of samples. Bodies that finish too quickly to time are batched so
+// every sample lasts at least 'MinSampleTime'.
+class Runner {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr auto MinSampleTime = std::chrono::microseconds(200);
+    static constexpr auto MinWarmup = std::chrono::milliseconds(100);
+    static constexpr auto MaxWarmup = std::chrono::seconds(2);
+    static constexpr int Samples = 51;
+
+    explicit Runner(std::string filter)
+        : filter_{std::move(filter)} {}
+
+    // whether the filter lets the benchmark called 'name' run
+    [[nodiscard]] bool selected(std::string_view name) const {
+        return filter_.empty() || name.find(filter_) != std::string_view::npos;
+    }
+
+    // 'body' performs 'ops' operations every time it is called
+    template <typename F>
+    void run(std::string_view name, u64 ops, F&& body) {
+        if (!selected(name)) return;
+
+        int batch = calibrate(body);
+        warmUp(body, batch);
+
+        std::vector<double> samples;
+        samples.reserve(Samples);
+        for (int i = 0; i < Samples; ++i) {
+            samples.push_back(time(body, batch) / static_cast<double>(ops * batch));
+        }
+        std::sort(samples.begin(), samples.end());
+
+        Stats stats;
+        stats.name = std::string{name};
+        stats.opsPerIteration = ops;
+        stats.samples = Samples;
+        stats.medianNs = samples[samples.size() / 2];
+        stats.p99Ns = samples[static_cast<size>(std::ceil(0.99 * samples.size())) - 1];
+        stats.opsPerSecond = 1e9 / stats.medianNs;
+
+        fmt::print("{:<36} {:>12.2f} ns {:>12.2f} ns {:>16.0f}\n", stats.name, stats.medianNs, stats.p99Ns, stats.opsPerSecond);
+        std::fflush(stdout);
+        results_.push_back(std::move(stats));
+    }
+
+    [[nodiscard]] const std::vector<Stats>& results() const { return results_; }
+
+    void printHeader() const {
+        fmt::print("{:<36} {:>15} {:>15} {:>16}\n", "benchmark", "median/op", "p99/op", "ops/s");
+    }
+
+    bool writeJson(const char* path) const {
+        std::FILE* file = std::fopen(path, "w");
+        if (file == nullptr) return false;
+
+        fmt::print(file, "{{\n  \"benchmarks\": [");
+        for (size i = 0; i < results_.size(); ++i) {
+            const Stats& stats = results_[i];
+            fmt::print(file, "{}\n    {{\"name\": \"{}\", \"ops_per_iteration\": {}, \"samples\": {}, "
+                             "\"median_ns\": {:.3f}, \"p99_ns\": {:.3f}, \"ops_per_second\": {:.1f}}}",
+                       i == 0 ? "" : ",", stats.name, stats.opsPerIteration, stats.samples,
+                       stats.medianNs, stats.p99Ns, stats.opsPerSecond);
+        }
+        fmt::print(file, "\n  ]\n}}\n");
+        return std::fclose(file) == 0;
+    }
+
+private:
+    template <typename F>
+    static double time(F& body, int batch) {
+        auto start = Clock::now();
+        for (int i = 0; i < batch; ++i) body();
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    }
+
+    template <typename F>
+    static int calibrate(F& body) {
+        double once = std::max(1.0, time(body, 1));
+        double wanted = std::chrono::duration<double, std::nano>(MinSampleTime).count();
+        return std::max(1, static_cast<int>(std::ceil(wanted / once)));
+    }
+
+    // caches, branch predictors and the string table fill up during the
+    // first runs; stop once two consecutive windows agree within 5%
+    template <typename F>
+    static void warmUp(F& body, int batch) {
+        constexpr int Window = 5;
+        auto start = Clock::now();
+        double previous = 0;
+
+        while (Clock::now() - start < MaxWarmup) {
+            std::vector<double> window;
+            for (int i = 0; i < Window; ++i) window.push_back(time(body, batch));
+            std::sort(window.begin(), window.end());
+            double median = window[Window / 2];
+
+            bool settled = previous > 0 && std::abs(median - previous) <= 0.05 * previous;
+            if (settled && Clock::now() - start >= MinWarmup) return;
+            previous = median;
+        }
+    }
+
+private:
+    std::string filter_;
+    std::vector<Stats> results_;
+};
+
+}
@@ -0,0 +1,665 @@
+#include "bench/Bench.hh"
+
+#include "ByteCode.hh"
+#include "Channel.hh"
+#include "HashTable.hh"
+#include "Isolate.hh"
+#include "Parallel.hh"
+#include "Program.hh"
+#include "Scanner.hh"
+#include "Session.hh"
+#include "Vm.hh"
+#include "compiler.hh"
+#include "glang.h"
+#include "memory.hh"
+#include "object.hh"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include <unistd.h>
+
+// compiled as one chunk, so 'count' must stay small enough for the
+// 256-entry constant pool; the scanner takes any size
+static std::string generateStatements(int count) {
+    std::string source;
+    for (int i = 0; i < count; ++i) {
+        source += fmt::format("def value{0} = 12.5 + scale(total{0}, \"label {0}\") * [1, 2, 3][0];\n"
+                              "if (value{0} < 10 and !done) {{ print value{0}; }} else {{ value{0} = value{0} - 1; }}\n",
+                              i);
+    }
+    return source;
+}
+
+static std::string generateFunctions(int count) {
+    std::string source;
+    for (int i = 0; i < count; ++i) {
+        source += fmt::format("fun step{0}(a, b) {{\n"
+                              "    def c = a + b * {0};\n"
+                              "    for (def i = 0; i < b; i = i + 1) {{ c = c - i; }}\n"
+                              "    if (c > 100) return c;\n"
+                              "    return step{0}(c, b - 1);\n"
+                              "}}\n",
+                              i);
+    }
+    return source;
+}
+
+static void scannerBenchmarks(bench::Runner& runner) {
+    std::string source = generateStatements(500);
+
+    Scanner scanner{source};
+    u64 tokens = 0;
+    while (scanner.scanToken().type != TokenEof) ++tokens;
+
+    runner.run("scanner/scanToken", tokens, [&] {
+        scanner.init(source);
+        Token token;
+        do {
+            token = scanner.scanToken();
+        } while (token.type != TokenEof);
+        bench::doNotOptimize(token);
+    });
+}
+
+static void compilerBenchmarks(bench::Runner& runner) {
+    std::string statements = generateStatements(15);
+    std::string functions = generateFunctions(50);
+    OutputBuffer errors;
+
+    // ops are source bytes, so ops/s reads as bytes compiled per second
+    runner.run("compile/statements (bytes)", statements.size(), [&] {
+        ByteCode code;
+        bench::doNotOptimize(compile(statements, code, errors));
+    });
+    runner.run("compile/functions (bytes)", functions.size(), [&] {
+        ByteCode code;
+        bench::doNotOptimize(compile(functions, code, errors));
+    });
+}
+
+// the keys are known to be distinct, so they skip the intern lookup that
+// would make building 64K of them quadratic
+static std::vector<ObjString*> makeKeys(int count) {
+    std::vector<ObjString*> keys;
+    for (int i = 0; i < count; ++i) {
+        std::string name = fmt::format("key{}", i);
+        char* chars = memory::allocate<char>(name.size() + 1);
+        std::memcpy(chars, name.c_str(), name.size() + 1);
+
+        u32 hash = 2166136261u;
+        for (char c : name) hash = (hash ^ static_cast<u8>(c)) * 16777619u;
+        keys.push_back(ObjFactory::allocateString(chars, static_cast<int>(name.size()), hash));
+    }
+    return keys;
+}
+
+static void hashTableBenchmarks(bench::Runner& runner) {
+    for (int count : {16, 1024, 65536}) {
+        auto keys = makeKeys(count);
+
+        runner.run(fmt::format("HashTable/set {}", count), count, [&] {
+            HashTable table;
+            for (ObjString* key : keys) table.set(key, Value::createNumber(1));
+            bench::doNotOptimize(table);
+        });
+
+        HashTable table;
+        for (ObjString* key : keys) table.set(key, Value::createNumber(1));
+        runner.run(fmt::format("HashTable/get {}", count), count, [&] {
+            for (ObjString* key : keys) bench::doNotOptimize(table.get(key));
+        });
+    }
+}
+
+static void stringBenchmarks(bench::Runner& runner) {
+    constexpr int Count = 100;
+
+    std::vector<std::string> names;
+    for (int i = 0; i < Count; ++i) names.push_back(fmt::format("interned string number {}", i));
+    for (const auto& name : names) ObjFactory::copyString(name.c_str(), static_cast<int>(name.size()));
+
+    runner.run("ObjFactory/copyString interned", Count, [&] {
+        for (const auto& name : names) {
+            bench::doNotOptimize(ObjFactory::copyString(name.c_str(), static_cast<int>(name.size())));
+        }
+    });
+
+    // every call interns a string never seen before; they are dropped from
+    // the table again so its size stays the same from sample to sample
+    u64 serial = 0;
+    std::vector<ObjString*> fresh(Count);
+    runner.run("ObjFactory/copyString new", Count, [&] {
+        char buffer[32];
+        for (int i = 0; i < Count; ++i) {
+            int length = std::snprintf(buffer, sizeof(buffer), "fresh %llu", static_cast<unsigned long long>(serial++));
+            fresh[i] = ObjFactory::copyString(buffer, length);
+        }
+        for (ObjString* string : fresh) ObjFactory::get().deleteEntry(string);
+    });
+
+    runner.run("ObjFactory/takeString interned", Count, [&] {
+        for (const auto& name : names) {
+            auto length = static_cast<int>(name.size());
+            char* chars = memory::allocate<char>(length + 1);
+            std::memcpy(chars, name.c_str(), length + 1);
+            bench::doNotOptimize(ObjFactory::takeString(chars, length));
+        }
+    });
+}
+
+// builds a script running 'pattern' 'times' times in straight-line code
+static ByteCode repeated(int times, const std::function<void(ByteCode&)>& prologue,
+                         const std::function<void(ByteCode&)>& pattern) {
+    ByteCode code;
+    prologue(code);
+    for (int i = 0; i < times; ++i) pattern(code);
+    code.writeOpCode(OpCode::Nil, 1);
+    code.writeOpCode(OpCode::Return, 1);
+    return code;
+}
+
+static void emit(ByteCode& code, OpCode op, std::initializer_list<u8> operands = {}) {
+    code.writeOpCode(op, 1);
+    for (u8 operand : operands) code.writeByte(operand, 1);
+}
+
+static void dispatchBenchmarks(bench::Runner& runner) {
+    constexpr int Times = 1000;
+    auto vm = std::make_unique<GlangVm>();
+
+    auto runCode = [&](std::string_view name, u64 ops, ByteCode code) {
+        ProgramRef program = Program::fromByteCode(std::move(code));
+        runner.run(name, ops, [&] { bench::doNotOptimize(vm->interpret(program)); });
+    };
+    auto none = [](ByteCode&) {};
+
+    runCode("dispatch/Nil Pop", 2 * Times, repeated(Times, none, [](ByteCode& code) {
+                emit(code, OpCode::Nil);
+                emit(code, OpCode::Pop);
+            }));
+
+    runCode("dispatch/Constant Pop", 2 * Times, repeated(Times, [](ByteCode& code) { code.writeValue(Value::createNumber(1)); }, [](ByteCode& code) {
+                emit(code, OpCode::Constant, {0});
+                emit(code, OpCode::Pop);
+            }));
+
+    runCode("dispatch/GetLocal Pop", 2 * Times, repeated(Times, [](ByteCode& code) { emit(code, OpCode::Nil); }, [](ByteCode& code) {
+                emit(code, OpCode::GetLocal, {0});
+                emit(code, OpCode::Pop);
+            }));
+
+    ObjString* global = ObjFactory::copyString("counter", 7);
+    auto defineGlobal = [&](ByteCode& code) {
+        code.writeValue(Value::createObj(global));
+        code.writeValue(Value::createNumber(1));
+        emit(code, OpCode::Constant, {1});
+        emit(code, OpCode::DefineGlobal, {0});
+    };
+    runCode("dispatch/GetGlobal Pop", 2 * Times, repeated(Times, defineGlobal, [](ByteCode& code) {
+                emit(code, OpCode::GetGlobal, {0});
+                emit(code, OpCode::Pop);
+            }));
+
+    runCode("dispatch/Constant Constant Add Pop", 4 * Times, repeated(Times, [](ByteCode& code) { code.writeValue(Value::createNumber(1)); }, [](ByteCode& code) {
+                emit(code, OpCode::Constant, {0});
+                emit(code, OpCode::Constant, {0});
+                emit(code, OpCode::Add);
+                emit(code, OpCode::Pop);
+            }));
+
+    runCode("dispatch/True Not Pop", 3 * Times, repeated(Times, none, [](ByteCode& code) {
+                emit(code, OpCode::True);
+                emit(code, OpCode::Not);
+                emit(code, OpCode::Pop);
+            }));
+
+    runCode("dispatch/Jmp", Times, repeated(Times, none, [](ByteCode& code) { emit(code, OpCode::Jmp, {0, 0}); }));
+
+    ObjString* left = ObjFactory::copyString("left half ", 10);
+    ObjString* right = ObjFactory::copyString("right half", 10);
+    auto strings = [&](ByteCode& code) {
+        code.writeValue(Value::createObj(left));
+        code.writeValue(Value::createObj(right));
+    };
+    // one concatenation per op; the result is interned after the first run
+    runCode("vm/concatenate", Times, repeated(Times, strings, [](ByteCode& code) {
+                emit(code, OpCode::Constant, {0});
+                emit(code, OpCode::Constant, {1});
+                emit(code, OpCode::Add);
+                emit(code, OpCode::Pop);
+            }));
+}
+
+// each thread's scripts differ in 'seed', so a value leaking from one
+// isolate into another shows up as a wrong result
+static std::string isolateScript(int seed) {
+    return fmt::format("def seed = {};\n"
+                       "fun fib(n) {{ if (n < 2) return n; return fib(n - 1) + fib(n - 2); }}\n"
+                       "def names = [];\n"
+                       "for (def i = 0; i < 20; i = i + 1) push(names, \"item \" + toString(i + seed));\n"
+                       "def result = fib(12) + len(names) + seed;\n",
+                       seed);
+}
+
+// Every script runs in a fresh isolate, the way a worker evaluating
+// independent scripts would; ops/s is the throughput over all threads
+// and should grow with the thread count up to the number of cores. With
+// 'shared' the scripts are compiled once up front and only run.
+static void isolateBenchmark(bench::Runner& runner, unsigned threads, bool shared) {
+    constexpr int ScriptsPerThread = 25;
+
+    std::vector<ProgramRef> programs;
+    for (unsigned t = 0; t < threads && shared; ++t) programs.push_back(Program::compile(isolateScript(static_cast<int>(t))));
+
+    std::atomic<int> failures{0};
+    auto name = fmt::format("isolates/{} threads{}", threads, shared ? ", shared" : "");
+    runner.run(name, u64{threads} * ScriptsPerThread, [&] {
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::string source = isolateScript(static_cast<int>(t));
+                for (int i = 0; i < ScriptsPerThread; ++i) {
+                    Isolate isolate;
+                    Result result = shared ? isolate.run(programs[t]) : isolate.interpret(source);
+                    auto value = isolate.global("result");
+                    if (result != Result::Ok || !value || !value->isNumber() || value->asNumber() != 144 + 20 + t) ++failures;
+                }
+            });
+        }
+        for (auto& worker : workers) worker.join();
+    });
+
+    if (failures > 0) {
+        fmt::print("{}: {} scripts computed the wrong result\n", name, failures.load());
+        std::exit(70);
+    }
+}
+
+static void isolateBenchmarks(bench::Runner& runner) {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> threadCounts;
+    for (unsigned threads = 1; threads < cores; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(cores);
+
+    for (unsigned threads : threadCounts) {
+        isolateBenchmark(runner, threads, false);
+        isolateBenchmark(runner, threads, true);
+    }
+}
+
+// one rule script run over and over on the same VM: only the first run
+// links the program, later ones must not allocate at all
+static void programBenchmarks(bench::Runner& runner) {
+    ProgramRef program = Program::compile("fun clamp(x, low, high) { if (x < low) return low; if (x > high) return high; return x; }\n"
+                                          "def limit = 40;\n"
+                                          "def score = clamp(limit * 3 - 25, 0, 100);\n"
+                                          "if (score > 50 and limit < 60) score = score - 10;\n");
+    Isolate isolate;
+    isolate.run(program);
+
+    runner.run("program/rerun", 1, [&] { bench::doNotOptimize(isolate.run(program)); });
+    if (!runner.selected("program/rerun")) return;
+
+    u64 before = memory::g_stats.allocations;
+    for (int i = 0; i < 1000; ++i) isolate.run(program);
+    if (memory::g_stats.allocations != before) {
+        fmt::print("program/rerun: {} allocations in 1000 runs\n", memory::g_stats.allocations - before);
+        std::exit(70);
+    }
+}
+
+static bool scaleNative(glang_vm*, int, const glang_value* args, glang_value* result, void*) {
+    *result = glang_number(args[0].as.number * 2);
+    return true;
+}
+
+// what an embedder pays per request: set an input, run a precompiled rule
+// that calls back into the host and read the result, all through glang.h
+static void capiBenchmarks(bench::Runner& runner) {
+    static const char source[] = "def result = scale(input) + 1;";
+
+    glang_vm* vm = glang_vm_new();
+    glang_define_native(vm, "scale", 1, scaleNative, nullptr);
+    glang_program* program = glang_compile(source, sizeof(source) - 1, nullptr, nullptr);
+
+    double input = 0;
+    glang_value result = glang_nil();
+    runner.run("capi/run", 1, [&] {
+        glang_set_global(vm, "input", glang_number(++input));
+        glang_run(vm, program);
+        glang_get_global(vm, "result", &result);
+        bench::doNotOptimize(result);
+    });
+    if (input > 0 && (result.type != GLANG_NUMBER || result.as.number != input * 2 + 1)) {
+        fmt::print("capi/run: wrong result\n");
+        std::exit(70);
+    }
+
+    runner.run("capi/interpret", 1, [&] { bench::doNotOptimize(glang_interpret(vm, source, sizeof(source) - 1)); });
+
+    glang_program_free(program);
+    glang_vm_free(vm);
+}
+
+// a notebook cell's turnaround: compile a snippet, link it against the
+// globals earlier cells left behind and run it
+static void sessionBenchmarks(bench::Runner& runner) {
+    Session session;
+    for (int i = 0; i < 50; ++i) session.evaluate(fmt::format("def cell{0} = {0}; fun double{0}(x) {{ return x * 2; }}", i));
+
+    runner.run("session/evaluate", 1, [&] { bench::doNotOptimize(session.evaluate("def total = double7(cell42) + cell3;")); });
+
+    std::string cell = "fun area(w, h) {\n    return w * h;\n}\nprint area(3, 4);";
+    runner.run("session/isComplete", cell.size(), [&] { bench::doNotOptimize(Session::isComplete(cell)); });
+}
+
+// for-in over 100k elements; ops are elements. A generator pays for two
+// context switches per value, the built-in iterables for none.
+static void iterationBenchmarks(bench::Runner& runner) {
+    Isolate isolate;
+    isolate.interpret("def numbers = []; for (def i = 0; i < 100000; i = i + 1) push(numbers, i);\n"
+                      "fun upTo(n) { for (def i = 0; i < n; i = i + 1) yield i; }\n");
+    double expected = 99999.0 * 100000 / 2;
+
+    auto iterate = [&](std::string_view name, const char* iterable) {
+        ProgramRef program = Program::compile(fmt::format("def total = 0; for (x in {}) total = total + x;", iterable));
+        runner.run(name, 100000, [&] { bench::doNotOptimize(isolate.run(program)); });
+
+        isolate.run(program);
+        auto total = isolate.global("total");
+        if (!total || !total->isNumber() || total->asNumber() != expected) {
+            fmt::print("{}: wrong result\n", name);
+            std::exit(70);
+        }
+    };
+    iterate("for-in/array", "numbers");
+    iterate("for-in/range", "range(100000)");
+    iterate("for-in/generator", "upTo(100000)");
+}
+
+// 100k fibers alive at once: each blocks on 'gate' until all are spawned,
+// then yields three times before it returns; ops are fibers. Each run gets
+// a fresh isolate, which frees the fibers it leaves behind.
+static void fiberBenchmarks(bench::Runner& runner) {
+    constexpr int Fibers = 100000;
+    ProgramRef program = Program::compile(fmt::format(
+        "def open = false;\n"
+        "fun hold() {{ while (!open) yield; }}\n"
+        "def gate = spawn(hold);\n"
+        "fun worker(n) {{ join(gate); def total = 0; for (def i = 0; i < 3; i = i + 1) {{ total = total + n; yield; }} return total; }}\n"
+        "def fibers = [];\n"
+        "for (def i = 0; i < {0}; i = i + 1) push(fibers, spawn(worker, i));\n"
+        "open = true;\n"
+        "def result = 0;\n"
+        "for (def i = 0; i < {0}; i = i + 1) result = result + join(fibers[i]);\n",
+        Fibers));
+    double expected = 3.0 * (Fibers - 1) * Fibers / 2;
+
+    auto runOnce = [&] {
+        Isolate isolate;
+        Result result = isolate.run(program);
+        auto value = isolate.global("result");
+        if (result != Result::Ok || !value || !value->isNumber() || value->asNumber() != expected) {
+            fmt::print("fibers: wrong result\n");
+            std::exit(70);
+        }
+    };
+    runner.run("fibers/100k spawn, yield, join", Fibers, runOnce);
+    if (!runner.selected("fibers/100k")) return;
+
+    // everything the run holds at its peak, when all the fibers are
+    // suspended, over the fiber count
+    memory::g_stats.peakHeapSize = memory::g_stats.heapSize;
+    u64 before = memory::g_stats.heapSize;
+    runOnce();
+    fmt::print("fibers/100k: {} bytes per suspended fiber\n", (memory::g_stats.peakHeapSize - before) / Fibers);
+}
+
+// A pure numeric body, 20k iterations of a 200-step inner loop, run as a
+// plain for-in and as a parallel for; ops are outer iterations. The ratio
+// of the two is the speedup over the pool's workers.
+static void parallelBenchmarks(bench::Runner& runner) {
+    static constexpr int Iterations = 20000;
+    auto compile = [](const char* loop) {
+        return Program::compile(fmt::format(
+            "def total = 0;\n"
+            "{} {{\n"
+            "    def x = 0;\n"
+            "    for (def j = 0; j < 200; j = j + 1) x = x + i + j;\n"
+            "    total = total + x;\n"
+            "}}\n",
+            fmt::format(fmt::runtime(loop), Iterations)));
+    };
+    double expected = 200.0 * (Iterations - 1) * Iterations / 2 + Iterations * 19900.0;
+
+    auto time = [&](std::string_view name, const char* loop) {
+        ProgramRef program = compile(loop);
+        Isolate isolate;
+        runner.run(name, Iterations, [&] { bench::doNotOptimize(isolate.run(program)); });
+
+        Result result = isolate.run(program);
+        auto total = isolate.global("total");
+        if (result != Result::Ok || !total || !total->isNumber() || total->asNumber() != expected) {
+            fmt::print("{}: wrong result\n", name);
+            std::exit(70);
+        }
+    };
+    size before = runner.results().size();
+    time("parallel/sequential for-in", "for (def i in range({}))");
+    time("parallel/parallel for", "parallel for (def i in range({})) reduce (+: total)");
+
+    if (runner.results().size() == before + 2) {
+        double speedup = runner.results()[before].medianNs / runner.results()[before + 1].medianNs;
+        fmt::print("parallel: {:.2f}x over sequential with {} workers\n", speedup, WorkerPool::shared().size());
+    }
+
+    // what a loop costs besides its body: short loops reading a global
+    // array of 100k numbers, which the workers are lent, not given copies of
+    {
+        static constexpr int Loops = 100;
+        ProgramRef program = Program::compile(fmt::format(
+            "def data = [];\n"
+            "for (def i = 0; i < 100000; i = i + 1) push(data, i);\n"
+            "fun loops() {{\n"
+            "    def total = 0;\n"
+            "    for (def k = 0; k < {}; k = k + 1) {{\n"
+            "        def part = 0;\n"
+            "        parallel for (def i in range(64)) reduce (+: part) {{ part = part + data[i * 1000]; }}\n"
+            "        total = total + part;\n"
+            "    }}\n"
+            "    return total;\n"
+            "}}\n",
+            Loops));
+        double expected = Loops * 1000.0 * 63 * 64 / 2;
+        Isolate isolate;
+        isolate.run(program);
+        auto loops = isolate.global("loops");
+        ObjFunction* function = loops && object::isFunction(*loops) ? object::asFunction(*loops) : nullptr;
+
+        runner.run("parallel/short loops over a 100k global array", Loops, [&] {
+            Value total;
+            Isolate::Scope scope{isolate};
+            if (function == nullptr || isolate.vm().callFunction(function, 0, nullptr, total) != Result::Ok ||
+                !total.isNumber() || total.asNumber() != expected) {
+                fmt::print("parallel/short loops: wrong result\n");
+                std::exit(70);
+            }
+        });
+    }
+}
+
+static void setChannel(Isolate& isolate, std::string_view name, const std::shared_ptr<Channel>& channel) {
+    Isolate::Scope scope{isolate};
+    isolate.setGlobal(name, Value::createObj(ObjFactory::newChannel(channel)));
+}
+
+// Two isolates on two threads bouncing a number over a pair of channels
+// (ops are round trips), and one producer feeding strings to four
+// consumers through a bounded channel (ops are messages). Every string is
+// one of a few, so after the first round they are shared, not copied.
+static void channelBenchmarks(bench::Runner& runner) {
+    {
+        static constexpr int RoundTrips = 2000;
+        ProgramRef pinger = Program::compile(fmt::format(
+            "def total = 0;\n"
+            "for (def i = 0; i < {}; i = i + 1) {{ send(ping, i); total = total + recv(pong); }}\n",
+            RoundTrips));
+        ProgramRef ponger = Program::compile(fmt::format(
+            "for (def i = 0; i < {}; i = i + 1) send(pong, recv(ping));\n", RoundTrips));
+
+        Isolate first;
+        Isolate second;
+        auto ping = std::make_shared<Channel>(1);
+        auto pong = std::make_shared<Channel>(1);
+        for (Isolate* isolate : {&first, &second}) {
+            setChannel(*isolate, "ping", ping);
+            setChannel(*isolate, "pong", pong);
+        }
+
+        runner.run("channels/ping-pong", RoundTrips, [&] {
+            std::thread other{[&] { second.run(ponger); }};
+            Result result = first.run(pinger);
+            other.join();
+
+            auto total = first.global("total");
+            if (result != Result::Ok || !total || !total->isNumber() ||
+                total->asNumber() != (RoundTrips - 1) * RoundTrips / 2.0) {
+                fmt::print("channels/ping-pong: wrong result\n");
+                std::exit(70);
+            }
+        });
+    }
+
+    {
+        static constexpr int Consumers = 4;
+        static constexpr int Rounds = 2500;
+        static constexpr int Messages = Rounds * 8;
+        ProgramRef producer = Program::compile(fmt::format(
+            "def words = [\"alpha\", \"beta\", \"gamma\", \"delta\", \"epsilon\", \"zeta\", \"eta\", \"theta\"];\n"
+            "for (def i = 0; i < {}; i = i + 1) for (def j = 0; j < 8; j = j + 1) send(work, words[j]);\n"
+            "for (def i = 0; i < {}; i = i + 1) send(work, nil);\n",
+            Rounds, Consumers));
+        ProgramRef consumer = Program::compile(
+            "def count = 0;\n"
+            "def chars = 0;\n"
+            "def word = recv(work);\n"
+            "while (word != nil) { count = count + 1; chars = chars + len(word); word = recv(work); }\n");
+        double expectedChars = Rounds * 38.0;
+
+        auto work = std::make_shared<Channel>(64);
+        Isolate source;
+        setChannel(source, "work", work);
+        std::vector<std::unique_ptr<Isolate>> sinks;
+        for (int i = 0; i < Consumers; ++i) {
+            sinks.push_back(std::make_unique<Isolate>());
+            setChannel(*sinks.back(), "work", work);
+        }
+
+        runner.run("channels/fan-out, 4 consumers", Messages, [&] {
+            std::vector<std::thread> threads;
+            for (auto& sink : sinks) threads.emplace_back([&] { sink->run(consumer); });
+            bool ok = source.run(producer) == Result::Ok;
+            for (auto& thread : threads) thread.join();
+
+            double count = 0;
+            double chars = 0;
+            for (auto& sink : sinks) {
+                auto got = sink->global("count");
+                auto length = sink->global("chars");
+                ok = ok && got && length && got->isNumber() && length->isNumber();
+                if (ok) {
+                    count += got->asNumber();
+                    chars += length->asNumber();
+                }
+            }
+            if (!ok || count != Messages || chars != expectedChars) {
+                fmt::print("channels/fan-out: wrong result\n");
+                std::exit(70);
+            }
+        });
+    }
+}
+
+// Eight files of 25k numbered lines, each summed by its own fiber while
+// the others wait for their reads; ops are lines.
+static void ioBenchmarks(bench::Runner& runner) {
+    static constexpr int Files = 8;
+    static constexpr int Lines = 25000;
+    auto directory = std::filesystem::temp_directory_path() / fmt::format("glang_bench_{}", ::getpid());
+    std::filesystem::create_directories(directory);
+    for (int i = 0; i < Files; ++i) {
+        std::ofstream file{directory / fmt::format("{}.txt", i)};
+        for (int line = 1; line <= Lines; ++line) file << line << '\n';
+    }
+
+    ProgramRef program = Program::compile(fmt::format(
+        "fun count(path) {{ def total = 0; for (def line in readLines(path)) total = total + toNumber(line); return total; }}\n"
+        "def fibers = [];\n"
+        "for (def i = 0; i < {0}; i = i + 1) push(fibers, spawn(count, \"{1}/\" + toString(i) + \".txt\"));\n"
+        "def result = 0;\n"
+        "for (def i = 0; i < {0}; i = i + 1) result = result + join(fibers[i]);\n",
+        Files, directory.string()));
+    double expected = Files * (Lines + 1.0) * Lines / 2;
+
+    runner.run("io/readLines, 8 files over fibers", Files * Lines, [&] {
+        Isolate isolate;
+        Result result = isolate.run(program);
+        auto value = isolate.global("result");
+        if (result != Result::Ok || !value || !value->isNumber() || value->asNumber() != expected) {
+            fmt::print("io/readLines: wrong result\n");
+            std::filesystem::remove_all(directory);
+            std::exit(70);
+        }
+    });
+    std::filesystem::remove_all(directory);
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    const char* jsonPath = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else {
+            fmt::print("Usage: glang_bench [--filter substring] [--json path]\n");
+            return 64;
+        }
+    }
+
+    bench::Runner runner{filter};
+    runner.printHeader();
+
+    // the benchmarks below share this isolate; isolateBenchmarks makes its own
+    Isolate isolate;
+    Isolate::Scope scope{isolate};
+
+    stringBenchmarks(runner);
+    dispatchBenchmarks(runner);
+    scannerBenchmarks(runner);
+    compilerBenchmarks(runner);
+    hashTableBenchmarks(runner);
+    programBenchmarks(runner);
+    capiBenchmarks(runner);
+    sessionBenchmarks(runner);
+    iterationBenchmarks(runner);
+    parallelBenchmarks(runner);
+    channelBenchmarks(runner);
+    ioBenchmarks(runner);
+    fiberBenchmarks(runner);
+    isolateBenchmarks(runner);
+
+    if (jsonPath != nullptr && !runner.writeJson(jsonPath)) {
+        fmt::print("Failed to write {}\n", jsonPath);
+        return 74;
+    }
+    return 0;
+}
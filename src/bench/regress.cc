@@ -0,0 +1,364 @@
+// Runs the script corpus in benchmarks/ through the glang binary and
+// compares the results with a saved baseline.
+//
+//   glang_regress [--glang path] [--runs n] [--baseline file] [--save file] [script...]
+//
+// Every script runs once to warm the file cache and then 'runs' times,
+// recording wall time, user-space instructions retired (when the kernel
+// allows perf_event_open) and peak RSS. Against a baseline, a script counts
+// as regressed when its wall time is slower by more than 3% and Welch's
+// t-test puts the difference at p < 0.05, or when it retires more than 1%
+// more instructions. The exit status is 1 if anything regressed.
+
+#include "common.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr double SlowdownThreshold = 0.03;
+constexpr double InstructionThreshold = 0.01;
+constexpr double Significance = 0.05;
+
+struct Benchmark {
+    std::string name;
+    std::vector<double> wallMs;
+    std::vector<double> instructions; // empty when the counter is unavailable
+    long maxRssKb{};
+};
+
+struct Run {
+    double wallMs;
+    double instructions; // -1 when the counter is unavailable
+    long maxRssKb;
+};
+
+}
+
+static int openInstructionCounter(pid_t pid) {
+    perf_event_attr attr{};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0));
+}
+
+// the child waits on a pipe until its counter is attached, then execs
+static bool runOnce(const std::string& glang, const std::string& script, Run& run) {
+    int gate[2];
+    if (pipe2(gate, O_CLOEXEC) != 0) return false;
+
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        char go;
+        close(gate[1]);
+        if (read(gate[0], &go, 1) != 1) _exit(127);
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        execl(glang.c_str(), glang.c_str(), script.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+
+    close(gate[0]);
+    int counter = openInstructionCounter(pid);
+
+    auto start = std::chrono::steady_clock::now();
+    bool released = write(gate[1], "x", 1) == 1;
+    close(gate[1]);
+
+    int status = 0;
+    rusage usage{};
+    wait4(pid, &status, 0, &usage);
+    auto end = std::chrono::steady_clock::now();
+
+    run.wallMs = std::chrono::duration<double, std::milli>(end - start).count();
+    run.maxRssKb = usage.ru_maxrss;
+    run.instructions = -1;
+    if (counter >= 0) {
+        u64 count = 0;
+        if (read(counter, &count, sizeof(count)) == sizeof(count)) run.instructions = static_cast<double>(count);
+        close(counter);
+    }
+
+    return released && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static double mean(const std::vector<double>& values) {
+    double sum = 0;
+    for (double value : values) sum += value;
+    return values.empty() ? 0 : sum / values.size();
+}
+
+static double variance(const std::vector<double>& values) {
+    if (values.size() < 2) return 0;
+    double average = mean(values);
+    double sum = 0;
+    for (double value : values) sum += (value - average) * (value - average);
+    return sum / (values.size() - 1);
+}
+
+static double median(std::vector<double> values) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size middle = values.size() / 2;
+    return values.size() % 2 == 1 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+// continued fraction for the regularized incomplete beta function
+static double betaFraction(double a, double b, double x) {
+    constexpr int MaxIterations = 200;
+    constexpr double Epsilon = 1e-12;
+    constexpr double Tiny = 1e-300;
+
+    double c = 1;
+    double d = 1 - (a + b) * x / (a + 1);
+    if (std::abs(d) < Tiny) d = Tiny;
+    d = 1 / d;
+    double result = d;
+
+    for (int m = 1; m <= MaxIterations; ++m) {
+        double even = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+        d = 1 + even * d;
+        if (std::abs(d) < Tiny) d = Tiny;
+        c = 1 + even / c;
+        if (std::abs(c) < Tiny) c = Tiny;
+        d = 1 / d;
+        result *= d * c;
+
+        double odd = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+        d = 1 + odd * d;
+        if (std::abs(d) < Tiny) d = Tiny;
+        c = 1 + odd / c;
+        if (std::abs(c) < Tiny) c = Tiny;
+        d = 1 / d;
+        double delta = d * c;
+        result *= delta;
+        if (std::abs(delta - 1) < Epsilon) break;
+    }
+    return result;
+}
+
+static double incompleteBeta(double a, double b, double x) {
+    if (x <= 0) return 0;
+    if (x >= 1) return 1;
+    double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log(1 - x));
+    if (x < (a + 1) / (a + b + 2)) return front * betaFraction(a, b, x) / a;
+    return 1 - front * betaFraction(b, a, 1 - x) / b;
+}
+
+// two-sided p-value of Welch's t-test for a difference in means
+static double welchPValue(const std::vector<double>& a, const std::vector<double>& b) {
+    if (a.size() < 2 || b.size() < 2) return 1;
+
+    double va = variance(a) / a.size();
+    double vb = variance(b) / b.size();
+    if (va + vb == 0) return mean(a) == mean(b) ? 1 : 0;
+
+    double t = (mean(a) - mean(b)) / std::sqrt(va + vb);
+    double df = (va + vb) * (va + vb) / (va * va / (a.size() - 1) + vb * vb / (b.size() - 1));
+    return incompleteBeta(df / 2, 0.5, df / (df + t * t));
+}
+
+static std::string joinNumbers(const std::vector<double>& values) {
+    std::string text;
+    for (size i = 0; i < values.size(); ++i) {
+        text += fmt::format("{}{:.3f}", i == 0 ? "" : ", ", values[i]);
+    }
+    return text;
+}
+
+static bool saveResults(const char* path, const std::vector<Benchmark>& benchmarks) {
+    std::FILE* file = std::fopen(path, "w");
+    if (file == nullptr) return false;
+
+    fmt::print(file, "{{\n  \"benchmarks\": [");
+    for (size i = 0; i < benchmarks.size(); ++i) {
+        const Benchmark& benchmark = benchmarks[i];
+        fmt::print(file, "{}\n    {{\"name\": \"{}\", \"wall_ms\": [{}], \"instructions\": [{}], \"max_rss_kb\": {}}}",
+                   i == 0 ? "" : ",", benchmark.name, joinNumbers(benchmark.wallMs),
+                   joinNumbers(benchmark.instructions), benchmark.maxRssKb);
+    }
+    fmt::print(file, "\n  ]\n}}\n");
+    return std::fclose(file) == 0;
+}
+
+static std::vector<double> parseNumbers(const std::string& text, size from, const char* key) {
+    std::vector<double> values;
+    size at = text.find(key, from);
+    if (at == std::string::npos) return values;
+
+    const char* cursor = text.c_str() + at + std::strlen(key);
+    while (*cursor != ']' && *cursor != '\0') {
+        char* end = nullptr;
+        double value = std::strtod(cursor, &end);
+        if (end == cursor) {
+            ++cursor;
+            continue;
+        }
+        values.push_back(value);
+        cursor = end;
+    }
+    return values;
+}
+
+// reads back what saveResults() writes; not a general JSON parser
+static bool loadResults(const char* path, std::vector<Benchmark>& benchmarks) {
+    std::ifstream file{path};
+    if (!file.is_open()) return false;
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string text = buffer.str();
+
+    const std::string nameKey = "\"name\": \"";
+    for (size at = text.find(nameKey); at != std::string::npos; at = text.find(nameKey, at + 1)) {
+        size begin = at + nameKey.size();
+        size end = text.find('"', begin);
+        if (end == std::string::npos) return false;
+
+        Benchmark benchmark;
+        benchmark.name = text.substr(begin, end - begin);
+        benchmark.wallMs = parseNumbers(text, end, "\"wall_ms\": [");
+        benchmark.instructions = parseNumbers(text, end, "\"instructions\": [");
+        auto rss = parseNumbers(text, end, "\"max_rss_kb\": ");
+        benchmark.maxRssKb = rss.empty() ? 0 : static_cast<long>(rss.front());
+        benchmarks.push_back(std::move(benchmark));
+    }
+    return true;
+}
+
+static const Benchmark* findBenchmark(const std::vector<Benchmark>& benchmarks, const std::string& name) {
+    for (const Benchmark& benchmark : benchmarks) {
+        if (benchmark.name == name) return &benchmark;
+    }
+    return nullptr;
+}
+
+// returns true if 'current' regressed against 'baseline'
+static bool compare(const Benchmark& current, const Benchmark& baseline, std::string& verdict) {
+    double now = median(current.wallMs);
+    double before = median(baseline.wallMs);
+    double change = before > 0 ? now / before - 1 : 0;
+    double p = welchPValue(current.wallMs, baseline.wallMs);
+
+    bool slower = change > SlowdownThreshold && p < Significance;
+    bool faster = change < -SlowdownThreshold && p < Significance;
+    verdict = fmt::format("{:+6.1f}% (p={:.3f})", 100 * change, p);
+
+    bool moreInstructions = false;
+    if (!current.instructions.empty() && !baseline.instructions.empty()) {
+        double instructionChange = median(current.instructions) / median(baseline.instructions) - 1;
+        moreInstructions = instructionChange > InstructionThreshold;
+        verdict += fmt::format(" instr {:+.1f}%", 100 * instructionChange);
+    }
+
+    if (slower || moreInstructions) {
+        verdict += "  REGRESSION";
+    } else if (faster) {
+        verdict += "  faster";
+    }
+    return slower || moreInstructions;
+}
+
+int main(int argc, char** argv) {
+    std::string glang = (std::filesystem::path{argv[0]}.parent_path() / "glang").string();
+    int runs = 10;
+    const char* baselinePath = nullptr;
+    const char* savePath = nullptr;
+    std::vector<std::string> scripts;
+
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--glang") == 0 && hasValue) {
+            glang = argv[++i];
+        } else if (std::strcmp(argv[i], "--runs") == 0 && hasValue) {
+            runs = std::max(2, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--baseline") == 0 && hasValue) {
+            baselinePath = argv[++i];
+        } else if (std::strcmp(argv[i], "--save") == 0 && hasValue) {
+            savePath = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fmt::print("Usage: glang_regress [--glang path] [--runs n] [--baseline file] [--save file] [script...]\n");
+            return 64;
+        } else {
+            scripts.emplace_back(argv[i]);
+        }
+    }
+
+    if (scripts.empty()) {
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator{"benchmarks", error}) {
+            if (entry.path().extension() == ".gln") scripts.push_back(entry.path().string());
+        }
+        std::sort(scripts.begin(), scripts.end());
+    }
+    if (scripts.empty()) {
+        fmt::print("No scripts given and none found in ./benchmarks\n");
+        return 64;
+    }
+
+    std::vector<Benchmark> baseline;
+    if (baselinePath != nullptr && !loadResults(baselinePath, baseline)) {
+        fmt::print("Failed to read baseline {}\n", baselinePath);
+        return 74;
+    }
+
+    fmt::print("{:<24} {:>20} {:>14} {:>10}  {}\n", "script", "wall ms (median±sd)", "instructions", "max rss", "vs baseline");
+
+    std::vector<Benchmark> results;
+    bool regressed = false;
+    for (const auto& script : scripts) {
+        Benchmark benchmark;
+        benchmark.name = std::filesystem::path{script}.stem().string();
+
+        Run run{};
+        bool ok = runOnce(glang, script, run);
+        for (int i = 0; ok && i < runs; ++i) {
+            ok = runOnce(glang, script, run);
+            benchmark.wallMs.push_back(run.wallMs);
+            if (run.instructions >= 0) benchmark.instructions.push_back(run.instructions);
+            benchmark.maxRssKb = std::max(benchmark.maxRssKb, run.maxRssKb);
+        }
+        if (!ok) {
+            fmt::print("{:<24} failed to run with {}\n", benchmark.name, glang);
+            regressed = true;
+            continue;
+        }
+
+        std::string verdict;
+        if (const Benchmark* before = findBenchmark(baseline, benchmark.name)) {
+            regressed = compare(benchmark, *before, verdict) || regressed;
+        }
+
+        std::string instructions = benchmark.instructions.empty() ? "n/a" : fmt::format("{:.3g}", median(benchmark.instructions));
+        fmt::print("{:<24} {:>12.1f} ±{:>6.1f} {:>14} {:>7} KiB  {}\n", benchmark.name, median(benchmark.wallMs),
+                   std::sqrt(variance(benchmark.wallMs)), instructions, benchmark.maxRssKb, verdict);
+        std::fflush(stdout);
+        results.push_back(std::move(benchmark));
+    }
+
+    if (savePath != nullptr && !saveResults(savePath, results)) {
+        fmt::print("Failed to write {}\n", savePath);
+        return 74;
+    }
+    return regressed ? 1 : 0;
+}
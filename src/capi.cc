@@ -0,0 +1,152 @@
+#include "glang.h"
+#include "Isolate.hh"
+#include "Session.hh"
+#include "object.hh"
+
+#include <memory>
+#include <vector>
+
+namespace {
+struct ForeignNative {
+    glang_vm* vm;
+    glang_native_fn function;
+    void* userdata;
+};
+}
+
+struct glang_vm {
+    Isolate isolate;
+    std::vector<std::unique_ptr<ForeignNative>> natives;
+};
+
+struct glang_program {
+    ProgramRef program;
+};
+
+static glang_result toResult(Result result) {
+    switch (result) {
+    case Result::Ok:
+        return GLANG_OK;
+    case Result::CompileError:
+        return GLANG_COMPILE_ERROR;
+    case Result::RuntimeError:
+        return GLANG_RUNTIME_ERROR;
+    }
+    return GLANG_RUNTIME_ERROR;
+}
+
+static glang_value fromValue(Value value) {
+    switch (value.type) {
+    case ValNil:
+        return glang_nil();
+    case ValBool:
+        return glang_bool(value.asBool());
+    case ValNumber:
+        return glang_number(value.asNumber());
+    case ValObj:
+        break;
+    }
+    if (object::isString(value)) {
+        ObjString* string = object::asString(value);
+        return glang_string(string->chars, static_cast<size_t>(string->length));
+    }
+    glang_value result;
+    result.type = GLANG_OBJECT;
+    result.as.object = value.asObj();
+    return result;
+}
+
+// strings are interned in the current heap
+static Value toValue(glang_value value) {
+    switch (value.type) {
+    case GLANG_NIL:
+        return Value::createNil();
+    case GLANG_BOOL:
+        return Value::createBool(value.as.boolean);
+    case GLANG_NUMBER:
+        return Value::createNumber(value.as.number);
+    case GLANG_STRING:
+        return Value::createObj(ObjFactory::copyString(value.as.string.chars, static_cast<int>(value.as.string.length)));
+    case GLANG_OBJECT:
+        return Value::createObj(static_cast<Obj*>(value.as.object));
+    }
+    return Value::createNil();
+}
+
+// every native registered through the C API runs through here; its
+// ObjNative, in the callee slot, says which function to call
+static bool callForeign(GlangVm&, int argCount, Value* args) {
+    auto native = static_cast<ForeignNative*>(object::asNative(args[-1])->data);
+
+    glang_value converted[UINT8_MAX + 1];
+    for (int i = 0; i < argCount; ++i) converted[i] = fromValue(args[i]);
+
+    glang_value result = glang_nil();
+    if (!native->function(native->vm, argCount, converted, &result, native->userdata)) return false;
+
+    args[-1] = toValue(result);
+    return true;
+}
+
+glang_vm* glang_vm_new(void) {
+    return new glang_vm;
+}
+
+void glang_vm_free(glang_vm* vm) {
+    delete vm;
+}
+
+void glang_vm_set_output(glang_vm* vm, glang_write_fn write, void* userdata) {
+    vm->isolate.vm().output().redirect(write, userdata);
+}
+
+glang_program* glang_compile(const char* source, size_t length, glang_write_fn errors, void* userdata) {
+    std::string code{source, length};
+    ProgramRef program;
+    if (errors != nullptr) {
+        OutputBuffer buffer{errors, userdata};
+        program = Program::compile(code, buffer);
+    } else {
+        program = Program::compile(code);
+    }
+    if (program == nullptr) return nullptr;
+    return new glang_program{std::move(program)};
+}
+
+void glang_program_free(glang_program* program) {
+    delete program;
+}
+
+glang_result glang_run(glang_vm* vm, const glang_program* program) {
+    return toResult(vm->isolate.run(program->program));
+}
+
+glang_result glang_interpret(glang_vm* vm, const char* source, size_t length) {
+    return toResult(vm->isolate.interpret(std::string{source, length}));
+}
+
+bool glang_is_complete(const char* source, size_t length) {
+    return Session::isComplete(std::string{source, length});
+}
+
+bool glang_get_global(glang_vm* vm, const char* name, glang_value* value) {
+    auto global = vm->isolate.global(name);
+    if (!global.has_value()) return false;
+    *value = fromValue(*global);
+    return true;
+}
+
+void glang_set_global(glang_vm* vm, const char* name, glang_value value) {
+    Isolate::Scope scope{vm->isolate};
+    vm->isolate.setGlobal(name, toValue(value));
+}
+
+void glang_define_native(glang_vm* vm, const char* name, int arity, glang_native_fn function, void* userdata) {
+    Isolate::Scope scope{vm->isolate};
+    auto& native = vm->natives.emplace_back(new ForeignNative{vm, function, userdata});
+    vm->isolate.vm().defineNative(name, callForeign, arity, native.get());
+}
+
+void glang_runtime_error(glang_vm* vm, const char* message) {
+    vm->isolate.vm().runtimeError("{}", message);
+}
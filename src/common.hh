@@ -10,11 +10,9 @@
 using u8 = std::uint8_t;
 using u16 = std::uint16_t;
 using u32 = std::uint32_t;
+using u64 = std::uint64_t;
 using size = std::size_t;
 
-// #define DEBUG_PRINT_BYTECODE
-// #define TRACE_VM_EXECUTION
-
 enum class Result {
     Ok,
     CompileError,
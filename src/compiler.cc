@@ -2,19 +2,13 @@
 #include "ByteCode.hh"
 #include "Parser.hh"
 
-#ifdef DEBUG_PRINT_BYTECODE
-#include "debug.hh"
-#endif
-
-Compiler* g_current = nullptr;
-
-bool compile(const std::string& code, ByteCode& byteCode) {
+bool compile(const std::string& code, ByteCode& byteCode, OutputBuffer& errors) {
     Scanner scanner{code};
-    Parser parser{scanner, byteCode};
     Compiler compiler;
+    compiler.byteCode = &byteCode;
     compiler.localCount = 0;
     compiler.scopeDepth = 0;
-    g_current = &compiler;
+    Parser parser{scanner, compiler, errors};
     parser.advance();
 
     // parser.expression();
@@ -25,11 +19,6 @@ bool compile(const std::string& code, ByteCode& byteCode) {
     }
 
     parser.emitReturn();
-#ifdef DEBUG_PRINT_BYTECODE
-    if (!parser.hasError()) {
-        debug::disassembleByteCode(byteCode);
-    }
-#endif
-
+    errors.flush();
     return !parser.hasError();
 }
\ No newline at end of file
@@ -4,17 +4,33 @@
 #include "Scanner.hh"
 
 class ByteCode;
+class OutputBuffer;
+struct ObjFunction;
 
 struct Local {
     Token name;
     int depth;
 };
 
+enum class FunctionType {
+    Function,
+    Initializer,
+    Method,
+    Parallel, // the body of a 'parallel for', run by every worker
+    Script
+};
+
 struct Compiler {
+    Compiler* enclosing{};
+    ObjFunction* function{}; // nullptr while compiling the top-level script
+    FunctionType type{FunctionType::Script};
+    ByteCode* byteCode{};
+    bool generator{}; // the function yields, so calling it makes a generator
+
     Local locals[UINT8_MAX + 1];
     int localCount{};
     int scopeDepth{};
 };
 
-extern Compiler* g_current;
-bool compile(const std::string& code, ByteCode& byteCode);
+// error messages are written to 'errors'
+bool compile(const std::string& code, ByteCode& byteCode, OutputBuffer& errors);
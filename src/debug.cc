@@ -1,99 +1,264 @@
 #include "debug.hh"
 
 #include "ByteCode.hh"
+#include "object.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
 
 namespace debug {
 
-static int simpleInstr(const char* name, int offset) {
-    fmt::print("{}\n", name);
+static int simpleInstr(const char* name, int offset, Buffer& out) {
+    fmt::format_to(std::back_inserter(out), "{}\n", name);
     return offset + 1;
 }
 
-static int constantInstruction(std::string_view name, const ByteCode& code, int offset) {
+static int constantInstruction(std::string_view name, const ByteCode& code, int offset, Buffer& out) {
     auto constantOffset = toU8(code.getOpCode(offset + 1));
     auto constant = code.getConstantAtOffset(constantOffset);
-    fmt::print("{} {} [{}]\n", name, constantOffset, constant.toString());
+    fmt::format_to(std::back_inserter(out), "{} {} [{}]\n", name, constantOffset, constant.toString());
 
     return offset + 2;
 }
 
-static int byteInstruction(std::string_view name, const ByteCode& code, int offset) {
+static int byteInstruction(std::string_view name, const ByteCode& code, int offset, Buffer& out) {
     auto slot = toU8(code.getOpCode(offset + 1));
-    fmt::print("{} {}\n", name, slot);
+    fmt::format_to(std::back_inserter(out), "{} {}\n", name, slot);
     return offset + 2;
 }
 
-static int jumpInstruction(std::string_view name, int sign, const ByteCode& code, int offset) {
+static int jumpInstruction(std::string_view name, int sign, const ByteCode& code, int offset, Buffer& out) {
     auto jump = (uint16_t)(toU8(code.getOpCode(offset + 1)) << 8);
     jump |= toU8(code.getOpCode(offset + 2));
-    fmt::print("{} {} -> {}\n", name, offset, offset + 3 + sign * jump);
+    fmt::format_to(std::back_inserter(out), "{} {} -> {}\n", name, offset, offset + 3 + sign * jump);
     return offset + 3;
 }
 
+static int propertyInstruction(std::string_view name, const ByteCode& code, int offset, Buffer& out) {
+    auto constantOffset = toU8(code.getOpCode(offset + 1));
+    auto cache = (uint16_t)(toU8(code.getOpCode(offset + 2)) << 8);
+    cache |= toU8(code.getOpCode(offset + 3));
+    fmt::format_to(std::back_inserter(out), "{} {} [{}] ic {}\n", name, constantOffset, code.getConstantAtOffset(constantOffset).toString(), cache);
+    return offset + 4;
+}
+
+static int invokeInstruction(std::string_view name, const ByteCode& code, int offset, Buffer& out) {
+    auto constantOffset = toU8(code.getOpCode(offset + 1));
+    auto argCount = toU8(code.getOpCode(offset + 2));
+    auto cache = (uint16_t)(toU8(code.getOpCode(offset + 3)) << 8);
+    cache |= toU8(code.getOpCode(offset + 4));
+    fmt::format_to(std::back_inserter(out), "{} ({} args) {} [{}] ic {}\n", name, argCount, constantOffset, code.getConstantAtOffset(constantOffset).toString(), cache);
+    return offset + 5;
+}
+
+static int forInInstruction(std::string_view name, const ByteCode& code, int offset, Buffer& out) {
+    auto slot = toU8(code.getOpCode(offset + 1));
+    auto jump = (uint16_t)(toU8(code.getOpCode(offset + 2)) << 8);
+    jump |= toU8(code.getOpCode(offset + 3));
+    fmt::format_to(std::back_inserter(out), "{} slots {}-{} exit -> {}\n", name, slot, slot + 2, offset + 4 + jump);
+    return offset + 4;
+}
+
+static int rangeInstruction(std::string_view name, int sign, const ByteCode& code, int offset, Buffer& out) {
+    auto slot = toU8(code.getOpCode(offset + 1));
+    auto comparison = toU8(code.getOpCode(offset + 2)) ? "<=" : "<";
+    int length = sign > 0 ? 5 : 6;
+    auto jump = (uint16_t)(toU8(code.getOpCode(offset + length - 2)) << 8);
+    jump |= toU8(code.getOpCode(offset + length - 1));
+
+    if (sign > 0) {
+        fmt::format_to(std::back_inserter(out), "{} slot {} {} slot {} -> {}\n", name, slot, comparison, slot + 1, offset + length + jump);
+    } else {
+        auto step = code.getConstantAtOffset(toU8(code.getOpCode(offset + 3)));
+        fmt::format_to(std::back_inserter(out), "{} slot {} += {} {} slot {} -> {}\n", name, slot, step.toString(), comparison, slot + 1, offset + length - jump);
+    }
+    return offset + length;
+}
+
+static int parallelInstruction(std::string_view name, const ByteCode& code, int offset, Buffer& out) {
+    auto body = code.getConstantAtOffset(toU8(code.getOpCode(offset + 1)));
+    static const char* const reductions[] = {"", " reduce +", " reduce *"};
+    auto reduction = toU8(code.getOpCode(offset + 2));
+    fmt::format_to(std::back_inserter(out), "{} {}{}\n", name, body.toString(), reduction < 3 ? reductions[reduction] : " ?");
+    return offset + 3;
+}
+
+const char* opCodeName(OpCode code) {
+    static const char* const names[OpCodeCount] = {
+        "Return", "Constant", "Negate", "Add", "Subtract", "Multiply", "Divide",
+        "Nil", "True", "False", "Not", "Equal", "Greater", "Less",
+        "Print", "Pop", "DefineGlobal", "GetGlobal", "SetGlobal", "SetLocal", "GetLocal",
+        "JmpIfFalse", "Jmp", "Loop", "Call", "TailCall", "BuildArray", "BuildMap",
+        "IndexGet", "IndexSet", "Class", "Method", "GetProperty", "SetProperty", "Invoke",
+        "ForRangeInit", "ForRangeStep", "Yield", "ForIn", "Generator",
+        "ParallelFor"};
+    return names[toU8(code)];
+}
+
+bool Filter::parseLines(std::string_view text) {
+    auto dash = text.find('-');
+    auto first = std::string{text.substr(0, dash)};
+    auto last = dash == std::string_view::npos ? first : std::string{text.substr(dash + 1)};
+    char* end = nullptr;
+
+    firstLine = static_cast<int>(std::strtol(first.c_str(), &end, 10));
+    if (first.empty() || *end != '\0') return false;
+    lastLine = static_cast<int>(std::strtol(last.c_str(), &end, 10));
+    return !last.empty() && *end == '\0' && firstLine <= lastLine;
+}
+
+bool Filter::parseOps(std::string_view text) {
+    ops.reset();
+    while (!text.empty()) {
+        auto comma = text.find(',');
+        auto name = text.substr(0, comma);
+        int op = 0;
+        while (op < OpCodeCount && name != opCodeName(toOp(op))) ++op;
+        if (op == OpCodeCount) return false;
+        ops.set(op);
+        text = comma == std::string_view::npos ? std::string_view{} : text.substr(comma + 1);
+    }
+    return ops.any();
+}
+
 void disassembleByteCode(const ByteCode& code) {
     fmt::print("== disassembly ==\n");
 
-    for (int offset = 0; offset < code.codeSize();) {
+    for (int offset = 0; offset < static_cast<int>(code.codeSize());) {
         offset = disassembleInstruction(code, offset);
     }
 }
+
+static void disassembleChunk(const ByteCode& code, std::string_view name, const Filter& filter,
+                             std::vector<const ByteCode*>& seen, std::FILE* stream) {
+    seen.push_back(&code);
+
+    Buffer out;
+    fmt::format_to(std::back_inserter(out), "== {} ==\n", name);
+    for (int offset = 0; offset < static_cast<int>(code.codeSize());) {
+        if (filter.matches(code.getLineNumber(offset), code.getOpCode(offset))) {
+            offset = disassembleInstruction(code, offset, out);
+        } else {
+            offset += instructionLength(code.getOpCode(offset));
+        }
+    }
+    std::fwrite(out.data(), 1, out.size(), stream);
+
+    for (size i = 0; i < code.constantCount(); ++i) {
+        Value constant = code.getConstantAtOffset(static_cast<int>(i));
+        if (!object::isFunction(constant)) continue;
+
+        ObjFunction* function = object::asFunction(constant);
+        if (std::find(seen.begin(), seen.end(), &function->byteCode) != seen.end()) continue;
+        disassembleChunk(function->byteCode, object::functionName(function), filter, seen, stream);
+    }
+}
+
+void disassembleProgram(const ByteCode& script, const Filter& filter, std::FILE* stream) {
+    std::vector<const ByteCode*> seen;
+    disassembleChunk(script, "<script>", filter, seen, stream);
+}
+
 int disassembleInstruction(const ByteCode& code, int offset) {
-    fmt::print("{:03} {:04} ", code.getLineNumber(offset), offset);
+    Buffer out;
+    offset = disassembleInstruction(code, offset, out);
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    return offset;
+}
+
+int disassembleInstruction(const ByteCode& code, int offset, Buffer& out) {
+    fmt::format_to(std::back_inserter(out), "{:03} {:04} ", code.getLineNumber(offset), offset);
 
     auto instruction = code.getOpCode(offset);
 
     switch (instruction) {
     case OpCode::Return:
-        return simpleInstr("Return", offset);
+        return simpleInstr("Return", offset, out);
     case OpCode::Constant:
-        return constantInstruction("Constant", code, offset);
+        return constantInstruction("Constant", code, offset, out);
     case OpCode::Negate:
-        return simpleInstr("Negate", offset);
+        return simpleInstr("Negate", offset, out);
     case OpCode::Add:
-        return simpleInstr("Add", offset);
+        return simpleInstr("Add", offset, out);
     case OpCode::Subtract:
-        return simpleInstr("Subtract", offset);
+        return simpleInstr("Subtract", offset, out);
     case OpCode::Multiply:
-        return simpleInstr("Multiply", offset);
+        return simpleInstr("Multiply", offset, out);
     case OpCode::Divide:
-        return simpleInstr("Divide", offset);
+        return simpleInstr("Divide", offset, out);
     case OpCode::Nil:
-        return simpleInstr("Nil", offset);
+        return simpleInstr("Nil", offset, out);
     case OpCode::False:
-        return simpleInstr("False", offset);
+        return simpleInstr("False", offset, out);
     case OpCode::True:
-        return simpleInstr("True", offset);
+        return simpleInstr("True", offset, out);
     case OpCode::Not:
-        return simpleInstr("Not", offset);
+        return simpleInstr("Not", offset, out);
     case OpCode::Equal:
-        return simpleInstr("Equal", offset);
+        return simpleInstr("Equal", offset, out);
     case OpCode::Greater:
-        return simpleInstr("Greater", offset);
+        return simpleInstr("Greater", offset, out);
     case OpCode::Less:
-        return simpleInstr("Less", offset);
+        return simpleInstr("Less", offset, out);
     case OpCode::Print:
-        return simpleInstr("Print", offset);
+        return simpleInstr("Print", offset, out);
     case OpCode::Pop:
-        return simpleInstr("Pop", offset);
+        return simpleInstr("Pop", offset, out);
     case OpCode::DefineGlobal:
-        return constantInstruction("DefineGlobal", code, offset);
+        return constantInstruction("DefineGlobal", code, offset, out);
     case OpCode::GetGlobal:
-        return constantInstruction("GetGlobal", code, offset);
+        return constantInstruction("GetGlobal", code, offset, out);
     case OpCode::SetGlobal:
-        return constantInstruction("SetGlobal", code, offset);
+        return constantInstruction("SetGlobal", code, offset, out);
     case OpCode::GetLocal:
-        return byteInstruction("GetLocal", code, offset);
+        return byteInstruction("GetLocal", code, offset, out);
     case OpCode::SetLocal:
-        return byteInstruction("SetLocal", code, offset);
+        return byteInstruction("SetLocal", code, offset, out);
     case OpCode::Jmp:
-        return jumpInstruction("Jmp", 1, code, offset);
+        return jumpInstruction("Jmp", 1, code, offset, out);
     case OpCode::JmpIfFalse:
-        return jumpInstruction("JmpIfFalse", 1, code, offset);
+        return jumpInstruction("JmpIfFalse", 1, code, offset, out);
     case OpCode::Loop:
-        return jumpInstruction("Loop", -1, code, offset);
+        return jumpInstruction("Loop", -1, code, offset, out);
+    case OpCode::Call:
+        return byteInstruction("Call", code, offset, out);
+    case OpCode::TailCall:
+        return byteInstruction("TailCall", code, offset, out);
+    case OpCode::BuildArray:
+        return byteInstruction("BuildArray", code, offset, out);
+    case OpCode::BuildMap:
+        return byteInstruction("BuildMap", code, offset, out);
+    case OpCode::IndexGet:
+        return simpleInstr("IndexGet", offset, out);
+    case OpCode::IndexSet:
+        return simpleInstr("IndexSet", offset, out);
+    case OpCode::Class:
+        return constantInstruction("Class", code, offset, out);
+    case OpCode::Method:
+        return constantInstruction("Method", code, offset, out);
+    case OpCode::GetProperty:
+        return propertyInstruction("GetProperty", code, offset, out);
+    case OpCode::SetProperty:
+        return propertyInstruction("SetProperty", code, offset, out);
+    case OpCode::Invoke:
+        return invokeInstruction("Invoke", code, offset, out);
+    case OpCode::ForRangeInit:
+        return rangeInstruction("ForRangeInit", 1, code, offset, out);
+    case OpCode::ForRangeStep:
+        return rangeInstruction("ForRangeStep", -1, code, offset, out);
+    case OpCode::Yield:
+        return simpleInstr("Yield", offset, out);
+    case OpCode::ForIn:
+        return forInInstruction("ForIn", code, offset, out);
+    case OpCode::Generator:
+        return simpleInstr("Generator", offset, out);
+    case OpCode::ParallelFor:
+        return parallelInstruction("ParallelFor", code, offset, out);
 
     default:
-        fmt::print("unknown opcode\n");
+        fmt::format_to(std::back_inserter(out), "unknown opcode\n");
         return offset + 1;
     }
 
@@ -1,10 +1,37 @@
 #pragma once
 
 #include "common.hh"
+#include "instructions.hh"
+
+#include <bitset>
+#include <climits>
+#include <cstdio>
+#include <string_view>
 
 class ByteCode;
 
 namespace debug {
+using Buffer = fmt::memory_buffer;
+
+// narrows --trace and --disasm output to a line range and a set of opcodes
+struct Filter {
+    int firstLine{0};
+    int lastLine{INT_MAX};
+    std::bitset<OpCodeCount> ops{std::bitset<OpCodeCount>{}.set()};
+
+    [[nodiscard]] bool matches(int line, OpCode op) const {
+        return line >= firstLine && line <= lastLine && ops.test(toU8(op));
+    }
+    // "12" or "12-40"
+    bool parseLines(std::string_view text);
+    // comma-separated opcode names, e.g. "Call,Return"
+    bool parseOps(std::string_view text);
+};
+
 void disassembleByteCode(const ByteCode& code);
+// the script followed by every function reachable through its constants
+void disassembleProgram(const ByteCode& script, const Filter& filter, std::FILE* stream);
 int disassembleInstruction(const ByteCode& code, int offset);
-}
\ No newline at end of file
+int disassembleInstruction(const ByteCode& code, int offset, Buffer& out);
+const char* opCodeName(OpCode code);
+}
@@ -0,0 +1,123 @@
+#ifndef GLANG_H
+#define GLANG_H
+
+/* The C interface of libglang. A glang_vm is an isolate: it has its own heap
+ * and globals, shares nothing with other VMs and must be used by one thread
+ * at a time. Programs are compiled once and can be run by any number of
+ * VMs, on any threads. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* marks what libglang.so exports; everything else in it is hidden */
+#if defined(__GNUC__)
+#define GLANG_API __attribute__((visibility("default")))
+#else
+#define GLANG_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct glang_vm glang_vm;
+typedef struct glang_program glang_program;
+
+typedef enum glang_result {
+    GLANG_OK,
+    GLANG_COMPILE_ERROR,
+    GLANG_RUNTIME_ERROR
+} glang_result;
+
+typedef enum glang_type {
+    GLANG_NIL,
+    GLANG_BOOL,
+    GLANG_NUMBER,
+    GLANG_STRING,
+    GLANG_OBJECT
+} glang_type;
+
+/* Strings handed out by a VM live as long as the VM. Objects other than
+ * strings are opaque, but can be given back to the VM they came from. */
+typedef struct glang_value {
+    glang_type type;
+    union {
+        bool boolean;
+        double number;
+        struct {
+            const char* chars;
+            size_t length;
+        } string;
+        void* object;
+    } as;
+} glang_value;
+
+/* receives output in chunks, not necessarily whole lines */
+typedef void (*glang_write_fn)(const char* text, size_t length, void* userdata);
+
+/* 'args' holds 'argc' arguments; a native that fails calls
+ * glang_runtime_error() and returns false */
+typedef bool (*glang_native_fn)(glang_vm* vm, int argc, const glang_value* args,
+                                glang_value* result, void* userdata);
+
+GLANG_API glang_vm* glang_vm_new(void);
+GLANG_API void glang_vm_free(glang_vm* vm);
+
+/* where 'print' and error messages go; stdout when 'write' is NULL */
+GLANG_API void glang_vm_set_output(glang_vm* vm, glang_write_fn write, void* userdata);
+
+/* NULL on errors, which go to 'errors', or to stdout when it is NULL */
+GLANG_API glang_program* glang_compile(const char* source, size_t length, glang_write_fn errors, void* userdata);
+/* VMs that ran the program keep it alive as long as they need it */
+GLANG_API void glang_program_free(glang_program* program);
+
+GLANG_API glang_result glang_run(glang_vm* vm, const glang_program* program);
+/* compiles and runs in one go; compile errors go to the VM's output */
+GLANG_API glang_result glang_interpret(glang_vm* vm, const char* source, size_t length);
+/* false while 'source' ends inside brackets or a string: a REPL or notebook
+ * should read more input before interpreting it */
+GLANG_API bool glang_is_complete(const char* source, size_t length);
+
+/* false if the global is not defined */
+GLANG_API bool glang_get_global(glang_vm* vm, const char* name, glang_value* value);
+GLANG_API void glang_set_global(glang_vm* vm, const char* name, glang_value value);
+
+/* 'arity' -1 accepts any number of arguments */
+GLANG_API void glang_define_native(glang_vm* vm, const char* name, int arity, glang_native_fn function, void* userdata);
+GLANG_API void glang_runtime_error(glang_vm* vm, const char* message);
+
+static inline glang_value glang_nil(void) {
+    glang_value value;
+    value.type = GLANG_NIL;
+    value.as.object = NULL;
+    return value;
+}
+
+static inline glang_value glang_bool(bool boolean) {
+    glang_value value;
+    value.type = GLANG_BOOL;
+    value.as.boolean = boolean;
+    return value;
+}
+
+static inline glang_value glang_number(double number) {
+    glang_value value;
+    value.type = GLANG_NUMBER;
+    value.as.number = number;
+    return value;
+}
+
+/* the characters are copied when the value is handed to a VM */
+static inline glang_value glang_string(const char* chars, size_t length) {
+    glang_value value;
+    value.type = GLANG_STRING;
+    value.as.string.chars = chars;
+    value.as.string.length = length;
+    return value;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
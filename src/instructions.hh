@@ -27,8 +27,70 @@ enum class OpCode : std::uint8_t {
     GetLocal,
     JmpIfFalse,
     Jmp,
-    Loop
+    Loop,
+    Call,       // two bytes: Call, argument count
+    TailCall,   // two bytes: TailCall, argument count; reuses the caller's frame
+    BuildArray, // two bytes: BuildArray, element count
+    BuildMap,   // two bytes: BuildMap, key/value pair count
+    IndexGet,
+    IndexSet,
+    Class,       // two bytes: Class, name constant
+    Method,      // two bytes: Method, name constant
+    GetProperty, // four bytes: GetProperty, name constant, inline cache index (u16)
+    SetProperty, // four bytes: SetProperty, name constant, inline cache index (u16)
+    Invoke,      // five bytes: Invoke, name constant, argument count, inline cache index (u16)
+    ForRangeInit, // five bytes: ForRangeInit, counter slot, inclusive, exit offset (u16)
+    ForRangeStep, // six bytes: ForRangeStep, counter slot, inclusive, step constant, loop offset (u16)
+    Yield,        // hands the value on top to the loop iterating this generator, or lets other fibers run
+    ForIn,        // four bytes: ForIn, first of the loop's three slots, exit offset (u16)
+    Generator,    // first in a generator function: the call returns a suspended generator instead
+    ParallelFor   // three bytes: ParallelFor, body constant, Reduction; replaces the range on top with the reduced value
+};
+
+// how a 'parallel for' combines what its workers computed
+enum class Reduction : std::uint8_t {
+    None,
+    Sum,
+    Product
 };
 
 inline std::uint8_t toU8(OpCode code) { return static_cast<std::uint8_t>(code); }
 inline OpCode toOp(std::uint8_t byte) { return static_cast<OpCode>(byte); }
+
+// one past the last opcode; keep in step with the enum above
+inline constexpr int OpCodeCount = static_cast<int>(OpCode::ParallelFor) + 1;
+
+// size of a whole instruction, opcode byte included
+inline int instructionLength(OpCode code) {
+    switch (code) {
+    case OpCode::Constant:
+    case OpCode::DefineGlobal:
+    case OpCode::GetGlobal:
+    case OpCode::SetGlobal:
+    case OpCode::SetLocal:
+    case OpCode::GetLocal:
+    case OpCode::Call:
+    case OpCode::TailCall:
+    case OpCode::BuildArray:
+    case OpCode::BuildMap:
+    case OpCode::Class:
+    case OpCode::Method:
+        return 2;
+    case OpCode::JmpIfFalse:
+    case OpCode::Jmp:
+    case OpCode::Loop:
+    case OpCode::ParallelFor:
+        return 3;
+    case OpCode::GetProperty:
+    case OpCode::SetProperty:
+    case OpCode::ForIn:
+        return 4;
+    case OpCode::Invoke:
+    case OpCode::ForRangeInit:
+        return 5;
+    case OpCode::ForRangeStep:
+        return 6;
+    default:
+        return 1;
+    }
+}
@@ -1,29 +1,221 @@
 #include "log.hh"
 #include "ByteCode.hh"
 #include "debug.hh"
-#include "Vm.hh"
+#include "Isolate.hh"
+#include "Profiler.hh"
+#include "Sampler.hh"
+#include "Tracer.hh"
+#include "Statistics.hh"
+#include "Server.hh"
 #include "repl.hh"
 #include "utils.hh"
 
-void runFile(const char* filename) {
-    auto sourceCode = utils::readTextFile(filename);
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct Options {
+    const char* path{};
+    bool profile{};
+    const char* foldedPath{}; // --profile=<file> also writes folded stacks there
+    bool sample{};
+    const char* samplePath{}; // --sample=<file> writes the sampled stacks there
+    bool trace{};
+    const char* tracePath{}; // --trace=<file> writes the trace there instead of stderr
+    bool disassemble{};
+    debug::Filter filter; // --lines and --ops, applied to --trace and --disasm
+    bool stats{};
+    const char* statsPath{}; // --stats=<file> also writes them there as JSON
+    std::vector<std::string> arguments; // whatever follows the path, for the script
+    const char* servePath{};   // --serve <socket>: run as a server
+    int workers{};             // --workers=<n>, for --serve; 0 is one per core
+    const char* connectPath{}; // --connect <socket>: submit the script to a server
+    const char* source{};      // --eval <source>: run this instead of a file
+};
+
+// "--name value" or "--name=value"
+static bool matchValue(int argc, char** argv, int& i, const char* name, const char*& value) {
+    size_t length = std::strlen(name);
+    if (std::strncmp(argv[i], name, length) != 0) return false;
+    if (argv[i][length] == '=') {
+        value = argv[i] + length + 1;
+        return true;
+    }
+    if (argv[i][length] != '\0' || i + 1 >= argc) return false;
+    value = argv[++i];
+    return true;
+}
+
+static bool parseArgs(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (options.path != nullptr || options.source != nullptr) {
+            options.arguments.emplace_back(arg);
+        } else if (matchValue(argc, argv, i, "--serve", options.servePath) ||
+                   matchValue(argc, argv, i, "--connect", options.connectPath) ||
+                   matchValue(argc, argv, i, "--eval", options.source)) {
+            continue;
+        } else if (std::strncmp(arg, "--workers=", 10) == 0) {
+            options.workers = std::atoi(arg + 10);
+        } else if (std::strcmp(arg, "--profile") == 0) {
+            options.profile = true;
+        } else if (std::strncmp(arg, "--profile=", 10) == 0) {
+            options.profile = true;
+            options.foldedPath = arg + 10;
+        } else if (std::strcmp(arg, "--sample") == 0) {
+            options.sample = true;
+        } else if (std::strncmp(arg, "--sample=", 9) == 0) {
+            options.sample = true;
+            options.samplePath = arg + 9;
+        } else if (std::strcmp(arg, "--trace") == 0) {
+            options.trace = true;
+        } else if (std::strncmp(arg, "--trace=", 8) == 0) {
+            options.trace = true;
+            options.tracePath = arg + 8;
+        } else if (std::strcmp(arg, "--disasm") == 0) {
+            options.disassemble = true;
+        } else if (std::strcmp(arg, "--stats") == 0) {
+            options.stats = true;
+        } else if (std::strncmp(arg, "--stats=", 8) == 0) {
+            options.stats = true;
+            options.statsPath = arg + 8;
+        } else if (std::strncmp(arg, "--lines=", 8) == 0) {
+            if (!options.filter.parseLines(arg + 8)) return false;
+        } else if (std::strncmp(arg, "--ops=", 6) == 0) {
+            if (!options.filter.parseOps(arg + 6)) return false;
+        } else if (arg[0] == '-') {
+            return false;
+        } else {
+            options.path = arg;
+        }
+    }
+    return true;
+}
+
+// hands the script to a server instead of running it here
+static int submit(const Options& options) {
+    Job job;
+    job.inlineSource = options.source != nullptr;
+    job.arguments = options.arguments;
+    if (job.inlineSource) {
+        job.script = options.source;
+    } else {
+        // the server resolves paths from its own working directory
+        char resolved[PATH_MAX];
+        job.script = realpath(options.path, resolved) != nullptr ? resolved : options.path;
+    }
+    return Server::submit(options.connectPath, job);
+}
+
+void runFile(const Options& options) {
+    std::optional<Statistics> stats;
+    if (options.stats) {
+        stats.emplace().begin(Statistics::Read);
+    }
+
+    auto sourceCode = options.source != nullptr ? std::string{options.source} : utils::readTextFile(options.path);
     sourceCode.push_back('\0');
-    auto result = interpret(sourceCode);
+
+    if (stats) {
+        stats->end(Statistics::Read);
+    }
+
+    std::optional<Profiler> profiler;
+    std::optional<Sampler> sampler;
+    RunOptions runOptions;
+    if (options.profile) {
+        runOptions.profiler = &profiler.emplace();
+    }
+    if (options.sample) {
+        runOptions.sampler = &sampler.emplace();
+    }
+    if (options.disassemble) {
+        runOptions.disassemble = &options.filter;
+    }
+    if (stats) {
+        runOptions.stats = &*stats;
+    }
+
+    std::FILE* traceFile = stderr;
+    if (options.tracePath != nullptr) {
+        traceFile = std::fopen(options.tracePath, "w");
+        if (traceFile == nullptr) {
+            fmt::print("Failed to open file: {}", options.tracePath);
+            std::exit(74);
+        }
+    }
+    std::optional<Tracer> tracer;
+    if (options.trace) {
+        runOptions.tracer = &tracer.emplace(options.filter, traceFile);
+    }
+
+    // the reports name the script's functions, so its heap must outlive them
+    Isolate isolate;
+    isolate.setArguments(options.arguments);
+    auto result = isolate.interpret(sourceCode, runOptions);
+
+    tracer.reset();
+    if (traceFile != stderr) std::fclose(traceFile);
+
+    if (profiler) {
+        std::fflush(stdout);
+        profiler->report(stderr);
+        if (options.foldedPath != nullptr && !profiler->writeFolded(options.foldedPath)) {
+            fmt::print(stderr, "Failed to write folded stacks to {}\n", options.foldedPath);
+        }
+    }
+    if (sampler) {
+        std::fflush(stdout);
+        sampler->report(stderr);
+        if (options.samplePath != nullptr && !sampler->writeFolded(options.samplePath)) {
+            fmt::print(stderr, "Failed to write folded stacks to {}\n", options.samplePath);
+        }
+    }
+
+    if (stats) {
+        std::fflush(stdout);
+        stats->recordAllocations();
+        stats->report(stderr);
+        if (options.statsPath != nullptr && !stats->writeJson(options.statsPath)) {
+            fmt::print(stderr, "Failed to write stats to {}\n", options.statsPath);
+        }
+    }
 
     if (result == Result::CompileError) std::exit(65);
     if (result == Result::RuntimeError) std::exit(70);
 }
 
 int main(int argc, char** argv) {
+    Options options;
 
-    if (argc == 1) {
+    if (!parseArgs(argc, argv, options)) {
+        fmt::print("Usage: glang [--profile[=folded-file]] [--sample[=folded-file]] [--trace[=file]] [--disasm]\n"
+                   "             [--stats[=json-file]] [--lines=first[-last]] [--ops=Op,Op...] [path | --eval source] [args...]\n"
+                   "       glang --serve socket [--workers=n]\n"
+                   "       glang --connect socket (path | --eval source) [args...]");
+        return 64;
+    }
+
+    if (options.servePath != nullptr) {
+        Server server{options.servePath, options.workers};
+        return server.run() ? 0 : 74;
+    }
+    if (options.connectPath != nullptr) {
+        if (options.path == nullptr && options.source == nullptr) {
+            fmt::print("--connect needs a script path or --eval\n");
+            return 64;
+        }
+        return submit(options);
+    }
+
+    if (options.path == nullptr && options.source == nullptr) {
         repl();
-    } else if (argc == 2) {
-        runFile(argv[1]);
     } else {
-        fmt::print("Usage: glang [path]");
-        return 64;
+        runFile(options);
     }
 
     return 0;
-}
\ No newline at end of file
+}
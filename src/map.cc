@@ -0,0 +1,142 @@
+#include "map.hh"
+#include "memory.hh"
+
+#include <algorithm>
+#include <cstring>
+
+namespace map {
+
+static constexpr std::int32_t EmptySlot = -1;
+
+static u32 mix(std::uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return static_cast<u32>(bits);
+}
+
+u32 hashValue(Value key) {
+    switch (key.type) {
+    case ValNumber: {
+        double number = key.asNumber();
+        if (number == 0) number = 0; // -0.0 and 0.0 are the same key
+        std::uint64_t bits;
+        std::memcpy(&bits, &number, sizeof(bits));
+        return mix(bits);
+    }
+    case ValBool:
+        return key.asBool() ? 0x9e3779b9u : 0x7f4a7c15u;
+    case ValNil:
+        return 0;
+    case ValObj:
+        if (object::isString(key)) return object::asString(key)->hash;
+        return mix(reinterpret_cast<std::uintptr_t>(key.asObj()));
+    }
+    return 0;
+}
+
+static std::int32_t* findSlot(ObjMap* map, Value key, u32 hash) {
+    u32 mask = map->indexCapacity - 1;
+    for (u32 i = hash & mask;; i = (i + 1) & mask) {
+        std::int32_t* slot = &map->index[i];
+        if (*slot == EmptySlot) return slot;
+
+        MapEntry* entry = &map->entries[*slot];
+        if (entry->hash == hash && !entry->deleted && Value::equal(entry->key, key)) {
+            return slot;
+        }
+    }
+}
+
+// rebuilds the index, dropping deleted entries from the dense array
+static void rebuild(ObjMap* map) {
+    int indexCapacity = map->indexCapacity == 0 ? 8 : map->indexCapacity;
+    while ((map->count + 1) * 2 > indexCapacity) {
+        indexCapacity *= 2;
+    }
+    int entryCapacity = indexCapacity / 4 * 3;
+
+    auto entries = memory::allocate<MapEntry>(entryCapacity);
+    int live = 0;
+    for (int i = 0; i < map->entryCount; ++i) {
+        if (!map->entries[i].deleted) entries[live++] = map->entries[i];
+    }
+    memory::free(map->entries, sizeof(MapEntry) * map->entryCapacity);
+    memory::free(map->index, sizeof(std::int32_t) * map->indexCapacity);
+
+    map->entries = entries;
+    map->entryCount = live;
+    map->entryCapacity = entryCapacity;
+    map->index = memory::allocate<std::int32_t>(indexCapacity);
+    map->indexCapacity = indexCapacity;
+    std::fill(map->index, map->index + indexCapacity, EmptySlot);
+
+    u32 mask = indexCapacity - 1;
+    for (int i = 0; i < live; ++i) {
+        u32 slot = entries[i].hash & mask;
+        while (map->index[slot] != EmptySlot) {
+            slot = (slot + 1) & mask;
+        }
+        map->index[slot] = i;
+    }
+}
+
+MapEntry* find(ObjMap* map, Value key) {
+    if (map->count == 0) return nullptr;
+
+    std::int32_t* slot = findSlot(map, key, hashValue(key));
+    return *slot == EmptySlot ? nullptr : &map->entries[*slot];
+}
+
+bool set(ObjMap* map, Value key, Value value) {
+    u32 hash = hashValue(key);
+    if (map->indexCapacity > 0) {
+        std::int32_t* slot = findSlot(map, key, hash);
+        if (*slot != EmptySlot) {
+            map->entries[*slot].value = value;
+            return false;
+        }
+    }
+
+    if (map->entryCount == map->entryCapacity) {
+        rebuild(map);
+    }
+
+    std::int32_t* slot = findSlot(map, key, hash);
+    *slot = map->entryCount;
+    map->entries[map->entryCount++] = MapEntry{.key = key, .value = value, .hash = hash, .deleted = false};
+    map->count++;
+    return true;
+}
+
+// the entry stays in place as a tombstone until the next rebuild, which
+// keeps the probe chains through it intact
+bool remove(ObjMap* map, Value key) {
+    MapEntry* entry = find(map, key);
+    if (entry == nullptr) return false;
+
+    entry->deleted = true;
+    entry->key = Value::createNil();
+    entry->value = Value::createNil();
+    map->count--;
+    return true;
+}
+}
+
+namespace object {
+std::string mapToString(ObjMap* map) {
+    std::string result = "{";
+    bool first = true;
+    for (int i = 0; i < map->entryCount; ++i) {
+        MapEntry* entry = &map->entries[i];
+        if (entry->deleted) continue;
+        if (!first) result += ", ";
+        first = false;
+        result += entry->key.toString();
+        result += ": ";
+        result += entry->value.toString();
+    }
+    result += "}";
+    return result;
+}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "common.hh"
+#include "object.hh"
+
+namespace map {
+// numbers hash by bit pattern, strings by their cached hash and other
+// objects by identity
+u32 hashValue(Value key);
+
+// returns nullptr if 'key' is absent
+MapEntry* find(ObjMap* map, Value key);
+// returns true if the key is new
+bool set(ObjMap* map, Value key, Value value);
+// returns true if the key was present
+bool remove(ObjMap* map, Value key);
+
+inline Value get(ObjMap* map, Value key) {
+    MapEntry* entry = find(map, key);
+    return entry != nullptr ? entry->value : Value::createNil();
+}
+}
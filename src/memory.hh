@@ -6,7 +6,28 @@
 
 namespace memory {
 
+// bookkeeping for every block that goes through reallocate(), per thread
+struct Stats {
+    u64 allocations;    // blocks created
+    u64 bytesAllocated; // sum of all growth
+    u64 bytesFreed;     // sum of all shrinking
+    u64 heapSize;       // live bytes
+    u64 peakHeapSize;
+};
+
+inline thread_local Stats g_stats{};
+
 inline void* reallocate(void* ptr, size oldSize, size newSize) {
+    if (newSize >= oldSize) {
+        g_stats.bytesAllocated += newSize - oldSize;
+        g_stats.heapSize += newSize - oldSize;
+        if (g_stats.heapSize > g_stats.peakHeapSize) g_stats.peakHeapSize = g_stats.heapSize;
+    } else {
+        g_stats.bytesFreed += oldSize - newSize;
+        g_stats.heapSize -= oldSize - newSize;
+    }
+    if (ptr == nullptr && newSize != 0) ++g_stats.allocations;
+
     if (newSize == 0) {
         std::free(ptr);
         return nullptr;
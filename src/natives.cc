@@ -0,0 +1,271 @@
+#include "natives.hh"
+#include "Vm.hh"
+#include "object.hh"
+#include "array.hh"
+#include "map.hh"
+
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace natives {
+
+static bool isInteger(Value value) {
+    return value.isNumber() && std::trunc(value.asNumber()) == value.asNumber();
+}
+
+static bool clockNative(GlangVm&, int, Value* args) {
+    using namespace std::chrono;
+    auto now = steady_clock::now().time_since_epoch();
+    args[-1] = Value::createNumber(duration<double>(now).count());
+    return true;
+}
+
+static bool lenNative(GlangVm& vm, int, Value* args) {
+    if (object::isString(args[0])) {
+        args[-1] = Value::createNumber(object::asString(args[0])->length);
+    } else if (object::isArray(args[0])) {
+        args[-1] = Value::createNumber(object::asArray(args[0])->count);
+    } else if (object::isMap(args[0])) {
+        args[-1] = Value::createNumber(object::asMap(args[0])->count);
+    } else {
+        vm.runtimeError("len() expects a string, an array or a map.");
+        return false;
+    }
+    return true;
+}
+
+static bool pushNative(GlangVm& vm, int, Value* args) {
+    if (!object::isArray(args[0])) {
+        vm.runtimeError("push() expects an array.");
+        return false;
+    }
+
+    ObjArray* array = object::asArray(args[0]);
+    if (!array::writable(array)) {
+        vm.runtimeError("push() can't modify a global array in a parallel loop.");
+        return false;
+    }
+    array::push(array, args[1]);
+    args[-1] = Value::createNumber(array->count);
+    return true;
+}
+
+static bool popNative(GlangVm& vm, int, Value* args) {
+    if (!object::isArray(args[0])) {
+        vm.runtimeError("pop() expects an array.");
+        return false;
+    }
+
+    ObjArray* array = object::asArray(args[0]);
+    if (!array::writable(array)) {
+        vm.runtimeError("pop() can't modify a global array in a parallel loop.");
+        return false;
+    }
+    if (array->count == 0) {
+        vm.runtimeError("pop() from an empty array.");
+        return false;
+    }
+
+    args[-1] = array::get(array, --array->count);
+    return true;
+}
+
+static bool substrNative(GlangVm& vm, int, Value* args) {
+    if (!object::isString(args[0]) || !isInteger(args[1]) || !isInteger(args[2])) {
+        vm.runtimeError("substr() expects a string, a start index and a length.");
+        return false;
+    }
+
+    ObjString* string = object::asString(args[0]);
+    double start = args[1].asNumber();
+    double length = args[2].asNumber();
+    if (start < 0 || length < 0 || start + length > string->length) {
+        vm.runtimeError("substr() range [{}, {}) is out of bounds for a string of length {}.",
+                        start, start + length, string->length);
+        return false;
+    }
+
+    args[-1] = Value::createObj(ObjFactory::copyString(string->chars + static_cast<int>(start), static_cast<int>(length)));
+    return true;
+}
+
+static bool toNumberNative(GlangVm&, int, Value* args) {
+    Value value = args[0];
+    if (value.isNumber()) {
+        args[-1] = value;
+        return true;
+    }
+
+    // decimal only, as the whole string: no whitespace, hex, inf or nan
+    args[-1] = Value::createNil();
+    if (object::isString(value)) {
+        ObjString* string = object::asString(value);
+        const char* end = string->chars + string->length;
+        double number;
+        auto [parsed, error] = std::from_chars(string->chars, end, number, std::chars_format::general);
+        if (error == std::errc{} && parsed == end && std::isfinite(number)) {
+            args[-1] = Value::createNumber(number);
+        }
+    }
+    return true;
+}
+
+static bool toStringNative(GlangVm&, int, Value* args) {
+    Value value = args[0];
+    if (object::isString(value)) {
+        args[-1] = value;
+        return true;
+    }
+
+    auto string = value.toString();
+    args[-1] = Value::createObj(ObjFactory::copyString(string.data(), static_cast<int>(string.size())));
+    return true;
+}
+
+static ObjMap* mapArgument(GlangVm& vm, Value value, const char* name) {
+    if (!object::isMap(value)) {
+        vm.runtimeError("{}() expects a map.", name);
+        return nullptr;
+    }
+    return object::asMap(value);
+}
+
+// get(map, key) or get(map, key, default)
+static bool getNative(GlangVm& vm, int argCount, Value* args) {
+    if (argCount != 2 && argCount != 3) {
+        vm.runtimeError("Expected 2 or 3 arguments but got {}.", argCount);
+        return false;
+    }
+    ObjMap* map = mapArgument(vm, args[0], "get");
+    if (map == nullptr) return false;
+
+    MapEntry* entry = map::find(map, args[1]);
+    if (entry != nullptr) {
+        args[-1] = entry->value;
+    } else {
+        args[-1] = argCount == 3 ? args[2] : Value::createNil();
+    }
+    return true;
+}
+
+static bool setNative(GlangVm& vm, int, Value* args) {
+    ObjMap* map = mapArgument(vm, args[0], "set");
+    if (map == nullptr) return false;
+    if (map->readOnly) {
+        vm.runtimeError("set() can't modify a global map in a parallel loop.");
+        return false;
+    }
+
+    map::set(map, args[1], args[2]);
+    args[-1] = args[2];
+    return true;
+}
+
+static bool hasNative(GlangVm& vm, int, Value* args) {
+    ObjMap* map = mapArgument(vm, args[0], "has");
+    if (map == nullptr) return false;
+
+    args[-1] = Value::createBool(map::find(map, args[1]) != nullptr);
+    return true;
+}
+
+static bool deleteNative(GlangVm& vm, int, Value* args) {
+    ObjMap* map = mapArgument(vm, args[0], "delete");
+    if (map == nullptr) return false;
+    if (map->readOnly) {
+        vm.runtimeError("delete() can't modify a global map in a parallel loop.");
+        return false;
+    }
+
+    args[-1] = Value::createBool(map::remove(map, args[1]));
+    return true;
+}
+
+// keys(map) and values(map) return arrays in insertion order
+template <bool Keys>
+static bool entriesNative(GlangVm& vm, Value* args, const char* name) {
+    ObjMap* map = mapArgument(vm, args[0], name);
+    if (map == nullptr) return false;
+
+    ObjArray* result = ObjFactory::newArray(map->count);
+    for (int i = 0; i < map->entryCount; ++i) {
+        MapEntry* entry = &map->entries[i];
+        if (!entry->deleted) array::push(result, Keys ? entry->key : entry->value);
+    }
+    args[-1] = Value::createObj(result);
+    return true;
+}
+
+static bool keysNative(GlangVm& vm, int, Value* args) {
+    return entriesNative<true>(vm, args, "keys");
+}
+
+static bool valuesNative(GlangVm& vm, int, Value* args) {
+    return entriesNative<false>(vm, args, "values");
+}
+
+static bool spawnNative(GlangVm& vm, int argCount, Value* args) {
+    if (argCount == 0) {
+        vm.runtimeError("spawn() expects a function and its arguments.");
+        return false;
+    }
+
+    ObjFiber* fiber = vm.spawn(args[0], argCount - 1, args + 1);
+    if (fiber == nullptr) return false;
+    args[-1] = Value::createObj(fiber);
+    return true;
+}
+
+static bool joinNative(GlangVm& vm, int, Value* args) {
+    if (!object::isFiber(args[0])) {
+        vm.runtimeError("join() expects a fiber.");
+        return false;
+    }
+    return vm.join(object::asFiber(args[0]), &args[-1]);
+}
+
+// range(end), range(start, end) or range(start, end, step)
+static bool rangeNative(GlangVm& vm, int argCount, Value* args) {
+    bool numbers = argCount >= 1 && argCount <= 3;
+    for (int i = 0; i < argCount && numbers; ++i) numbers = args[i].isNumber();
+    if (!numbers) {
+        vm.runtimeError("range() expects an end, or a start, an end and optionally a step.");
+        return false;
+    }
+
+    double start = argCount == 1 ? 0 : args[0].asNumber();
+    double end = argCount == 1 ? args[0].asNumber() : args[1].asNumber();
+    double step = argCount == 3 ? args[2].asNumber() : 1;
+    if (step == 0) {
+        vm.runtimeError("range() step must not be zero.");
+        return false;
+    }
+
+    args[-1] = Value::createObj(ObjFactory::newRange(start, end, step));
+    return true;
+}
+
+void defineStandard(GlangVm& vm) {
+    vm.defineNative("clock", clockNative, 0);
+    vm.defineNative("len", lenNative, 1);
+    vm.defineNative("substr", substrNative, 3);
+    vm.defineNative("toNumber", toNumberNative, 1);
+    vm.defineNative("toString", toStringNative, 1);
+    vm.defineNative("push", pushNative, 2);
+    vm.defineNative("pop", popNative, 1);
+    vm.defineNative("get", getNative, -1);
+    vm.defineNative("set", setNative, 3);
+    vm.defineNative("has", hasNative, 2);
+    vm.defineNative("delete", deleteNative, 2);
+    vm.defineNative("keys", keysNative, 1);
+    vm.defineNative("values", valuesNative, 1);
+    vm.defineNative("spawn", spawnNative, -1);
+    vm.defineNative("join", joinNative, 1);
+    vm.defineNative("range", rangeNative, -1);
+    defineArrayOps(vm);
+    defineChannels(vm);
+    defineIo(vm);
+}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "common.hh"
+
+class GlangVm;
+
+namespace natives {
+// registers clock, len, substr, toNumber, toString, the array natives push
+// and pop, the map natives get, set, has, delete, keys and values, the
+// fiber natives spawn and join and the iterable range as globals of 'vm',
+// followed by the bulk array builtins, the channels and the I/O natives
+void defineStandard(GlangVm& vm);
+// registers the bulk array builtins sum, min, max, dot, add, mul, fill and map
+void defineArrayOps(GlangVm& vm);
+// registers channel, send, recv, try_recv and select
+void defineChannels(GlangVm& vm);
+// registers readFile, writeFile, readLines, readCommand and commandLines,
+// which park the calling fiber while their I/O is in flight
+void defineIo(GlangVm& vm);
+}
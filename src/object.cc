@@ -1,11 +1,29 @@
 #include "object.hh"
 #include "memory.hh"
+#include "Heap.hh"
+#include "Vm.hh"
+#include "Channel.hh"
 
-HashTable ObjFactory::strings_;
+#include <csignal>
+#include <new>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+thread_local ObjFactory::Stats ObjFactory::stats_{};
+
+HashTable& ObjFactory::get() {
+    return Heap::current().strings_;
+}
 
 Obj* ObjFactory::allocateObject(size_t size, ObjType type) {
+    Heap& heap = Heap::current();
     Obj* object = (Obj*)memory::reallocate(nullptr, 0, size);
     object->type = type;
+    object->next = heap.objects_;
+    heap.objects_ = object;
+    ++stats_.objects[type];
+    stats_.bytes[type] += size;
     return object;
 }
 
@@ -15,8 +33,10 @@ ObjString* ObjFactory::allocateString(char* chars, int length, u32 hash) {
     string->length = length;
     string->chars = chars;
     string->hash = hash;
+    string->shared = nullptr;
+    stats_.bytes[OBJ_STRING] += length + 1;
 
-    strings_.set(string, Value::createNil());
+    get().set(string, Value::createNil());
 
     return string;
 }
@@ -24,10 +44,12 @@ ObjString* ObjFactory::allocateString(char* chars, int length, u32 hash) {
 ObjString* ObjFactory::copyString(const char* chars, int length) {
 
     u32 hash = hashString(chars, length);
-    ObjString* interned = strings_.findString(chars, length, hash);
+    ObjString* interned = get().findString(chars, length, hash);
     if (interned != nullptr) {
+        ++stats_.internHits;
         return interned;
     }
+    ++stats_.internMisses;
 
     char* heapChars = memory::allocate<char>(length + 1);
     std::memcpy(heapChars, chars, length);
@@ -38,12 +60,293 @@ ObjString* ObjFactory::copyString(const char* chars, int length) {
 
 ObjString* ObjFactory::takeString(char* chars, int length) {
     u32 hash = hashString(chars, length);
-    ObjString* interned = strings_.findString(chars, length, hash);
+    ObjString* interned = get().findString(chars, length, hash);
 
     if (interned != nullptr) {
+        ++stats_.internHits;
         memory::free(chars, length + 1);
         return interned;
     }
+    ++stats_.internMisses;
 
     return allocateString(chars, length, hash);
 }
+
+ObjString* ObjFactory::shareString(SharedString* shared) {
+    ObjString* interned = get().findString(shared->chars(), shared->length(), shared->hash());
+    if (interned != nullptr) {
+        ++stats_.internHits;
+        return interned;
+    }
+    ++stats_.internMisses;
+
+    shared->retain();
+    ObjString* string = allocateString(shared->chars(), shared->length(), shared->hash());
+    string->shared = shared;
+    return string;
+}
+
+ObjFunction* ObjFactory::newFunction() {
+    auto function = allocateObj<ObjFunction>(OBJ_FUNCTION);
+
+    function->arity = 0;
+    function->name = nullptr;
+    new (&function->byteCode) ByteCode();
+
+    return function;
+}
+
+ObjNative* ObjFactory::newNative(NativeFn function, int arity, ObjString* name, void* data) {
+    auto native = allocateObj<ObjNative>(OBJ_NATIVE);
+
+    native->function = function;
+    native->arity = arity;
+    native->name = name;
+    native->data = data;
+
+    return native;
+}
+
+ObjArray* ObjFactory::newArray(int capacity) {
+    auto array = allocateObj<ObjArray>(OBJ_ARRAY);
+
+    array->packed = true;
+    array->readOnly = false;
+    array->lent = false;
+    array->count = 0;
+    array->capacity = capacity;
+    array->numbers = capacity > 0 ? memory::allocate<double>(capacity) : nullptr;
+
+    return array;
+}
+
+ObjMap* ObjFactory::newMap() {
+    auto map = allocateObj<ObjMap>(OBJ_MAP);
+
+    map->count = 0;
+    map->entryCount = 0;
+    map->entryCapacity = 0;
+    map->entries = nullptr;
+    map->indexCapacity = 0;
+    map->index = nullptr;
+    map->readOnly = false;
+
+    return map;
+}
+
+ObjClass* ObjFactory::newClass(ObjString* name) {
+    auto klass = allocateObj<ObjClass>(OBJ_CLASS);
+
+    klass->name = name;
+    new (&klass->methods) HashTable();
+    klass->initializer = nullptr;
+    klass->rootShape = newShape(klass);
+
+    return klass;
+}
+
+ObjShape* ObjFactory::newShape(ObjClass* klass) {
+    auto shape = allocateObj<ObjShape>(OBJ_SHAPE);
+
+    shape->klass = klass;
+    new (&shape->keys) std::vector<ObjString*>();
+    new (&shape->transitions) std::vector<std::pair<ObjString*, ObjShape*>>();
+
+    return shape;
+}
+
+ObjInstance* ObjFactory::newInstance(ObjClass* klass) {
+    auto instance = allocateObj<ObjInstance>(OBJ_INSTANCE);
+
+    instance->klass = klass;
+    instance->shape = klass->rootShape;
+    instance->capacity = 0;
+    instance->fields = nullptr;
+
+    return instance;
+}
+
+ObjBoundMethod* ObjFactory::newBoundMethod(Value receiver, ObjFunction* method) {
+    auto bound = allocateObj<ObjBoundMethod>(OBJ_BOUND_METHOD);
+
+    bound->receiver = receiver;
+    bound->method = method;
+
+    return bound;
+}
+
+ObjFiber* ObjFactory::newFiber() {
+    auto fiber = allocateObj<ObjFiber>(OBJ_FIBER);
+
+    fiber->state = FiberState::Ready;
+    fiber->frameCount = 0;
+    fiber->frameCapacity = 0;
+    fiber->frames = nullptr;
+    fiber->stackCapacity = 0;
+    fiber->stack = nullptr;
+    fiber->stackTop = nullptr;
+    fiber->result = Value::createNil();
+    fiber->pending = false;
+    fiber->next = nullptr;
+    fiber->waiters = nullptr;
+    fiber->resumer = nullptr;
+    fiber->wait = nullptr;
+    fiber->parkedAt = 0;
+
+    return fiber;
+}
+
+ObjRange* ObjFactory::newRange(double start, double end, double step) {
+    auto range = allocateObj<ObjRange>(OBJ_RANGE);
+
+    range->start = start;
+    range->end = end;
+    range->step = step;
+
+    return range;
+}
+
+ObjChannel* ObjFactory::newChannel(std::shared_ptr<Channel> channel) {
+    auto object = allocateObj<ObjChannel>(OBJ_CHANNEL);
+
+    new (&object->channel) std::shared_ptr<Channel>{std::move(channel)};
+    Heap::current().holdChannel(object->channel.get());
+
+    return object;
+}
+
+ObjLines* ObjFactory::newLines(int fd, int pid) {
+    auto lines = allocateObj<ObjLines>(OBJ_LINES);
+
+    lines->fd = fd;
+    lines->pid = pid;
+    lines->buffer = nullptr;
+    lines->capacity = 0;
+    lines->start = 0;
+    lines->end = 0;
+    lines->read = nullptr;
+
+    return lines;
+}
+
+void ObjFactory::freeObject(Obj* object) {
+    switch (object->type) {
+    case OBJ_STRING: {
+        auto string = (ObjString*)object;
+        // a string received from another isolate has no characters of its own
+        if (string->shared == nullptr || string->chars != string->shared->chars()) {
+            memory::free(string->chars, string->length + 1);
+        }
+        if (string->shared != nullptr) string->shared->release();
+        memory::free(string, sizeof(ObjString));
+        break;
+    }
+    case OBJ_FUNCTION: {
+        auto function = (ObjFunction*)object;
+        function->byteCode.~ByteCode();
+        memory::free(function, sizeof(ObjFunction));
+        break;
+    }
+    case OBJ_NATIVE:
+        memory::free(object, sizeof(ObjNative));
+        break;
+    case OBJ_ARRAY: {
+        auto array = (ObjArray*)object;
+        if (array->packed) {
+            memory::free(array->numbers, sizeof(double) * array->capacity);
+        } else {
+            memory::free(array->values, sizeof(Value) * array->capacity);
+        }
+        memory::free(array, sizeof(ObjArray));
+        break;
+    }
+    case OBJ_MAP: {
+        auto map = (ObjMap*)object;
+        memory::free(map->entries, sizeof(MapEntry) * map->entryCapacity);
+        memory::free(map->index, sizeof(std::int32_t) * map->indexCapacity);
+        memory::free(map, sizeof(ObjMap));
+        break;
+    }
+    case OBJ_CLASS: {
+        auto klass = (ObjClass*)object;
+        klass->methods.~HashTable();
+        memory::free(klass, sizeof(ObjClass));
+        break;
+    }
+    case OBJ_SHAPE: {
+        auto shape = (ObjShape*)object;
+        shape->keys.~vector();
+        shape->transitions.~vector();
+        memory::free(shape, sizeof(ObjShape));
+        break;
+    }
+    case OBJ_INSTANCE: {
+        auto instance = (ObjInstance*)object;
+        memory::free(instance->fields, sizeof(Value) * instance->capacity);
+        memory::free(instance, sizeof(ObjInstance));
+        break;
+    }
+    case OBJ_BOUND_METHOD:
+        memory::free(object, sizeof(ObjBoundMethod));
+        break;
+    case OBJ_FIBER: {
+        // a fiber that never finished, because its script failed, still has its stacks
+        auto fiber = (ObjFiber*)object;
+        memory::free(fiber->frames, sizeof(CallFrame) * fiber->frameCapacity);
+        memory::free(fiber->stack, sizeof(Value) * fiber->stackCapacity);
+        memory::free(fiber, sizeof(ObjFiber));
+        break;
+    }
+    case OBJ_RANGE:
+        memory::free(object, sizeof(ObjRange));
+        break;
+    case OBJ_LINES: {
+        auto lines = (ObjLines*)object;
+        // a command whose output was not read to the end is stopped
+        if (lines->fd >= 0) ::close(lines->fd);
+        if (lines->fd >= 0 && lines->pid > 0) ::kill(lines->pid, SIGTERM);
+        if (lines->pid > 0) ::waitpid(lines->pid, nullptr, 0);
+        memory::free(lines->buffer, lines->capacity);
+        memory::free(lines, sizeof(ObjLines));
+        break;
+    }
+    case OBJ_CHANNEL: {
+        auto channel = (ObjChannel*)object;
+        channel->channel.~shared_ptr();
+        memory::free(channel, sizeof(ObjChannel));
+        break;
+    }
+    }
+}
+
+namespace object {
+const char* kindName(Value value) {
+    switch (objType(value)) {
+    case OBJ_STRING:
+        return "string";
+    case OBJ_FUNCTION:
+    case OBJ_NATIVE:
+        return "function";
+    case OBJ_ARRAY:
+        return "array";
+    case OBJ_MAP:
+        return "map";
+    case OBJ_CLASS:
+        return "class";
+    case OBJ_BOUND_METHOD:
+        return "method";
+    case OBJ_FIBER:
+        return "fiber";
+    case OBJ_RANGE:
+        return "range";
+    case OBJ_LINES:
+        return "file";
+    case OBJ_CHANNEL:
+        return "channel";
+    case OBJ_SHAPE:
+    case OBJ_INSTANCE:
+        break;
+    }
+    return "instance";
+}
+}
@@ -4,13 +4,41 @@
 #include "Value.hh"
 #include "memory.hh"
 #include "HashTable.hh"
+#include "ByteCode.hh"
+
+#include <cstdio>
+#include <memory>
+#include <utility>
+#include <vector>
 
 enum ObjType {
-    OBJ_STRING
+    OBJ_STRING,
+    OBJ_FUNCTION,
+    OBJ_NATIVE,
+    OBJ_ARRAY,
+    OBJ_MAP,
+    OBJ_CLASS,
+    OBJ_SHAPE,
+    OBJ_INSTANCE,
+    OBJ_BOUND_METHOD,
+    OBJ_FIBER,
+    OBJ_RANGE,
+    OBJ_LINES,
+    OBJ_CHANNEL
 };
 
+inline constexpr int ObjTypeCount = OBJ_CHANNEL + 1;
+
+class GlangVm;
+class Channel;
+class SharedString;
+class Wait;
+class Heap;
+struct CallFrame;
+
 struct Obj {
     ObjType type;
+    Obj* next; // the owning heap's list of objects
 };
 
 struct ObjString {
@@ -18,6 +46,162 @@ struct ObjString {
     int length;
     char* chars;
     u32 hash;
+    SharedString* shared; // a copy of 'chars' other isolates share, once the string was sent
+};
+
+struct ObjFunction {
+    Obj obj;
+    int arity;
+    ByteCode byteCode;
+    ObjString* name; // nullptr for the top-level script
+};
+
+// natives read their arguments straight off the VM stack and write their
+// result into args[-1], the callee's slot. On failure they report through
+// GlangVm::runtimeError and return false.
+using NativeFn = bool (*)(GlangVm& vm, int argCount, Value* args);
+
+struct ObjNative {
+    Obj obj;
+    NativeFn function;
+    int arity; // -1 accepts any number of arguments
+    ObjString* name;
+    void* data; // whatever the embedder registered the native with
+};
+
+// Arrays of numbers only are kept 'packed': the doubles are stored unboxed
+// in 'numbers'. The first non-number stored moves the array to boxed
+// 'values' for good.
+struct ObjArray {
+    Obj obj;
+    bool packed;
+    bool readOnly; // a worker's copy of a global, in a parallel loop
+    bool lent;     // read by the workers of a running parallel loop as it is
+    int count;
+    int capacity;
+    union {
+        double* numbers;
+        Value* values;
+    };
+};
+
+struct MapEntry {
+    Value key;
+    Value value;
+    u32 hash;
+    bool deleted;
+};
+
+// An insertion-ordered hash map: 'entries' is a dense array in insertion
+// order and 'index' is an open-addressed table of positions into it, so
+// iteration walks contiguous memory and probing touches only small ints.
+struct ObjMap {
+    Obj obj;
+    int count;      // live entries
+    int entryCount; // used slots of 'entries', deleted ones included
+    int entryCapacity;
+    MapEntry* entries;
+    int indexCapacity; // a power of two
+    std::int32_t* index;
+    bool readOnly; // a worker's copy of a global, in a parallel loop
+};
+
+struct ObjClass;
+
+// A hidden class: the ordered list of fields an instance has. Instances
+// that gained the same fields in the same order share one shape, so a
+// field is a fixed slot in the instance's flat 'fields' array. Each class
+// owns the root of its shape tree, so a shape also identifies the class.
+struct ObjShape {
+    Obj obj;
+    ObjClass* klass;
+    std::vector<ObjString*> keys; // keys[slot] names the field in 'slot'
+    std::vector<std::pair<ObjString*, ObjShape*>> transitions;
+};
+
+struct ObjClass {
+    Obj obj;
+    ObjString* name;
+    HashTable methods;
+    ObjFunction* initializer; // the 'init' method, if any
+    ObjShape* rootShape;
+};
+
+struct ObjInstance {
+    Obj obj;
+    ObjClass* klass;
+    ObjShape* shape;
+    int capacity;
+    Value* fields;
+};
+
+struct ObjBoundMethod {
+    Obj obj;
+    Value receiver;
+    ObjFunction* method;
+};
+
+enum class FiberState : u8 {
+    Ready,     // in the run queue
+    Running,
+    Waiting,   // in join() or iterating a generator
+    Suspended, // a generator between values
+    Done
+};
+
+// A call stack of its own, run by its VM's scheduler. Switching fibers
+// only changes which stack the VM works on. A stack starts just big
+// enough for its function, grows on calls and is freed once the fiber
+// returns.
+//
+// A generator is a fiber too, one that is never in the run queue: a
+// for-in loop resumes it for each value and it hands the value back
+// with 'yield'.
+struct ObjFiber {
+    Obj obj;
+    FiberState state;
+    int frameCount;
+    int frameCapacity;
+    CallFrame* frames;
+    int stackCapacity;
+    Value* stack;
+    Value* stackTop;
+    Value result;      // what the function returned once Done; for a generator, what it yielded last
+    bool pending;      // a generator's 'result' is a value its loop has yet to take
+    ObjFiber* next;    // in the run queue, or among the waiters of a fiber
+    ObjFiber* waiters; // fibers joining this one
+    ObjFiber* resumer; // the fiber iterating this generator, while it runs
+    Wait* wait;        // what the fiber waits for while parked, owned
+    int parkedAt;      // its place among the VM's parked fibers, while it waits
+};
+
+// what range() returns: the numbers from 'start' up to 'end', exclusive,
+// 'step' apart; 'step' is negative for a range counting down
+struct ObjRange {
+    Obj obj;
+    double start;
+    double end;
+    double step;
+};
+
+// what readLines() and commandLines() return: a file, or a command's
+// output, read a line at a time as a loop asks for them through one buffer
+struct ObjLines {
+    Obj obj;
+    int fd;  // -1 once the end was reached
+    int pid; // the command, until it is reaped; 0 for a file
+    char* buffer;
+    int capacity;
+    int start; // the bytes read but not returned yet are [start, end)
+    int end;
+    Wait* read; // the loop whose read into 'buffer' is in flight, which must stay put
+};
+
+// a channel as one isolate sees it; every isolate holding the channel has
+// an ObjChannel of its own
+struct ObjChannel {
+    Obj obj;
+    std::shared_ptr<Channel> channel;
 };
 
 inline bool isObjType(Value value, ObjType type) {
@@ -31,12 +215,70 @@ inline ObjString* asString(Value value) { return (ObjString*)value.asObj(); }
 inline char* asCString(Value value) {
     return ((ObjString*)value.asObj())->chars;
 }
+inline bool isFunction(Value value) { return isObjType(value, OBJ_FUNCTION); }
+inline ObjFunction* asFunction(Value value) { return (ObjFunction*)value.asObj(); }
+inline bool isNative(Value value) { return isObjType(value, OBJ_NATIVE); }
+inline ObjNative* asNative(Value value) { return (ObjNative*)value.asObj(); }
+inline bool isArray(Value value) { return isObjType(value, OBJ_ARRAY); }
+inline ObjArray* asArray(Value value) { return (ObjArray*)value.asObj(); }
+
+inline bool isMap(Value value) { return isObjType(value, OBJ_MAP); }
+inline ObjMap* asMap(Value value) { return (ObjMap*)value.asObj(); }
+
+inline bool isClass(Value value) { return isObjType(value, OBJ_CLASS); }
+inline ObjClass* asClass(Value value) { return (ObjClass*)value.asObj(); }
+inline bool isInstance(Value value) { return isObjType(value, OBJ_INSTANCE); }
+inline ObjInstance* asInstance(Value value) { return (ObjInstance*)value.asObj(); }
+inline bool isBoundMethod(Value value) { return isObjType(value, OBJ_BOUND_METHOD); }
+inline ObjBoundMethod* asBoundMethod(Value value) { return (ObjBoundMethod*)value.asObj(); }
+inline bool isFiber(Value value) { return isObjType(value, OBJ_FIBER); }
+inline ObjFiber* asFiber(Value value) { return (ObjFiber*)value.asObj(); }
+inline bool isRange(Value value) { return isObjType(value, OBJ_RANGE); }
+inline ObjRange* asRange(Value value) { return (ObjRange*)value.asObj(); }
+inline bool isLines(Value value) { return isObjType(value, OBJ_LINES); }
+inline ObjLines* asLines(Value value) { return (ObjLines*)value.asObj(); }
+inline bool isChannel(Value value) { return isObjType(value, OBJ_CHANNEL); }
+inline ObjChannel* asChannel(Value value) { return (ObjChannel*)value.asObj(); }
+
+std::string arrayToString(ObjArray* array);
+std::string mapToString(ObjMap* map);
+// what a script calls the kind of object 'value' holds, for errors
+const char* kindName(Value value);
+
+inline std::string functionName(ObjFunction* function) {
+    if (function->name == nullptr) return "<script>";
+    return fmt::format("<fn {}>", function->name->chars);
+}
 
 inline std::string toString(Value value) {
     switch (object::objType(value)) {
     case OBJ_STRING:
         return fmt::format("{}", object::asCString(value));
         break;
+    case OBJ_FUNCTION:
+        return functionName(asFunction(value));
+    case OBJ_NATIVE:
+        return fmt::format("<native fn {}>", asNative(value)->name->chars);
+    case OBJ_ARRAY:
+        return arrayToString(asArray(value));
+    case OBJ_MAP:
+        return mapToString(asMap(value));
+    case OBJ_CLASS:
+        return fmt::format("<class {}>", asClass(value)->name->chars);
+    case OBJ_SHAPE:
+        return "<shape>";
+    case OBJ_INSTANCE:
+        return fmt::format("<{} instance>", asInstance(value)->klass->name->chars);
+    case OBJ_BOUND_METHOD:
+        return functionName(asBoundMethod(value)->method);
+    case OBJ_FIBER:
+        return "<fiber>";
+    case OBJ_RANGE:
+        return "<range>";
+    case OBJ_LINES:
+        return "<lines>";
+    case OBJ_CHANNEL:
+        return "<channel>";
     }
 }
 }
@@ -60,10 +302,38 @@ public:
     static ObjString* allocateString(char* chars, int length, u32 hash);
     static ObjString* copyString(const char* chars, int length);
     static ObjString* takeString(char* chars, int length);
+    // the string 'shared' holds, interned in the current heap without
+    // copying its characters
+    static ObjString* shareString(SharedString* shared);
+    static ObjFunction* newFunction();
+    static ObjNative* newNative(NativeFn function, int arity, ObjString* name, void* data = nullptr);
+    static ObjArray* newArray(int capacity);
+    static ObjMap* newMap();
+    static ObjClass* newClass(ObjString* name);
+    static ObjShape* newShape(ObjClass* klass);
+    static ObjInstance* newInstance(ObjClass* klass);
+    static ObjBoundMethod* newBoundMethod(Value receiver, ObjFunction* method);
+    // a fiber with no stack yet; GlangVm::spawn() gives it one
+    static ObjFiber* newFiber();
+    static ObjRange* newRange(double start, double end, double step);
+    // takes ownership of 'fd' and of the process 'pid', if there is one
+    static ObjLines* newLines(int fd, int pid);
+    static ObjChannel* newChannel(std::shared_ptr<Channel> channel);
+
+    // the current heap's intern table
+    static HashTable& get();
 
-    static HashTable& get() { return strings_; }
+    struct Stats {
+        u64 objects[ObjTypeCount];
+        u64 bytes[ObjTypeCount]; // object headers, plus the characters of strings
+        u64 internHits;
+        u64 internMisses;
+    };
+    static const Stats& stats() { return stats_; }
 
 private:
+    friend Heap;
+
     static Obj* allocateObject(size_t size, ObjType type);
 
     template <typename T>
@@ -72,5 +342,8 @@ private:
     }
 
 private:
-    static HashTable strings_;
+    static void freeObject(Obj* object);
+
+private:
+    static thread_local Stats stats_;
 };
@@ -5,21 +5,23 @@
 #include <string>
 #include <iostream>
 
-#include "Vm.hh"
+#include "Session.hh"
 
-// more work needs to be done on the REPL
-// like handling multi-line inputs
+// one session for the whole REPL, so globals defined on one line are
+// there on the next; unfinished input continues on a '...' prompt
 inline void repl() {
+    Session session;
     std::string line;
 
     while (true) {
-        fmt::print(">>> ");
+        fmt::print(session.pending() ? "... " : ">>> ");
+        std::fflush(stdout);
 
         if (!std::getline(std::cin, line)) {
             fmt::print("\n");
             break;
         }
 
-        interpret(line);
+        session.feed(line);
     }
-}
\ No newline at end of file
+}
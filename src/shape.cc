@@ -0,0 +1,31 @@
+#include "shape.hh"
+#include "memory.hh"
+
+namespace shape {
+
+ObjShape* transition(ObjShape* shape, ObjString* key) {
+    for (auto& [transitionKey, child] : shape->transitions) {
+        if (transitionKey == key) return child;
+    }
+
+    ObjShape* child = ObjFactory::newShape(shape->klass);
+    child->keys = shape->keys;
+    child->keys.push_back(key);
+    shape->transitions.emplace_back(key, child);
+    return child;
+}
+}
+
+namespace instance {
+
+void reshape(ObjInstance* instance, ObjShape* shape) {
+    int needed = static_cast<int>(shape->keys.size());
+    if (needed > instance->capacity) {
+        int capacity = instance->capacity < 4 ? 4 : instance->capacity * 2;
+        while (capacity < needed) capacity *= 2;
+        instance->fields = static_cast<Value*>(memory::reallocate(instance->fields, sizeof(Value) * instance->capacity, sizeof(Value) * capacity));
+        instance->capacity = capacity;
+    }
+    instance->shape = shape;
+}
+}
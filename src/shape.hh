@@ -0,0 +1,24 @@
+#pragma once
+
+#include "common.hh"
+#include "object.hh"
+
+namespace shape {
+// the slot of field 'key', or -1
+inline int lookup(const ObjShape* shape, const ObjString* key) {
+    const auto& keys = shape->keys;
+    for (size i = 0; i < keys.size(); ++i) {
+        if (keys[i] == key) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+// the shape reached from 'shape' by adding field 'key'; shared by every
+// instance that takes the same transition
+ObjShape* transition(ObjShape* shape, ObjString* key);
+}
+
+namespace instance {
+// moves 'instance' to 'shape', growing its field storage if needed
+void reshape(ObjInstance* instance, ObjShape* shape);
+}
@@ -0,0 +1,300 @@
+#include "simd.hh"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GLANG_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace simd {
+
+struct Kernels {
+    const char* name;
+    double (*sum)(const double*, size);
+    double (*min)(const double*, size);
+    double (*max)(const double*, size);
+    double (*dot)(const double*, const double*, size);
+    void (*add)(const double*, const double*, double*, size);
+    void (*sub)(const double*, const double*, double*, size);
+    void (*mul)(const double*, const double*, double*, size);
+    void (*div)(const double*, const double*, double*, size);
+    void (*addScalar)(const double*, double, double*, size);
+    void (*mulScalar)(const double*, double, double*, size);
+    void (*negate)(const double*, double*, size);
+    void (*fill)(double*, double, size);
+};
+
+namespace scalar {
+    static double sum(const double* x, size n) {
+        double total = 0;
+        for (size i = 0; i < n; ++i) total += x[i];
+        return total;
+    }
+    static double min(const double* x, size n) {
+        double result = x[0];
+        for (size i = 1; i < n; ++i) result = std::min(result, x[i]);
+        return result;
+    }
+    static double max(const double* x, size n) {
+        double result = x[0];
+        for (size i = 1; i < n; ++i) result = std::max(result, x[i]);
+        return result;
+    }
+    static double dot(const double* x, const double* y, size n) {
+        double total = 0;
+        for (size i = 0; i < n; ++i) total += x[i] * y[i];
+        return total;
+    }
+    static void add(const double* x, const double* y, double* out, size n) {
+        for (size i = 0; i < n; ++i) out[i] = x[i] + y[i];
+    }
+    static void sub(const double* x, const double* y, double* out, size n) {
+        for (size i = 0; i < n; ++i) out[i] = x[i] - y[i];
+    }
+    static void mul(const double* x, const double* y, double* out, size n) {
+        for (size i = 0; i < n; ++i) out[i] = x[i] * y[i];
+    }
+    static void div(const double* x, const double* y, double* out, size n) {
+        for (size i = 0; i < n; ++i) out[i] = x[i] / y[i];
+    }
+    static void addScalar(const double* x, double scalar, double* out, size n) {
+        for (size i = 0; i < n; ++i) out[i] = x[i] + scalar;
+    }
+    static void mulScalar(const double* x, double scalar, double* out, size n) {
+        for (size i = 0; i < n; ++i) out[i] = x[i] * scalar;
+    }
+    static void negate(const double* x, double* out, size n) {
+        for (size i = 0; i < n; ++i) out[i] = -x[i];
+    }
+    static void fill(double* out, double value, size n) {
+        std::fill(out, out + n, value);
+    }
+
+    static const Kernels kernels = {"scalar", sum, min, max, dot, add, sub, mul, div, addScalar, mulScalar, negate, fill};
+}
+
+#ifdef GLANG_SIMD_X86
+
+// The elementwise kernels share one shape: full vectors, then a scalar tail.
+#define GLANG_BINARY_KERNEL(name, width, vtype, load, store, vop, op) \
+    static void name(const double* x, const double* y, double* out, size n) { \
+        size i = 0;                                                         \
+        for (; i + (width) <= n; i += (width)) {                            \
+            vtype a = load(x + i);                                          \
+            vtype b = load(y + i);                                          \
+            store(out + i, vop(a, b));                                      \
+        }                                                                   \
+        for (; i < n; ++i) out[i] = x[i] op y[i];                           \
+    }
+
+#define GLANG_SCALAR_KERNEL(name, width, vtype, load, store, set1, vop, op) \
+    static void name(const double* x, double scalar, double* out, size n) { \
+        size i = 0;                                                          \
+        vtype s = set1(scalar);                                              \
+        for (; i + (width) <= n; i += (width)) {                             \
+            store(out + i, vop(load(x + i), s));                             \
+        }                                                                    \
+        for (; i < n; ++i) out[i] = x[i] op scalar;                          \
+    }
+
+namespace sse2 {
+    GLANG_BINARY_KERNEL(add, 2, __m128d, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, +)
+    GLANG_BINARY_KERNEL(sub, 2, __m128d, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd, -)
+    GLANG_BINARY_KERNEL(mul, 2, __m128d, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd, *)
+    GLANG_BINARY_KERNEL(div, 2, __m128d, _mm_loadu_pd, _mm_storeu_pd, _mm_div_pd, /)
+    GLANG_SCALAR_KERNEL(addScalar, 2, __m128d, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_add_pd, +)
+    GLANG_SCALAR_KERNEL(mulScalar, 2, __m128d, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_mul_pd, *)
+
+    static double sum(const double* x, size n) {
+        __m128d acc0 = _mm_setzero_pd();
+        __m128d acc1 = _mm_setzero_pd();
+        size i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc0 = _mm_add_pd(acc0, _mm_loadu_pd(x + i));
+            acc1 = _mm_add_pd(acc1, _mm_loadu_pd(x + i + 2));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+        double total = lanes[0] + lanes[1];
+        for (; i < n; ++i) total += x[i];
+        return total;
+    }
+
+    static double dot(const double* x, const double* y, size n) {
+        __m128d acc0 = _mm_setzero_pd();
+        __m128d acc1 = _mm_setzero_pd();
+        size i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+            acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+        double total = lanes[0] + lanes[1];
+        for (; i < n; ++i) total += x[i] * y[i];
+        return total;
+    }
+
+    static double min(const double* x, size n) {
+        if (n < 2) return x[0];
+        __m128d acc = _mm_loadu_pd(x);
+        size i = 2;
+        for (; i + 2 <= n; i += 2) acc = _mm_min_pd(acc, _mm_loadu_pd(x + i));
+        double lanes[2];
+        _mm_storeu_pd(lanes, acc);
+        double result = std::min(lanes[0], lanes[1]);
+        for (; i < n; ++i) result = std::min(result, x[i]);
+        return result;
+    }
+
+    static double max(const double* x, size n) {
+        if (n < 2) return x[0];
+        __m128d acc = _mm_loadu_pd(x);
+        size i = 2;
+        for (; i + 2 <= n; i += 2) acc = _mm_max_pd(acc, _mm_loadu_pd(x + i));
+        double lanes[2];
+        _mm_storeu_pd(lanes, acc);
+        double result = std::max(lanes[0], lanes[1]);
+        for (; i < n; ++i) result = std::max(result, x[i]);
+        return result;
+    }
+
+    static void negate(const double* x, double* out, size n) {
+        mulScalar(x, -1.0, out, n);
+    }
+
+    static void fill(double* out, double value, size n) {
+        __m128d v = _mm_set1_pd(value);
+        size i = 0;
+        for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, v);
+        for (; i < n; ++i) out[i] = value;
+    }
+
+    static const Kernels kernels = {"sse2", sum, min, max, dot, add, sub, mul, div, addScalar, mulScalar, negate, fill};
+}
+
+#define GLANG_AVX2 __attribute__((target("avx2")))
+
+namespace avx2 {
+    GLANG_AVX2 GLANG_BINARY_KERNEL(add, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, +)
+    GLANG_AVX2 GLANG_BINARY_KERNEL(sub, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_sub_pd, -)
+    GLANG_AVX2 GLANG_BINARY_KERNEL(mul, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd, *)
+    GLANG_AVX2 GLANG_BINARY_KERNEL(div, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_div_pd, /)
+    GLANG_AVX2 GLANG_SCALAR_KERNEL(addScalar, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_add_pd, +)
+    GLANG_AVX2 GLANG_SCALAR_KERNEL(mulScalar, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_mul_pd, *)
+
+    GLANG_AVX2 static double horizontalAdd(__m256d v) {
+        __m128d low = _mm256_castpd256_pd128(v);
+        __m128d high = _mm256_extractf128_pd(v, 1);
+        low = _mm_add_pd(low, high);
+        return _mm_cvtsd_f64(_mm_add_sd(low, _mm_unpackhi_pd(low, low)));
+    }
+
+    // four independent accumulators hide the latency of the adds
+    GLANG_AVX2 static double sum(const double* x, size n) {
+        __m256d acc0 = _mm256_setzero_pd();
+        __m256d acc1 = _mm256_setzero_pd();
+        __m256d acc2 = _mm256_setzero_pd();
+        __m256d acc3 = _mm256_setzero_pd();
+        size i = 0;
+        for (; i + 16 <= n; i += 16) {
+            acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(x + i));
+            acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(x + i + 4));
+            acc2 = _mm256_add_pd(acc2, _mm256_loadu_pd(x + i + 8));
+            acc3 = _mm256_add_pd(acc3, _mm256_loadu_pd(x + i + 12));
+        }
+        for (; i + 4 <= n; i += 4) acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(x + i));
+        double total = horizontalAdd(_mm256_add_pd(_mm256_add_pd(acc0, acc1), _mm256_add_pd(acc2, acc3)));
+        for (; i < n; ++i) total += x[i];
+        return total;
+    }
+
+    GLANG_AVX2 static double dot(const double* x, const double* y, size n) {
+        __m256d acc0 = _mm256_setzero_pd();
+        __m256d acc1 = _mm256_setzero_pd();
+        size i = 0;
+        for (; i + 8 <= n; i += 8) {
+            acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+            acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+        }
+        for (; i + 4 <= n; i += 4) acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+        double total = horizontalAdd(_mm256_add_pd(acc0, acc1));
+        for (; i < n; ++i) total += x[i] * y[i];
+        return total;
+    }
+
+    GLANG_AVX2 static double min(const double* x, size n) {
+        if (n < 4) return scalar::min(x, n);
+        __m256d acc = _mm256_loadu_pd(x);
+        size i = 4;
+        for (; i + 4 <= n; i += 4) acc = _mm256_min_pd(acc, _mm256_loadu_pd(x + i));
+        double lanes[4];
+        _mm256_storeu_pd(lanes, acc);
+        double result = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+        for (; i < n; ++i) result = std::min(result, x[i]);
+        return result;
+    }
+
+    GLANG_AVX2 static double max(const double* x, size n) {
+        if (n < 4) return scalar::max(x, n);
+        __m256d acc = _mm256_loadu_pd(x);
+        size i = 4;
+        for (; i + 4 <= n; i += 4) acc = _mm256_max_pd(acc, _mm256_loadu_pd(x + i));
+        double lanes[4];
+        _mm256_storeu_pd(lanes, acc);
+        double result = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+        for (; i < n; ++i) result = std::max(result, x[i]);
+        return result;
+    }
+
+    GLANG_AVX2 static void negate(const double* x, double* out, size n) {
+        mulScalar(x, -1.0, out, n);
+    }
+
+    GLANG_AVX2 static void fill(double* out, double value, size n) {
+        __m256d v = _mm256_set1_pd(value);
+        size i = 0;
+        for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, v);
+        for (; i < n; ++i) out[i] = value;
+    }
+
+    static const Kernels kernels = {"avx2", sum, min, max, dot, add, sub, mul, div, addScalar, mulScalar, negate, fill};
+}
+
+#undef GLANG_AVX2
+#undef GLANG_SCALAR_KERNEL
+#undef GLANG_BINARY_KERNEL
+
+#endif
+
+static const Kernels& select() {
+#ifdef GLANG_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return avx2::kernels;
+    if (__builtin_cpu_supports("sse2")) return sse2::kernels;
+#endif
+    return scalar::kernels;
+}
+
+static const Kernels& kernels() {
+    static const Kernels& selected = select();
+    return selected;
+}
+
+double sum(const double* x, size n) { return kernels().sum(x, n); }
+double min(const double* x, size n) { return kernels().min(x, n); }
+double max(const double* x, size n) { return kernels().max(x, n); }
+double dot(const double* x, const double* y, size n) { return kernels().dot(x, y, n); }
+
+void add(const double* x, const double* y, double* out, size n) { kernels().add(x, y, out, n); }
+void sub(const double* x, const double* y, double* out, size n) { kernels().sub(x, y, out, n); }
+void mul(const double* x, const double* y, double* out, size n) { kernels().mul(x, y, out, n); }
+void div(const double* x, const double* y, double* out, size n) { kernels().div(x, y, out, n); }
+void addScalar(const double* x, double scalar, double* out, size n) { kernels().addScalar(x, scalar, out, n); }
+void mulScalar(const double* x, double scalar, double* out, size n) { kernels().mulScalar(x, scalar, out, n); }
+void negate(const double* x, double* out, size n) { kernels().negate(x, out, n); }
+void fill(double* out, double value, size n) { kernels().fill(out, value, n); }
+
+const char* isaName() { return kernels().name; }
+}
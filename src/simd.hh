@@ -0,0 +1,24 @@
+#pragma once
+
+#include "common.hh"
+
+// Bulk kernels over unboxed doubles. The first call binds every kernel to
+// the widest implementation the CPU supports: AVX2, SSE2 or scalar code.
+namespace simd {
+double sum(const double* x, size n);
+double min(const double* x, size n); // n > 0
+double max(const double* x, size n); // n > 0
+double dot(const double* x, const double* y, size n);
+
+void add(const double* x, const double* y, double* out, size n);
+void sub(const double* x, const double* y, double* out, size n);
+void mul(const double* x, const double* y, double* out, size n);
+void div(const double* x, const double* y, double* out, size n);
+void addScalar(const double* x, double scalar, double* out, size n);
+void mulScalar(const double* x, double scalar, double* out, size n);
+void negate(const double* x, double* out, size n);
+void fill(double* out, double value, size n);
+
+// "avx2", "sse2" or "scalar"
+const char* isaName();
+}
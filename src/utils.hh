@@ -6,20 +6,25 @@
 #include <fstream>
 
 namespace utils {
-inline std::string readTextFile(const char* filename) {
+inline bool tryReadTextFile(const char* filename, std::string& content) {
     std::ifstream file{filename, std::ios::ate | std::ios::in};
+    if (!file.is_open()) return false;
 
-    if (!file.is_open()) {
-        fmt::print("Failed to open file: {}", filename);
-        std::exit(74);
-    }
     auto size = file.tellg();
-    std::string content(size, 0);
+    content.assign(size, 0);
 
     file.seekg(0, std::ios::beg);
 
     file.read(content.data(), size);
-    // fmt::print("content is {}", content);
+    return true;
+}
+
+inline std::string readTextFile(const char* filename) {
+    std::string content;
+    if (!tryReadTextFile(filename, content)) {
+        fmt::print("Failed to open file: {}", filename);
+        std::exit(74);
+    }
     return content;
 }
 }
\ No newline at end of file
@@ -0,0 +1,300 @@
+#include "verifier.hh"
+
+#include "ByteCode.hh"
+#include "object.hh"
+
+#include <vector>
+
+namespace verifier {
+
+static u8 readByte(const ByteCode& code, int offset) {
+    return toU8(code.getOpCode(offset));
+}
+
+static u16 readShort(const ByteCode& code, int offset) {
+    return static_cast<u16>((readByte(code, offset) << 8) | readByte(code, offset + 1));
+}
+
+static bool fail(std::string& error, int offset, std::string_view message) {
+    error = fmt::format("offset {}: {}", offset, message);
+    return false;
+}
+
+static bool usesNameConstant(OpCode op) {
+    switch (op) {
+    case OpCode::DefineGlobal:
+    case OpCode::GetGlobal:
+    case OpCode::SetGlobal:
+    case OpCode::Class:
+    case OpCode::Method:
+    case OpCode::GetProperty:
+    case OpCode::SetProperty:
+    case OpCode::Invoke:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// first pass: instruction boundaries and the operands that index into tables
+static bool checkOperands(const ByteCode& code, std::vector<bool>& boundary, std::string& error) {
+    int codeSize = static_cast<int>(code.codeSize());
+    int constants = static_cast<int>(code.constantCount());
+    int caches = static_cast<int>(code.cacheCount());
+
+    for (int offset = 0; offset < codeSize;) {
+        u8 byte = readByte(code, offset);
+        if (byte >= OpCodeCount) {
+            return fail(error, offset, fmt::format("unknown opcode {}", byte));
+        }
+
+        auto op = toOp(byte);
+        int length = instructionLength(op);
+        if (offset + length > codeSize) {
+            return fail(error, offset, "truncated instruction");
+        }
+        boundary[offset] = true;
+
+        if (op == OpCode::Constant || usesNameConstant(op)) {
+            int constant = readByte(code, offset + 1);
+            if (constant >= constants) {
+                return fail(error, offset, fmt::format("constant {} out of range", constant));
+            }
+            if (usesNameConstant(op) && !object::isString(code.getConstantAtOffset(constant))) {
+                return fail(error, offset, "name operand is not a string");
+            }
+        }
+        if (op == OpCode::ForRangeStep) {
+            int constant = readByte(code, offset + 3);
+            if (constant >= constants || !code.getConstantAtOffset(constant).isNumber()) {
+                return fail(error, offset, "loop step is not a number constant");
+            }
+        }
+        if (op == OpCode::ParallelFor) {
+            // the body the parser built: (first, last, start, step, accumulator)
+            int constant = readByte(code, offset + 1);
+            Value body = constant < constants ? code.getConstantAtOffset(constant) : Value::createNil();
+            if (!object::isFunction(body) || object::asFunction(body)->arity != 5) {
+                return fail(error, offset, "parallel loop body is not a function of five parameters");
+            }
+            if (readByte(code, offset + 2) > static_cast<u8>(Reduction::Product)) {
+                return fail(error, offset, "unknown reduction");
+            }
+        }
+        if (op == OpCode::GetProperty || op == OpCode::SetProperty || op == OpCode::Invoke) {
+            int cache = readShort(code, offset + length - 2);
+            if (cache >= caches) {
+                return fail(error, offset, fmt::format("inline cache {} out of range", cache));
+            }
+        }
+
+        offset += length;
+    }
+    return true;
+}
+
+// second pass: walks every path through the code tracking the stack depth
+static bool checkStack(const ByteCode& code, const std::vector<bool>& boundary, int slots, int& maxStack, std::string& error) {
+    int codeSize = static_cast<int>(code.codeSize());
+    std::vector<int> depths(codeSize, -1);
+    std::vector<int> pending;
+
+    depths[0] = slots;
+    pending.push_back(0);
+    maxStack = slots;
+
+    while (!pending.empty()) {
+        int offset = pending.back();
+        pending.pop_back();
+
+        auto op = code.getOpCode(offset);
+        int length = instructionLength(op);
+        int depth = depths[offset];
+        int needs = 0;
+        int effect = 0;
+        int target = 0;
+        bool jumps = false;
+        bool fallsThrough = true;
+
+        switch (op) {
+        case OpCode::Return:
+            needs = 1;
+            fallsThrough = false;
+            break;
+        case OpCode::Constant:
+        case OpCode::Nil:
+        case OpCode::True:
+        case OpCode::False:
+        case OpCode::GetGlobal:
+        case OpCode::Class:
+            effect = 1;
+            break;
+        case OpCode::GetLocal:
+        case OpCode::SetLocal:
+            if (readByte(code, offset + 1) >= depth) {
+                return fail(error, offset, "local slot out of range");
+            }
+            needs = op == OpCode::SetLocal ? 1 : 0;
+            effect = op == OpCode::GetLocal ? 1 : 0;
+            break;
+        case OpCode::Negate:
+        case OpCode::Not:
+        case OpCode::SetGlobal:
+        case OpCode::GetProperty:
+            needs = 1;
+            break;
+        case OpCode::Add:
+        case OpCode::Subtract:
+        case OpCode::Multiply:
+        case OpCode::Divide:
+        case OpCode::Equal:
+        case OpCode::Greater:
+        case OpCode::Less:
+        case OpCode::IndexGet:
+        case OpCode::Method:
+        case OpCode::SetProperty:
+            needs = 2;
+            effect = -1;
+            break;
+        case OpCode::Print:
+        case OpCode::Pop:
+        case OpCode::DefineGlobal:
+            needs = 1;
+            effect = -1;
+            break;
+        case OpCode::IndexSet:
+            needs = 3;
+            effect = -2;
+            break;
+        case OpCode::JmpIfFalse:
+            needs = 1;
+            target = offset + length + readShort(code, offset + 1);
+            jumps = true;
+            break;
+        case OpCode::Jmp:
+            target = offset + length + readShort(code, offset + 1);
+            jumps = true;
+            fallsThrough = false;
+            break;
+        case OpCode::Loop:
+            target = offset + length - readShort(code, offset + 1);
+            jumps = true;
+            fallsThrough = false;
+            break;
+        case OpCode::Call:
+        case OpCode::TailCall: {
+            int argCount = readByte(code, offset + 1);
+            needs = argCount + 1;
+            effect = -argCount;
+            break;
+        }
+        case OpCode::Invoke: {
+            int argCount = readByte(code, offset + 2);
+            needs = argCount + 1;
+            effect = -argCount;
+            break;
+        }
+        case OpCode::BuildArray: {
+            int count = readByte(code, offset + 1);
+            needs = count;
+            effect = 1 - count;
+            break;
+        }
+        case OpCode::BuildMap: {
+            int count = 2 * readByte(code, offset + 1);
+            needs = count;
+            effect = 1 - count;
+            break;
+        }
+        case OpCode::ForRangeInit:
+        case OpCode::ForRangeStep: {
+            // the counter and its limit live in two adjacent locals
+            if (readByte(code, offset + 1) + 1 >= depth) {
+                return fail(error, offset, "loop counter slot out of range");
+            }
+            int jump = readShort(code, offset + length - 2);
+            target = op == OpCode::ForRangeInit ? offset + length + jump : offset + length - jump;
+            jumps = true;
+            break;
+        }
+        case OpCode::Yield:
+            needs = 1;
+            effect = -1;
+            break;
+        case OpCode::ForIn:
+            // the iterable, its cursor and the loop variable
+            if (readByte(code, offset + 1) + 2 >= depth) {
+                return fail(error, offset, "loop slots out of range");
+            }
+            target = offset + length + readShort(code, offset + 2);
+            jumps = true;
+            break;
+        case OpCode::ParallelFor:
+            needs = 1;
+            break;
+        case OpCode::Generator:
+            if (offset != 0) {
+                return fail(error, offset, "Generator must come first");
+            }
+            break;
+        }
+
+        if (depth < needs) {
+            return fail(error, offset, "stack underflow");
+        }
+        depth += effect;
+        if (depth > maxStack) maxStack = depth;
+
+        int successors[2];
+        int successorCount = 0;
+        if (fallsThrough) successors[successorCount++] = offset + length;
+        if (jumps) successors[successorCount++] = target;
+
+        for (int i = 0; i < successorCount; ++i) {
+            int next = successors[i];
+            if (next < 0 || next >= codeSize) {
+                return fail(error, offset, "control flow leaves the code");
+            }
+            if (!boundary[next]) {
+                return fail(error, offset, "jump into the middle of an instruction");
+            }
+            if (depths[next] == -1) {
+                depths[next] = depth;
+                pending.push_back(next);
+            } else if (depths[next] != depth) {
+                return fail(error, next, "stack depth differs between paths");
+            }
+        }
+    }
+    return true;
+}
+
+bool verify(ByteCode& code, int slots, std::string& error) {
+    if (code.verified()) return true;
+
+    if (code.codeSize() == 0) {
+        error = "empty code";
+        return false;
+    }
+
+    std::vector<bool> boundary(code.codeSize(), false);
+    int maxStack = 0;
+    if (!checkOperands(code, boundary, error) || !checkStack(code, boundary, slots, maxStack, error)) {
+        return false;
+    }
+
+    for (size i = 0; i < code.constantCount(); ++i) {
+        Value constant = code.getConstantAtOffset(static_cast<int>(i));
+        if (!object::isFunction(constant)) continue;
+
+        ObjFunction* function = object::asFunction(constant);
+        if (!verify(function->byteCode, function->arity + 1, error)) {
+            error = fmt::format("{} {}", object::functionName(function), error);
+            return false;
+        }
+    }
+
+    code.markVerified(maxStack);
+    return true;
+}
+}
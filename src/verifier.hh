@@ -0,0 +1,21 @@
+#pragma once
+
+#include "common.hh"
+
+#include <string>
+
+class ByteCode;
+
+// One pass over compiled code before it runs. Checks that every opcode is
+// known, operands stay inside the code, constant pool and cache table, jumps
+// land on instruction boundaries, locals refer to live slots and the stack
+// never underflows and has the same depth wherever control flow merges.
+// Functions found in the constant pool are checked the same way.
+//
+// Code that passes gets its maximum stack depth recorded, which lets the
+// interpreter loop run without any per-instruction checks and reserve stack
+// space once per call instead.
+namespace verifier {
+// 'slots' is the stack depth on entry: 0 for a script, arity + 1 for a function
+bool verify(ByteCode& code, int slots, std::string& error);
+}